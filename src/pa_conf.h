@@ -173,6 +173,14 @@
  */
 #define PA_RUN_DELAY 20
 
+/**
+ * Monotonic clock, in microseconds, used to measure the time spent executing
+ * prefix assignment routines.
+ *   uint64_t pa_clock_us(void)
+ *   (Optional - Default to CLOCK_MONOTONIC)
+ */
+//#define pa_clock_us() my_clock_us()
+
 /**
  * The pa_ldp structure may contains PA_LDP_USERS void * pointers, to be used
  * by users for storing private data.
@@ -180,6 +188,96 @@
  */
 #define PA_LDP_USERS 2
 
+/**
+ * Number of candidate prefixes for which conflicting Assigned and Advertised
+ * Prefixes are summarized and remembered during a single routine execution.
+ * Rules checking the same candidate multiple times (e.g. in get_max_priority
+ * and match) only walk the prefix tree once.
+ * Set to 0 in order to disable memoization.
+ *    (Optional - Default to 8)
+ */
+#define PA_CONFLICT_CACHE_SIZE 8
+
+/**
+ * Maximum number of assigned, published and applied events buffered for
+ * users implementing the batch callback. Buffered events are delivered when
+ * control is given back to the event loop, or when the buffer is full.
+ * Set to 0 in order to disable batched notifications.
+ *    (Optional - Default to 64)
+ */
+#define PA_USER_BATCH_SIZE 64
+
+/**
+ * Link/Delegated Prefix pairs, and their scheduling states, are allocated by
+ * slabs of PA_LDP_SLAB_SIZE elements (at most 256). Empty slabs are released,
+ * but one slab of scheduling states is kept until the last link is removed.
+ * Set to 0 in order to allocate each pair and state separately.
+ *    (Optional - Default to 64)
+ */
+#define PA_LDP_SLAB_SIZE 64
+
+/**
+ * Every external input of cores attached to a recorder (Configuration
+ * changes, Advertised Prefixes, timers and random values) is written into a
+ * binary log which can be replayed offline (See pa_record.h).
+ * pa_core.c, pa_rules.c and pa_record.c must be built with the same value.
+ *    (Optional - Default to 0)
+ */
+//#define PA_RECORD 1
+
+/**
+ * Performance counters (Routines, rule calls, prefix tree walks, timers and
+ * state transitions) maintained by each core and returned by
+ * pa_core_get_stats(). Counters compile out when set to 0.
+ *    (Optional - Default to 0)
+ */
+//#define PA_STATS 1
+
+/**
+ * Each rule counts the calls to its filter_accept, get_max_priority and match
+ * functions, the time spent in each of them (Using pa_clock_us), and how many
+ * times it won a routine (See pa_rule_get_stats()).
+ *    (Optional - Default to 0)
+ */
+//#define PA_RULE_STATS 1
+
+/**
+ * Each Link/Delegated Prefix pair remembers when it was created, first ran its
+ * routine, started a backoff, and was last assigned, published, adopted,
+ * applied and un-assigned (Using pa_clock_us). The core aggregates these into
+ * convergence latency histograms (See pa_core_timeline()).
+ * Costs 72 bytes per pair.
+ *    (Optional - Default to 0)
+ */
+//#define PA_TIMELINE 1
+
+/**
+ * The core measures, in microseconds, how late routine and backoff timers are
+ * executed compared to their expected expiry time, how long each routine
+ * takes, and how long each user callback takes (See pa_core_latency()).
+ * High timer lags mean the event loop is saturated.
+ * Costs 16 bytes per pair.
+ *    (Optional - Default to 0)
+ */
+//#define PA_LATENCY 1
+
+/**
+ * Number of events kept in the trace ring buffer of each core (A power of
+ * two). Pair state changes, routines, rule results and Advertised Prefixes
+ * changes are written as fixed-size binary records, without any formatting.
+ * The last events can be dumped and decoded later (See pa_trace.h).
+ * Costs about 56 bytes per event in the pa_core structure.
+ *    (Optional - Default to 0)
+ */
+//#define PA_TRACE 4096
+
+/**
+ * Size of the rule names copied into traced rule events, including the
+ * terminating null byte. Longer names are truncated.
+ *    (Optional - Default to 16)
+ */
+//#define PA_TRACE_RULE_NAME_LEN 16
+
 /**
  * Link type identifier option.
  *
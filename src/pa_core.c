@@ -13,6 +13,217 @@
 
 #include "prefix.h"
 
+#if PA_RECORD != 0
+#include "pa_record.h"
+#define pa_record(rec, type, object, value) do { \
+		if(rec) pa_record_event(rec, type, object, value); } while(0)
+#else
+#define pa_record(rec, type, object, value) do {} while(0)
+#endif
+
+#if PA_STATS != 0
+#define pa_stat(core, counter) ((core)->stats.counter++)
+#else
+#define pa_stat(core, counter) ((void)0)
+#endif
+
+#if PA_HISTOGRAMS != 0
+void pa_histogram_add(struct pa_histogram *h, uint64_t value)
+{
+	unsigned int i = 0;
+	while(value >> i && i < PA_HISTOGRAM_BUCKETS - 1)
+		i++;
+	h->buckets[i]++;
+	h->count++;
+	h->sum += value;
+	if(value > h->max)
+		h->max = value;
+}
+
+uint64_t pa_histogram_percentile(const struct pa_histogram *h,
+		unsigned int percent)
+{
+	uint64_t target, seen = 0, bound;
+	unsigned int i;
+	if(!h->count)
+		return 0;
+
+	target = (h->count * (percent > 100?100:percent) + 99) / 100;
+	for(i = 0; i < PA_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += h->buckets[i];
+		if(seen >= target && seen)
+			break;
+	}
+	bound = i?(((uint64_t)1 << i) - 1):0;
+	return (i == PA_HISTOGRAM_BUCKETS - 1 || bound > h->max)?h->max:bound;
+}
+#endif
+
+#if PA_TIMELINE != 0
+#define pa_timeline_ms(ldp, from, to) \
+	(((ldp)->timeline[to] - (ldp)->timeline[from]) / 1000)
+
+/* Remembers an ldp event, and updates convergence latency histograms. */
+static void pa_timeline(struct pa_ldp *ldp, enum pa_timeline_event event)
+{
+	struct pa_histogram *h = ldp->link->core->timeline;
+	uint8_t first = !(ldp->timeline_set & (1 << event));
+
+	if(event == PA_TL_ROUTINE && !first)
+		return;
+
+	ldp->timeline[event] = pa_clock_us();
+	ldp->timeline_set |= 1 << event;
+	switch (event) {
+	case PA_TL_ASSIGNED:
+		if(first)
+			pa_histogram_add(&h[PA_TL_H_CREATED_ASSIGNED],
+					pa_timeline_ms(ldp, PA_TL_CREATED, PA_TL_ASSIGNED));
+		if(ldp->backoff && (ldp->timeline_set & (1 << PA_TL_BACKOFF)))
+			pa_histogram_add(&h[PA_TL_H_BACKOFF_ASSIGNED],
+					pa_timeline_ms(ldp, PA_TL_BACKOFF, PA_TL_ASSIGNED));
+		break;
+	case PA_TL_APPLIED:
+		pa_histogram_add(&h[PA_TL_H_ASSIGNED_APPLIED],
+				pa_timeline_ms(ldp, PA_TL_ASSIGNED, PA_TL_APPLIED));
+		if(first)
+			pa_histogram_add(&h[PA_TL_H_CREATED_APPLIED],
+					pa_timeline_ms(ldp, PA_TL_CREATED, PA_TL_APPLIED));
+		break;
+	default:
+		break;
+	}
+}
+#else
+#define pa_timeline(ldp, event) do {} while(0)
+#endif
+
+#if PA_TRACE != 0
+/* Writes an event into the trace ring buffer. */
+static void pa_trace(struct pa_core *core, enum pa_trace_type type,
+		const void *object, const pa_prefix *prefix, pa_plen plen,
+		uint8_t value, pa_priority priority, pa_rule_priority rule_priority)
+{
+	struct pa_trace_event *e = &core->trace[core->trace_n++ & (PA_TRACE - 1)];
+	e->time = pa_clock_us();
+	e->object = object;
+	memcpy(&e->prefix, prefix, sizeof(e->prefix));
+	e->plen = plen;
+	e->type = type;
+	e->value = value;
+	e->priority = priority;
+	e->rule_priority = rule_priority;
+	e->rule[0] = '\0';
+}
+
+#define pa_trace_ldp(ldp, type, value) \
+	pa_trace((ldp)->link->core, type, ldp, &(ldp)->prefix, (ldp)->plen, value, \
+			(ldp)->priority, (ldp)->rule_priority)
+#define pa_trace_advp(core, advp, type) \
+	pa_trace(core, type, advp, &(advp)->prefix, (advp)->plen, 0, \
+			(advp)->priority, 0)
+
+/* Traces the winning rule result of a routine. */
+static void pa_trace_rule(struct pa_ldp *ldp, struct pa_rule *rule,
+		enum pa_rule_target target, struct pa_rule_arg *arg)
+{
+	struct pa_core *core = ldp->link->core;
+	if(target == PA_RULE_PUBLISH)
+		pa_trace(core, PA_TRACE_RULE, ldp, &arg->prefix, arg->plen, target,
+				arg->priority, arg->rule_priority);
+	else if(target == PA_RULE_ADOPT)
+		pa_trace(core, PA_TRACE_RULE, ldp, &ldp->prefix, ldp->plen, target,
+				arg->priority, arg->rule_priority);
+	else //Other targets do not provide priorities
+		pa_trace(core, PA_TRACE_RULE, ldp, &ldp->prefix, ldp->plen, target,
+				0, 0);
+	char *name = core->trace[(core->trace_n - 1) & (PA_TRACE - 1)].rule;
+	strncpy(name, rule->name?rule->name:"", PA_TRACE_RULE_NAME_LEN - 1);
+	name[PA_TRACE_RULE_NAME_LEN - 1] = '\0';
+}
+#else
+#define pa_trace(core, type, object, prefix, plen, value, priority, rule_priority) \
+	do {} while(0)
+#define pa_trace_ldp(ldp, type, value) do {} while(0)
+#define pa_trace_advp(core, advp, type) do {} while(0)
+#define pa_trace_rule(ldp, rule, target, arg) do {} while(0)
+#endif
+
+#if PA_RULE_STATS != 0
+/* Counts and measures a call to some rule function. */
+#define pa_rule_call(rule, function, call) do { \
+		uint64_t _pa_rule_start = pa_clock_us(), _pa_rule_end; \
+		call; \
+		_pa_rule_end = pa_clock_us(); \
+		(rule)->_stats.function##_calls++; \
+		if(_pa_rule_end > _pa_rule_start) \
+			(rule)->_stats.function##_us += _pa_rule_end - _pa_rule_start; \
+	} while(0)
+#else
+#define pa_rule_call(rule, function, call) call
+#endif
+
+/* Arms a core timer. */
+#define pa_timer_set(core, timeout, ms) do { \
+		pa_stat(core, timers); uloop_timeout_set(timeout, ms); } while(0)
+
+#if PA_LATENCY != 0
+static void pa_latency_add(struct pa_core *core,
+		enum pa_latency_histogram histogram, uint64_t since)
+{
+	uint64_t now = pa_clock_us();
+	pa_histogram_add(&core->latency[histogram], (now > since)?(now - since):0);
+}
+
+/* Arms an ldp timer, remembering when it is expected to fire. */
+#define pa_ldp_timer_set(ldp, timer, ms) do { \
+		uint32_t _pa_ldp_timer_ms = (ms); \
+		if(!pa_ldp_sched_get(ldp)) break; \
+		(ldp)->sched->timer##_due = pa_clock_us() + (uint64_t)_pa_ldp_timer_ms * 1000; \
+		pa_timer_set((ldp)->link->core, &(ldp)->sched->timer, _pa_ldp_timer_ms); } while(0)
+
+/* Accounts for the delay between an ldp timer expiry and its execution. */
+#define pa_latency_lag(ldp, timer, histogram) \
+	pa_latency_add((ldp)->link->core, histogram, (ldp)->sched->timer##_due)
+
+/* Measures the execution time of some call. */
+#define pa_latency_call(core, histogram, call) do { \
+		uint64_t _pa_latency_start = pa_clock_us(); \
+		call; \
+		pa_latency_add(core, histogram, _pa_latency_start); } while(0)
+
+/* Accounts for the execution time of a user callback. The user may have
+ * unregistered and freed itself during the callback, in which case only the
+ * core histogram is updated. */
+static void pa_user_latency_add(struct pa_core *core, struct pa_user *user,
+		uint64_t since)
+{
+	struct pa_user *u;
+	uint64_t now = pa_clock_us(), duration = (now > since)?(now - since):0;
+	pa_histogram_add(&core->latency[PA_LAT_USER], duration);
+	list_for_each_entry(u, &core->users, le) {
+		if(u == user) {
+			pa_histogram_add(&user->latency, duration);
+			break;
+		}
+	}
+}
+
+/* Measures the execution time of a user callback. */
+#define pa_user_call(core, user, call) do { \
+		uint64_t _pa_user_start = pa_clock_us(); \
+		call; \
+		pa_user_latency_add(core, user, _pa_user_start); } while(0)
+#else
+#define pa_ldp_timer_set(ldp, timer, ms) do { \
+		uint32_t _pa_ldp_timer_ms = (ms); \
+		if(!pa_ldp_sched_get(ldp)) break; \
+		pa_timer_set((ldp)->link->core, &(ldp)->sched->timer, _pa_ldp_timer_ms); } while(0)
+#define pa_latency_lag(ldp, timer, histogram) do {} while(0)
+#define pa_latency_call(core, histogram, call) call
+#define pa_user_call(core, user, call) call
+#endif
+
 #ifndef container_of
 #define container_of(ptr, type, member) (           \
     (type *)( (char *)ptr - offsetof(type,member) ))
@@ -35,25 +246,307 @@ const char *pa_hex_dump(uint8_t *ptr, size_t len, char *s) {
 /* Returns whether the Advertised Prefix takes precedence over the Assigned Prefix. */
 #define pa_precedes(advp, ldp) \
 	((!ldp->published) || ((advp)->priority > (ldp)->priority) || \
-	(((advp)->priority == (ldp)->priority) && memcmp((advp)->node_id, (ldp)->core->node_id, PA_NODE_ID_LEN*sizeof(PA_NODE_ID_TYPE))))
+	(((advp)->priority == (ldp)->priority) && memcmp((advp)->node_id, (ldp)->link->core->node_id, PA_NODE_ID_LEN*sizeof(PA_NODE_ID_TYPE))))
 
 #define pa_for_each_user(pa_core, pa_user) list_for_each_entry(pa_user, &(pa_core)->users, le)
 
 #define pa_user_notify(pa_ldp, function) \
 	do { \
-		struct pa_user *_pa_user_notify_user; \
-		pa_for_each_user((pa_ldp)->core, _pa_user_notify_user) { \
+		struct pa_user *_pa_user_notify_user, *_pa_user_notify_user2; \
+		list_for_each_entry_safe(_pa_user_notify_user, _pa_user_notify_user2, \
+				&(pa_ldp)->link->core->users, le) { \
 			if(_pa_user_notify_user->function) \
-				_pa_user_notify_user->function(_pa_user_notify_user, ldp);\
+				pa_user_call((pa_ldp)->link->core, _pa_user_notify_user, \
+					_pa_user_notify_user->function(_pa_user_notify_user, ldp));\
 		} \
+		pa_batch_push(pa_ldp, pa_event_##function); \
+		(pa_ldp)->link->core->changed = 1; \
+		pa_quiesce_schedule((pa_ldp)->link->core); \
 	} while(0)
 
-#define pa_routine_schedule(ldp) do { \
-	if(!(ldp)->routine_to.pending) \
-		uloop_timeout_set(&(ldp)->routine_to, PA_RUN_DELAY); }while(0)
+#if PA_USER_BATCH_SIZE != 0
+
+#define pa_event_assigned PA_EVENT_ASSIGNED
+#define pa_event_published PA_EVENT_PUBLISHED
+#define pa_event_applied PA_EVENT_APPLIED
+
+/* Delivers buffered events to batch users. */
+static void pa_batch_flush(struct pa_core *core)
+{
+	/* Users may generate new events while being notified. */
+	struct pa_event buf[PA_USER_BATCH_SIZE], *events = core->events_buf;
+	struct pa_user *user, *user2;
+	size_t n = core->events_n;
+
+	if(events != core->events) { //The reserved buffer is handed over
+		core->events_buf = core->events;
+		core->events_max = PA_USER_BATCH_SIZE;
+	} else if(n) {
+		memcpy(buf, events, n * sizeof(*events));
+		events = buf;
+	} else {
+		return;
+	}
+	core->events_n = 0;
+	if(core->batch_to.pending)
+		uloop_timeout_cancel(&core->batch_to);
+
+	if(n) {
+		PA_DEBUG("Delivering %zu batched events", n);
+		list_for_each_entry_safe(user, user2, &core->users, le) {
+			if(user->batch)
+				pa_user_call(core, user, user->batch(user, events, n));
+		}
+	}
+
+	if(events != buf)
+		free(events);
+}
+
+static void pa_batch_to(struct uloop_timeout *to)
+{
+	struct pa_core *core = container_of(to, struct pa_core, batch_to);
+	pa_record(core->record, PA_RECORD_BATCH_TO, core, 0);
+	pa_batch_flush(core);
+}
+
+static bool pa_batch_wanted(struct pa_core *core)
+{
+	struct pa_user *user;
+	pa_for_each_user(core, user) {
+		if(user->batch)
+			return true;
+	}
+	return false;
+}
+
+/* Makes room for n more events, so that they are delivered in a single call.
+ * Events are delivered in several calls if the allocation fails. */
+static void pa_batch_reserve(struct pa_core *core, size_t n)
+{
+	struct pa_event *events;
+	n += core->events_n;
+	if(n <= core->events_max || !pa_batch_wanted(core) ||
+			!(events = malloc(n * sizeof(*events))))
+		return;
+
+	memcpy(events, core->events_buf, core->events_n * sizeof(*events));
+	if(core->events_buf != core->events)
+		free(core->events_buf);
+	core->events_buf = events;
+	core->events_max = n;
+}
+
+static void pa_batch_push(struct pa_ldp *ldp, enum pa_event_type type)
+{
+	struct pa_core *core = ldp->link->core;
+	struct pa_event *e;
+
+	if(!pa_batch_wanted(core))
+		return;
+
+	if(core->events_n == core->events_max)
+		pa_batch_flush(core);
+
+	e = &core->events_buf[core->events_n++];
+	e->ldp = ldp;
+	e->type = type;
+	switch (type) {
+	case PA_EVENT_ASSIGNED:
+		e->value = ldp->assigned;
+		break;
+	case PA_EVENT_PUBLISHED:
+		e->value = ldp->published;
+		break;
+	case PA_EVENT_APPLIED:
+		e->value = ldp->applied;
+		break;
+	default:
+		e->value = 1;
+		break;
+	}
+	pa_prefix_cpy(&ldp->prefix, ldp->plen, &e->prefix, e->plen);
+	e->priority = ldp->priority;
+
+	if(!core->batch_to.pending)
+		pa_timer_set(core, &core->batch_to, 0);
+}
+
+#else
+
+#define pa_batch_push(ldp, type) do {} while(0)
+#define pa_batch_reserve(core, n) do { (void)(n); } while(0)
+
+#endif
+
+/* Delay, in milliseconds, applied to routines exceeding the routine budget. */
+#define PA_RUN_YIELD_DELAY 1
+
+/* Delays quiescence notification, if some user wants it. */
+static void pa_quiesce_schedule(struct pa_core *core)
+{
+	struct pa_user *user;
+	if(!core->changed || core->routines_pending)
+		return;
+
+	pa_for_each_user(core, user) {
+		if(user->quiescent) {
+			pa_timer_set(core, &core->quiesce_to, PA_RUN_DELAY);
+			return;
+		}
+	}
+}
+
+static void pa_quiesce_to(struct uloop_timeout *to)
+{
+	struct pa_core *core = container_of(to, struct pa_core, quiesce_to);
+	struct pa_user *user, *user2;
+	pa_record(core->record, PA_RECORD_QUIESCE_TO, core, 0);
+	PA_DEBUG("Prefix Assignment is quiescent");
+	core->changed = 0;
+	list_for_each_entry_safe(user, user2, &core->users, le) {
+		if(user->quiescent)
+			pa_user_call(core, user, user->quiescent(user));
+	}
+}
+
+static void pa_routine_to(struct uloop_timeout *to);
+static void pa_backoff_to(struct uloop_timeout *to);
+
+#if PA_LDP_SLAB_SIZE != 0
+
+/* Scheduling states are allocated by slabs too. Empty slabs are freed, but
+ * the last one, which is kept until the last link is removed, such that
+ * pairs going back and forth to idle do not allocate memory. */
+struct pa_ldp_sched_slab {
+	struct list_head le;    /* Linked in pa_core. */
+	struct list_head free;  /* Released states, linked by in_waiters. */
+	uint32_t used;          /* Number of allocated states. */
+	uint32_t fresh;         /* Number of states allocated at least once. */
+	struct pa_ldp_sched scheds[PA_LDP_SLAB_SIZE];
+};
+
+#define pa_ldp_sched_slab(sched) \
+	container_of(((sched) - (sched)->slab_index), struct pa_ldp_sched_slab, scheds[0])
+
+static struct pa_ldp_sched *pa_ldp_sched_alloc(struct pa_core *core)
+{
+	struct pa_ldp_sched_slab *slab = NULL;
+	struct pa_ldp_sched *sched;
+
+	if(!list_empty(&core->sched_slabs))
+		slab = list_first_entry(&core->sched_slabs, struct pa_ldp_sched_slab, le);
+
+	if(!slab || slab->used == PA_LDP_SLAB_SIZE) {
+		if(!(slab = calloc(1, sizeof(*slab))))
+			return NULL;
+		INIT_LIST_HEAD(&slab->free);
+		list_add(&slab->le, &core->sched_slabs);
+	}
+
+	if(!list_empty(&slab->free)) {
+		sched = list_first_entry(&slab->free, struct pa_ldp_sched, in_waiters);
+		list_del(&sched->in_waiters);
+		memset(sched, 0, sizeof(*sched));
+	} else {
+		sched = &slab->scheds[slab->fresh++]; //Zeroed by calloc
+	}
+	sched->slab_index = sched - slab->scheds;
+
+	if(++slab->used == PA_LDP_SLAB_SIZE) //Full slabs go last
+		list_move_tail(&slab->le, &core->sched_slabs);
+
+	return sched;
+}
+
+static void pa_ldp_sched_free(struct pa_core *core, struct pa_ldp_sched *sched)
+{
+	struct pa_ldp_sched_slab *slab = pa_ldp_sched_slab(sched);
+	list_add(&sched->in_waiters, &slab->free);
+	if(!--slab->used && slab->le.next != slab->le.prev) { //Not the last slab
+		list_del(&slab->le);
+		free(slab);
+	} else {
+		list_move(&slab->le, &core->sched_slabs);
+	}
+}
+
+/* Frees the slab kept once all states were released. */
+static void pa_ldp_sched_flush(struct pa_core *core)
+{
+	struct pa_ldp_sched_slab *slab, *slab2;
+	list_for_each_entry_safe(slab, slab2, &core->sched_slabs, le) {
+		if(!slab->used) {
+			list_del(&slab->le);
+			free(slab);
+		}
+	}
+}
+
+#else
+
+#define pa_ldp_sched_alloc(core) calloc(1, sizeof(struct pa_ldp_sched))
+#define pa_ldp_sched_free(core, sched) free(sched)
+#define pa_ldp_sched_flush(core) do {} while(0)
+
+#endif
+
+/* Returns the scheduling state of a pair, which is allocated if needed. */
+static struct pa_ldp_sched *pa_ldp_sched_get(struct pa_ldp *ldp)
+{
+	struct pa_ldp_sched *sched;
+	if(ldp->sched)
+		return ldp->sched;
+
+	if(!(sched = pa_ldp_sched_alloc(ldp->link->core))) {
+		PA_WARNING("FAILED to create scheduling state for "PA_LDP_P, PA_LDP_PA(ldp));
+		return NULL;
+	}
+	sched->ldp = ldp;
+	sched->routine_to.cb = pa_routine_to;
+	sched->backoff_to.cb = pa_backoff_to;
+	ldp->sched = sched;
+	return sched;
+}
+
+/* Releases the scheduling state of a pair which became idle. */
+static void pa_ldp_sched_release(struct pa_ldp *ldp)
+{
+	struct pa_ldp_sched *sched = ldp->sched;
+	if(!sched || ldp->in_routine || ldp->waiting || ldp->candidate ||
+			sched->routine_to.pending || sched->backoff_to.pending)
+		return;
+
+	ldp->sched = NULL;
+	pa_ldp_sched_free(ldp->link->core, sched);
+}
+
+/* Cancels an ldp timer. */
+#define pa_ldp_timer_cancel(ldp, timer) do { \
+		if((ldp)->sched && (ldp)->sched->timer.pending) { \
+			uloop_timeout_cancel(&(ldp)->sched->timer); \
+			pa_ldp_sched_release(ldp); \
+		} } while(0)
 
-#define PA_ADOPT_DELAY_r(ldp) (pa_rand() % (ldp)->core->adopt_delay)
-#define PA_BACKOFF_DELAY_r(ldp) ((ldp)->core->adopt_delay + pa_rand() % ((ldp)->core->backoff_delay - (ldp)->core->adopt_delay))
+static void pa_routine_schedule(struct pa_ldp *ldp)
+{
+	if(ldp->link->suspended && !ldp->assigned)
+		return; //Scheduled when resumed
+
+	if(ldp->link->core->config_depth) {
+		ldp->config_sched = 1; //Scheduled when committing
+		return;
+	}
+	if(!pa_ldp_routine_pending(ldp) && pa_ldp_sched_get(ldp)) {
+		pa_ldp_timer_set(ldp, routine_to, PA_RUN_DELAY);
+		ldp->link->core->routines_pending++;
+		if(ldp->link->core->quiesce_to.pending)
+			uloop_timeout_cancel(&ldp->link->core->quiesce_to);
+	}
+}
+
+#define PA_ADOPT_DELAY_r(ldp) (pa_core_rand((ldp)->link->core) % (ldp)->link->core->adopt_delay)
+#define PA_BACKOFF_DELAY_r(ldp) ((ldp)->link->core->adopt_delay + pa_core_rand((ldp)->link->core) % ((ldp)->link->core->backoff_delay - (ldp)->link->core->adopt_delay))
 
 static void pa_ldp_apply(struct pa_ldp *ldp)
 {
@@ -70,7 +563,10 @@ static void pa_ldp_apply(struct pa_ldp *ldp)
 
 	PA_DEBUG("Applying "PA_LDP_P, PA_LDP_PA(ldp));
 
+	pa_stat(ldp->link->core, apply);
 	ldp->applied = 1;
+	pa_timeline(ldp, PA_TL_APPLIED);
+	pa_trace_ldp(ldp, PA_TRACE_APPLY, 1);
 	ldp->ha_apply_pending = 0;
 	pa_user_notify(ldp, applied);
 }
@@ -81,12 +577,13 @@ static void pa_ldp_unpublish(struct pa_ldp *ldp, bool cancel_apply)
 		return;
 
 	PA_DEBUG("Un-publishing "PA_LDP_P, PA_LDP_PA(ldp));
+	pa_trace_ldp(ldp, PA_TRACE_PUBLISH, 0);
 	ldp->rule = NULL;
 	ldp->priority = 0;
 	ldp->rule_priority = 0;
 
-	if(cancel_apply && ldp->backoff_to.pending)
-		uloop_timeout_cancel(&ldp->backoff_to);
+	if(cancel_apply)
+		pa_ldp_timer_cancel(ldp, backoff_to);
 
 	ldp->published = 0;
 
@@ -106,8 +603,9 @@ static void pa_ldp_unadopt(struct pa_ldp *ldp)
 	ldp->adopting = 0;
 
 	//Un-adopt means we are going to either publish, destroy, or someone else publishes
-	if(!ldp->applied)
-		uloop_timeout_set(&ldp->backoff_to, ldp->core->flooding_delay * 2);
+	//Suspended pairs are not applied before they are resumed
+	if(!ldp->applied && !ldp->link->suspended)
+		pa_ldp_timer_set(ldp, backoff_to, ldp->link->core->flooding_delay * 2);
 }
 
 static void pa_ldp_publish(struct pa_ldp *ldp, struct pa_rule *rule,
@@ -127,10 +625,45 @@ static void pa_ldp_publish(struct pa_ldp *ldp, struct pa_rule *rule,
 
 	ldp->published = 1;
 	PA_DEBUG("Published "PA_LDP_P, PA_LDP_PA(ldp));
+	pa_stat(ldp->link->core, publish);
+	pa_timeline(ldp, PA_TL_PUBLISHED);
+	pa_trace_ldp(ldp, PA_TRACE_PUBLISH, 1);
 
 	pa_user_notify(ldp, published);
 }
 
+/* Publishes, or updates an already published prefix in place. */
+static void pa_ldp_republish(struct pa_ldp *ldp, struct pa_rule *rule,
+		pa_priority priority, pa_rule_priority rule_priority)
+{
+	struct pa_user *user, *user2;
+
+	if(!ldp->published) {
+		pa_ldp_publish(ldp, rule, priority, rule_priority);
+		return;
+	}
+
+	if(ldp->rule == rule && ldp->priority == priority &&
+			ldp->rule_priority == rule_priority)
+		return;
+
+	ldp->rule = rule;
+	ldp->priority = priority;
+	ldp->rule_priority = rule_priority;
+	PA_DEBUG("Re-published "PA_LDP_P, PA_LDP_PA(ldp));
+
+	//Users may unregister themselves
+	list_for_each_entry_safe(user, user2, &ldp->link->core->users, le) {
+		if(user->republished)
+			pa_user_call(ldp->link->core, user, user->republished(user, ldp));
+		else if(user->published)
+			pa_user_call(ldp->link->core, user, user->published(user, ldp));
+	}
+	pa_batch_push(ldp, PA_EVENT_REPUBLISHED);
+	ldp->link->core->changed = 1;
+	pa_quiesce_schedule(ldp->link->core);
+}
+
 static void pa_ldp_adopt(struct pa_ldp *ldp, struct pa_rule *rule,
 		pa_priority priority, pa_rule_priority rule_priority)
 {
@@ -147,14 +680,76 @@ static void pa_ldp_adopt(struct pa_ldp *ldp, struct pa_rule *rule,
 	ldp->rule_priority = rule_priority;
 
 	ldp->adopting = 1;
-	uloop_timeout_set(&ldp->backoff_to, PA_ADOPT_DELAY_r(ldp));
+	pa_ldp_timer_set(ldp, backoff_to, PA_ADOPT_DELAY_r(ldp));
+	pa_timeline(ldp, PA_TL_ADOPTED);
+	pa_trace_ldp(ldp, PA_TRACE_ADOPT, 1);
 
 	PA_DEBUG("Adopting "PA_LDP_P, PA_LDP_PA(ldp));
 }
 
+/* Puts a pair that found no prefix in its Delegated Prefix waiting list. */
+static void pa_ldp_wait(struct pa_ldp *ldp)
+{
+	if(ldp->waiting || !pa_ldp_sched_get(ldp))
+		return;
+
+	PA_DEBUG("Waiting for space: "PA_LDP_P, PA_LDP_PA(ldp));
+	pa_trace_ldp(ldp, PA_TRACE_WAIT, 0);
+	ldp->waiting = 1;
+	list_add_tail(&ldp->sched->in_waiters, &ldp->dp->waiters);
+}
+
+static void pa_ldp_unwait(struct pa_ldp *ldp)
+{
+	if(!ldp->waiting)
+		return;
+
+	ldp->waiting = 0;
+	list_del(&ldp->sched->in_waiters);
+	pa_ldp_sched_release(ldp);
+}
+
+/*
+ * Schedules, in arrival order, the waiting pairs the available space of the
+ * Delegated Prefix may satisfy. A waiter is assumed to need a prefix as long
+ * as the one it held last, or as long as the released block of length plen
+ * when it never held any. Space is read from the prefix trie, as released
+ * blocks may merge with free neighbours, and is reserved for each woken
+ * waiter such that pairs are not woken up only to wait again.
+ */
+static void pa_dp_wake(struct pa_dp *dp, pa_plen plen)
+{
+	struct pa_ldp_sched *sched, *sched2;
+	struct pa_ldp *ldp;
+	uint64_t space = 0, reserved = 0, need;
+	pa_plen len, space_len = 0;
+
+	list_for_each_entry_safe(sched, sched2, &dp->waiters, in_waiters) {
+		ldp = sched->ldp;
+		len = ldp->plen?ldp->plen:plen;
+		if(len < dp->plen)
+			len = dp->plen;
+
+		if(len - dp->plen < 64) { //Longer prefixes are not counted
+			if(len != space_len) {
+				space = btrie_available_space(&ldp->link->core->prefixes,
+						(btrie_key_t *)&dp->prefix, dp->plen, len);
+				space_len = len;
+			}
+			need = BTRIE_AVAILABLE_ALL >> (len - dp->plen);
+			if(space <= reserved || space - reserved < need)
+				continue; //Not enough space for this one
+			reserved += need;
+		}
+
+		PA_DEBUG("Waking up "PA_LDP_P, PA_LDP_PA(ldp));
+		pa_ldp_unwait(ldp);
+		pa_routine_schedule(ldp);
+	}
+}
+
 static void pa_ldp_unassign(struct pa_ldp *ldp)
 {
-	struct pa_ldp *ldp2;
 	if(!ldp->assigned)
 		return;
 
@@ -163,25 +758,34 @@ static void pa_ldp_unassign(struct pa_ldp *ldp)
 #endif
 	if(ldp->applied) {
 		ldp->applied = 0;
+		pa_trace_ldp(ldp, PA_TRACE_APPLY, 0);
 		pa_user_notify(ldp, applied);
 	}
 
 	pa_ldp_unpublish(ldp, 1);
 	pa_ldp_unadopt(ldp);
-	uloop_timeout_cancel(&ldp->backoff_to);
+	pa_ldp_timer_cancel(ldp, backoff_to);
 	PA_INFO("Un-assign prefix: "PA_LDP_P, PA_LDP_PA(ldp));
 
 	btrie_remove(&ldp->in_core.be);
 	ldp->assigned = 0;
+	pa_stat(ldp->link->core, unassign);
+	pa_timeline(ldp, PA_TL_UNASSIGNED);
+	pa_trace_ldp(ldp, PA_TRACE_ASSIGN, 0);
 	pa_user_notify(ldp, assigned); /* Tell users about that */
 
 	/* Destroying the Assigned Prefix possibly freed space that other interfaces may use.
-	 * Schedule links for the same dp, if there is no current prefix.
+	 * Wake up pairs of the same dp which are waiting for a prefix.
 	 * This can be ignored when no prefix is ever created by the local node. */
-	pa_for_each_ldp_in_dp(ldp->dp, ldp2) {
-		if(!ldp2->assigned && (ldp2 != ldp))
-			pa_routine_schedule(ldp2);
+	if(ldp->dp->removing) //All pairs are destroyed anyway
+		return;
+
+	if(ldp->link->core->config_depth) { //Scheduled once when committing
+		ldp->dp->config_sched = 1;
+		return;
 	}
+
+	pa_dp_wake(ldp->dp, ldp->plen);
 }
 
 static int pa_ldp_assign(struct pa_ldp *ldp, pa_prefix *prefix, pa_plen plen)
@@ -192,17 +796,22 @@ static int pa_ldp_assign(struct pa_ldp *ldp, pa_prefix *prefix, pa_plen plen)
 		return -2;
 	}
 
+	pa_ldp_unwait(ldp);
 	pa_prefix_cpy(prefix, plen, &ldp->prefix, ldp->plen);
-	if(btrie_add(&ldp->core->prefixes, &ldp->in_core.be, (const btrie_key_t *)prefix, plen)) {
+	if(btrie_add(&ldp->link->core->prefixes, &ldp->in_core.be, (const btrie_key_t *)prefix, plen)) {
 		PA_WARNING("Could not assign %s to "PA_LINK_P, pa_prefix_repr(prefix, plen), PA_LINK_PA(ldp->link));
 		return -1;
 	}
 
 	//Cancel backoff timer and set apply timer
-	PA_DEBUG("Set apply timer %d", 2 * ldp->core->flooding_delay);
-	uloop_timeout_set(&ldp->backoff_to, 2 * ldp->core->flooding_delay);
+	PA_DEBUG("Set apply timer %d", 2 * ldp->link->core->flooding_delay);
+	pa_ldp_timer_set(ldp, backoff_to, 2 * ldp->link->core->flooding_delay);
 
 	ldp->assigned = 1;
+	ldp->candidate = 0;
+	pa_stat(ldp->link->core, assign);
+	pa_timeline(ldp, PA_TL_ASSIGNED);
+	pa_trace_ldp(ldp, PA_TRACE_ASSIGN, 1);
 	PA_INFO("Assigned prefix: "PA_LDP_P, PA_LDP_PA(ldp));
 	pa_user_notify(ldp, assigned); /* Tell users about that*/
 	return 0;
@@ -214,19 +823,37 @@ static bool pa_ldp_global_valid(struct pa_ldp *ldp)
 	 * If there are overlapping DPs, this assumption may be wrong and
 	 * this code would bug. */
 	struct pa_advp *advp;
-	btrie_for_each_updown_entry(advp, &ldp->core->prefixes, (btrie_key_t *)&ldp->prefix, ldp->plen, in_core.be) {
+	pa_stat(ldp->link->core, updown_walks);
+	btrie_for_each_updown_entry(advp, &ldp->link->core->prefixes, (btrie_key_t *)&ldp->prefix, ldp->plen, in_core.be) {
+		pa_stat(ldp->link->core, updown_elements);
 		if(&advp->in_core != &ldp->in_core && pa_precedes(advp, ldp))
 			return false;
 	}
 	return true;
 }
 
+/*
+ * Routine of suspended pairs.
+ * The Assigned Prefix is kept unless it is not globally valid anymore.
+ */
+static void pa_routine_suspended(struct pa_ldp *ldp)
+{
+	if(ldp->assigned && !pa_ldp_global_valid(ldp)) {
+		PA_INFO("Giving up prefix of suspended "PA_LDP_P, PA_LDP_PA(ldp));
+		pa_ldp_unassign(ldp);
+	}
+	pa_ldp_sched_release(ldp);
+}
+
 /*
  * Prefix Assignment Routine.
  */
 static void pa_routine(struct pa_ldp *ldp, bool backoff)
 {
 	PA_DEBUG("Executing PA %sRoutine for "PA_LDP_P, backoff?"backoff ":"", PA_LDP_PA(ldp));
+	ldp->in_routine = 1;
+	pa_timeline(ldp, PA_TL_ROUTINE);
+	pa_trace_ldp(ldp, PA_TRACE_ROUTINE, backoff?1:0);
 
 	/*
 	 * The algorithm is slightly modified in order to provide support for
@@ -244,17 +871,19 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 	 *********************************/
 	struct pa_advp *advp;
 	struct pa_pentry *pentry;
-	ldp->best_assignment = NULL;
-	btrie_for_each_updown_entry(pentry, &ldp->core->prefixes,
+	ldp->sched->best_assignment = NULL;
+	pa_stat(ldp->link->core, updown_walks);
+	btrie_for_each_updown_entry(pentry, &ldp->link->core->prefixes,
 			(btrie_key_t *)&ldp->dp->prefix, ldp->dp->plen, be) {
+		pa_stat(ldp->link->core, updown_elements);
 		if(pentry->type == PAT_ADVERTISED) {
 			advp = container_of(pentry, struct pa_advp, in_core);
 			if(advp->link == ldp->link &&
-					(!ldp->best_assignment ||
-					advp->priority > ldp->best_assignment->priority ||
-					((advp->priority == ldp->best_assignment->priority) &&
-							(PA_NODE_ID_CMP(advp->node_id, ldp->best_assignment->node_id) > 0))))
-				ldp->best_assignment = advp;
+					(!ldp->sched->best_assignment ||
+					advp->priority > ldp->sched->best_assignment->priority ||
+					((advp->priority == ldp->sched->best_assignment->priority) &&
+							(PA_NODE_ID_CMP(advp->node_id, ldp->sched->best_assignment->node_id) > 0))))
+				ldp->sched->best_assignment = advp;
 		}
 	}
 
@@ -262,23 +891,23 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 	 * 2. Check Assignment Validity. *
 	 *********************************/
 
-	if(!ldp->best_assignment || !pa_precedes(ldp->best_assignment, ldp))
-		ldp->best_assignment = NULL; //We don't really care about invalid best assignments.
+	if(!ldp->sched->best_assignment || !pa_precedes(ldp->sched->best_assignment, ldp))
+		ldp->sched->best_assignment = NULL; //We don't really care about invalid best assignments.
 
 	if(ldp->assigned) { //Check whether the algorithm would keep that prefix or destroy it.
 		bool valid;
-		if(!ldp->best_assignment) {
+		if(!ldp->sched->best_assignment) {
 			valid = pa_ldp_global_valid(ldp); //Globally valid
 		} else {
 			valid = pa_prefix_equals(&ldp->prefix, ldp->plen, //Different from Best Assignment
-					&ldp->best_assignment->prefix, ldp->best_assignment->plen);
+					&ldp->sched->best_assignment->prefix, ldp->sched->best_assignment->plen);
 		}
 		if(!valid)
 			pa_ldp_unassign(ldp);
 	}
 
 	/* If there is a best assignment, we can't adopt the prefix. */
-	if(ldp->best_assignment)
+	if(ldp->sched->best_assignment)
 		pa_ldp_unadopt(ldp);
 
 	/*********************
@@ -286,19 +915,36 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 	 *********************/
 
 	struct pa_rule *rule, *r2;
+	int accept;
 	struct list_head rules, *insert;
 	INIT_LIST_HEAD(&rules);
 	ldp->backoff = backoff?1:0;
 
+#if PA_CONFLICT_CACHE_SIZE != 0
+	/* Conflict summaries stay valid until rules are executed. */
+	ldp->link->core->conflicts_n = 0;
+	ldp->link->core->conflicts_next = 0;
+	ldp->link->core->conflicts_valid = 1;
+#endif
+
 	/* First, sort the rules with their max priority. */
-	list_for_each_entry(rule, &ldp->core->rules, le) {
+	list_for_each_entry(rule, &ldp->link->core->rules, le) {
 		/* Apply rule filter */
-		if(rule->filter_accept && !rule->filter_accept(rule, ldp, rule->filter_private))
-			continue;
+		if(rule->filter_accept) {
+			pa_stat(ldp->link->core, rule_filter);
+			pa_rule_call(rule, filter, accept = rule->filter_accept(rule, ldp, rule->filter_private));
+			if(!accept)
+				continue;
+		}
 
 		/* Get priority */
-		rule->_max_priority = rule->get_max_priority?
-				rule->get_max_priority(rule, ldp):rule->max_priority;
+		if(rule->get_max_priority) {
+			pa_stat(ldp->link->core, rule_max_priority);
+			pa_rule_call(rule, max_priority,
+					rule->_max_priority = rule->get_max_priority(rule, ldp));
+		} else {
+			rule->_max_priority = rule->max_priority;
+		}
 
 		if(!rule->_max_priority)
 			continue;
@@ -331,8 +977,14 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 		 * They only return a match when they have the best
 		 * priority, and everything they say is valid.
 		 */
-		if(!rule->match || !(target = rule->match(rule, ldp, best_prio, &arg)))
-				continue;
+		arg.speculative = 0;
+		if(!rule->match)
+			continue;
+
+		pa_stat(ldp->link->core, rule_match);
+		pa_rule_call(rule, match, target = rule->match(rule, ldp, best_prio, &arg));
+		if(!target)
+			continue;
 
 		best_arg = arg;
 		best_target = target;
@@ -340,10 +992,19 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 		best_rule = rule;
 	}
 
-	if(best_target == PA_RULE_NO_MATCH)
+#if PA_CONFLICT_CACHE_SIZE != 0
+	ldp->link->core->conflicts_valid = 0;
+#endif
+
+	if(best_target == PA_RULE_NO_MATCH) {
 		PA_DEBUG("No matching rule was found.");
-	else
+	} else {
 		PA_DEBUG("Rule "PA_RULE_P" matched", PA_RULE_PA(best_rule));
+#if PA_RULE_STATS != 0
+		best_rule->_stats.wins++;
+#endif
+		pa_trace_rule(ldp, best_rule, best_target, &best_arg);
+	}
 
 	/* Now act upon the best rule */
 	struct pa_ldp *ldp2;
@@ -356,7 +1017,7 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 			break;
 		case PA_RULE_BACKOFF:
 			PA_DEBUG("Target: Backoff");
-			if(ldp->best_assignment) {
+			if(ldp->sched->best_assignment) {
 				PA_WARNING("Backoff is not a valid rule target, as there is a best assignment.");
 				break;
 			}
@@ -364,8 +1025,19 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 			//Backoff only makes sense for not assigned ldps
 			pa_ldp_unassign(ldp);
 			//If already pending, we can keep waiting.
-			if(!ldp->backoff_to.pending)
-				uloop_timeout_set(&ldp->backoff_to, PA_BACKOFF_DELAY_r(ldp));
+			if(!pa_ldp_backoff_pending(ldp)) {
+				pa_ldp_timer_set(ldp, backoff_to, PA_BACKOFF_DELAY_r(ldp));
+				pa_timeline(ldp, PA_TL_BACKOFF);
+				pa_trace_ldp(ldp, PA_TRACE_BACKOFF, 0);
+			}
+			//Remember the candidate prefix the rule may have computed in advance.
+			if(best_arg.speculative) {
+				pa_prefix_cpy(&best_arg.prefix, best_arg.plen,
+						&ldp->sched->candidate_prefix, ldp->sched->candidate_plen);
+				ldp->candidate = 1;
+			} else {
+				ldp->candidate = 0;
+			}
 			break;
 		case PA_RULE_DESTROY:
 			PA_DEBUG("Target: Destroy %s", pa_prefix_repr(&ldp->prefix, ldp->plen));
@@ -377,7 +1049,9 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 								best_arg.priority, best_arg.rule_priority);
 
 			/* Unassign conflicting prefixes on other ldps */
-			btrie_for_each_updown_entry_safe(pentry, pentry2, &ldp->core->prefixes, (btrie_key_t *)&best_arg.prefix, best_arg.plen, be) {
+			pa_stat(ldp->link->core, updown_walks);
+			btrie_for_each_updown_entry_safe(pentry, pentry2, &ldp->link->core->prefixes, (btrie_key_t *)&best_arg.prefix, best_arg.plen, be) {
+				pa_stat(ldp->link->core, updown_elements);
 				if(pentry->type == PAT_ASSIGNED && (pentry != &ldp->in_core)) {
 					ldp2 = container_of(pentry, struct pa_ldp, in_core);
 					pa_ldp_unassign(ldp2);
@@ -390,24 +1064,24 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 				pa_ldp_unassign(ldp);
 			}
 
-			if(ldp->assigned) {
-				pa_ldp_unpublish(ldp, 0);
-				pa_ldp_unadopt(ldp);
-			} else {
+			if(!ldp->assigned)
 				pa_ldp_assign(ldp, &best_arg.prefix, best_arg.plen);
-			}
-			pa_ldp_publish(ldp, best_rule, best_arg.priority, best_arg.rule_priority);
 
-			//publish must return a valid advertisement
-			ldp->best_assignment = NULL;
+			//Adopted prefixes are published, published ones are updated
+			pa_ldp_republish(ldp, best_rule, best_arg.priority, best_arg.rule_priority);
 
-			//TODO: Send an update to FM instead of un-publish+publish
+			//publish must return a valid advertisement
+			ldp->sched->best_assignment = NULL;
 			break;
 		case PA_RULE_NO_MATCH:
 		default:
 			break;
 	}
 
+	/* The candidate was either used or is outdated. */
+	if(backoff && !pa_ldp_backoff_pending(ldp))
+		ldp->candidate = 0;
+
 	/*********************************
 	 * 4. End the routine            *
 	 *********************************/
@@ -415,61 +1089,240 @@ static void pa_routine(struct pa_ldp *ldp, bool backoff)
 	if(ldp->assigned) {
 		//Assigned and valid
 
-		if(ldp->best_assignment) {
+		if(ldp->sched->best_assignment) {
 			//Same prefix is advertised by someone else
 			pa_ldp_unpublish(ldp, 0); //Give-up prefix
 			pa_ldp_unadopt(ldp); //Cancel adoption
 		} else if(!ldp->published && !ldp->adopting) {
 			//Nobody advertises the prefix, and no rule tried to save the prefix
-			//So it shall die.
+			//So it shall die, and the pair waits for space like any other.
 			pa_ldp_unassign(ldp);
+			if(!pa_ldp_backoff_pending(ldp) && !pa_ldp_routine_pending(ldp))
+				pa_ldp_wait(ldp);
 		}
 
-	} else if (ldp->best_assignment) {
+	} else if (ldp->sched->best_assignment) {
 		//Should accept the best_assignment
 		pa_ldp_unassign(ldp);
-		pa_ldp_assign(ldp, &ldp->best_assignment->prefix, ldp->best_assignment->plen);
+		pa_ldp_assign(ldp, &ldp->sched->best_assignment->prefix, ldp->sched->best_assignment->plen);
+	} else if(!pa_ldp_backoff_pending(ldp) && !pa_ldp_routine_pending(ldp)) {
+		//No prefix could be found
+		pa_ldp_wait(ldp);
+	}
+
+	ldp->in_routine = 0;
+	pa_ldp_sched_release(ldp);
+}
+
+/* Whether a pair may exist given the links hierarchy. */
+#ifdef PA_HIERARCHICAL
+/* If dp is from higher level and the link is the child of a higher level link.
+ * Compare the two links.  */
+#define pa_ldp_pairable(link, dp) \
+	(!((dp)->ha_ldp && (link)->ha_parent && (link)->ha_parent != (dp)->ha_ldp->link))
+#else
+#define pa_ldp_pairable(link, dp) 1
+#endif
+
+/* Whether a pair is needed, in lazy mode. */
+static bool pa_ldp_wanted(struct pa_core *core, struct pa_link *link, struct pa_dp *dp)
+{
+	struct pa_rule *rule;
+	struct pa_pentry *pentry;
+	struct pa_ldp tmp;
+	int accept;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.link = link;
+	tmp.dp = dp;
+	list_for_each_entry(rule, &core->rules, le) {
+		if(!rule->filter_accept)
+			return true;
+
+		pa_stat(core, rule_filter);
+		pa_rule_call(rule, filter, accept = rule->filter_accept(rule, &tmp, rule->filter_private));
+		if(accept)
+			return true;
+	}
+
+	btrie_for_each_down_entry(pentry, &core->prefixes, (btrie_key_t *)&dp->prefix, dp->plen, be) {
+		if(pentry->type == PAT_ADVERTISED &&
+				container_of(pentry, struct pa_advp, in_core)->link == link)
+			return true;
+	}
+	return false;
+}
+
+static void pa_ldp_destroy(struct pa_ldp *ldp);
+
+/* Destroys idle pairs which are not needed anymore, in lazy mode. */
+static void pa_ldp_reclaim(struct pa_ldp *ldp)
+{
+	if(!ldp->link->core->lazy_ldps || ldp->assigned ||
+			pa_ldp_routine_pending(ldp) || pa_ldp_backoff_pending(ldp) ||
+			pa_ldp_wanted(ldp->link->core, ldp->link, ldp->dp))
+		return;
+
+	PA_DEBUG("Reclaiming idle pair "PA_LDP_P, PA_LDP_PA(ldp));
+	pa_ldp_destroy(ldp);
+}
+
+static void pa_tick_to(struct uloop_timeout *to)
+{
+	struct pa_core *core = container_of(to, struct pa_core, tick_to);
+	pa_record(core->record, PA_RECORD_TICK_TO, core, 0);
+	core->tick_routines = 0;
+}
+
+/*
+ * Accounts for a routine about to be executed.
+ * Returns true if the routine budget is exhausted, in which case the routine
+ * must be deferred.
+ */
+static bool pa_routine_budget_exhausted(struct pa_core *core)
+{
+	if(!core->routine_budget && !core->routine_budget_us)
+		return false;
+
+	if(!core->tick_routines) {
+		/* First routine since control was given back to the event loop.
+		 * tick_to is the first timeout to fire in the next iteration. */
+		core->tick_start = pa_clock_us();
+		pa_timer_set(core, &core->tick_to, PA_RUN_YIELD_DELAY);
+	} else if((core->routine_budget &&
+			core->tick_routines >= core->routine_budget) ||
+			(core->routine_budget_us &&
+			pa_clock_us() - core->tick_start >= core->routine_budget_us)) {
+		return true;
 	}
+
+	core->tick_routines++;
+	return false;
 }
 
 static void pa_backoff_to(struct uloop_timeout *to)
 {
-	struct pa_ldp *ldp = container_of(to, struct pa_ldp, backoff_to);
+	struct pa_ldp *ldp = container_of(to, struct pa_ldp_sched, backoff_to)->ldp;
+	pa_record(ldp->link->core->record, PA_RECORD_BACKOFF_TO, ldp, 0);
+	pa_latency_lag(ldp, backoff_to, PA_LAT_BACKOFF_LAG);
 	if(ldp->adopting) { //Adopt timeout
 		pa_ldp_publish(ldp, ldp->rule, ldp->priority, ldp->rule_priority);
+		pa_ldp_sched_release(ldp);
 	} else if(ldp->assigned) { //Apply timeout
 		pa_ldp_apply(ldp);
-	} else { //Backoff delay
-		pa_routine(ldp, true);
+		pa_ldp_sched_release(ldp);
+	} else if(pa_routine_budget_exhausted(ldp->link->core)) { //Backoff delay
+		PA_DEBUG("Deferring backoff routine "PA_LDP_P, PA_LDP_PA(ldp));
+		pa_ldp_timer_set(ldp, backoff_to, PA_RUN_YIELD_DELAY);
+	} else {
+		pa_stat(ldp->link->core, routines_backoff);
+		pa_latency_call(ldp->link->core, PA_LAT_ROUTINE, pa_routine(ldp, true));
+		pa_ldp_reclaim(ldp);
 	}
 }
 
 static void pa_routine_to(struct uloop_timeout *to)
 {
-	struct pa_ldp *ldp = container_of(to, struct pa_ldp, routine_to);
-	pa_routine(ldp, false);
+	struct pa_ldp *ldp = container_of(to, struct pa_ldp_sched, routine_to)->ldp;
+	struct pa_core *core = ldp->link->core;
+	pa_record(core->record, PA_RECORD_ROUTINE_TO, ldp, 0);
+	pa_latency_lag(ldp, routine_to, PA_LAT_ROUTINE_LAG);
+	if(pa_routine_budget_exhausted(core)) {
+		PA_DEBUG("Deferring routine "PA_LDP_P, PA_LDP_PA(ldp));
+		pa_ldp_timer_set(ldp, routine_to, PA_RUN_YIELD_DELAY);
+		return;
+	}
+	core->routines_pending--;
+	pa_stat(core, routines);
+	if(ldp->link->suspended)
+		pa_routine_suspended(ldp);
+	else
+		pa_latency_call(core, PA_LAT_ROUTINE, pa_routine(ldp, false));
+	pa_ldp_reclaim(ldp);
+	pa_quiesce_schedule(core);
+}
+
+#if PA_LDP_SLAB_SIZE != 0
+
+struct pa_ldp_slab {
+	struct list_head le;    /* Linked in pa_core. */
+	struct list_head free;  /* Released ldps, linked by in_link. */
+	uint32_t used;          /* Number of allocated ldps. */
+	uint32_t fresh;         /* Number of ldps allocated at least once. */
+	struct pa_ldp ldps[PA_LDP_SLAB_SIZE];
+};
+
+#define pa_ldp_slab(ldp) \
+	container_of(((ldp) - (ldp)->slab_index), struct pa_ldp_slab, ldps[0])
+
+static struct pa_ldp *pa_ldp_alloc(struct pa_core *core)
+{
+	struct pa_ldp_slab *slab = NULL;
+	struct pa_ldp *ldp;
+
+	if(!list_empty(&core->ldp_slabs))
+		slab = list_first_entry(&core->ldp_slabs, struct pa_ldp_slab, le);
+
+	if(!slab || slab->used == PA_LDP_SLAB_SIZE) {
+		if(!(slab = calloc(1, sizeof(*slab))))
+			return NULL;
+		INIT_LIST_HEAD(&slab->free);
+		list_add(&slab->le, &core->ldp_slabs);
+	}
+
+	if(!list_empty(&slab->free)) {
+		ldp = list_first_entry(&slab->free, struct pa_ldp, in_link);
+		list_del(&ldp->in_link);
+		memset(ldp, 0, sizeof(*ldp));
+	} else {
+		ldp = &slab->ldps[slab->fresh++]; //Zeroed by calloc
+	}
+	ldp->slab_index = ldp - slab->ldps;
+
+	if(++slab->used == PA_LDP_SLAB_SIZE) //Full slabs go last
+		list_move_tail(&slab->le, &core->ldp_slabs);
+
+	return ldp;
 }
 
+static void pa_ldp_free(struct pa_ldp *ldp)
+{
+	struct pa_ldp_slab *slab = pa_ldp_slab(ldp);
+	if(!--slab->used) {
+		list_del(&slab->le);
+		free(slab);
+	} else {
+		list_add(&ldp->in_link, &slab->free);
+		list_move(&slab->le, &ldp->link->core->ldp_slabs);
+	}
+}
+
+#else
+
+#define pa_ldp_alloc(core) calloc(1, sizeof(struct pa_ldp))
+#define pa_ldp_free(ldp) free(ldp)
+
+#endif
+
 /*
  * Create a new empty link/dp pairing.
  */
 static int pa_ldp_create(struct pa_core *core, struct pa_link *link, struct pa_dp *dp)
 {
 	struct pa_ldp *ldp;
-	if(!(ldp = calloc(1, sizeof(*ldp)))) {
+	if(!(ldp = pa_ldp_alloc(core))) {
 		PA_WARNING("FAILED to create state for "PA_LINK_P"/"PA_DP_P, PA_LINK_PA(link), PA_DP_PA(dp));
 		return -1;
 	}
 
-	ldp->backoff_to.cb = pa_backoff_to;
-	ldp->routine_to.cb = pa_routine_to;
 	ldp->in_core.type = PAT_ASSIGNED;
-	ldp->core = core;
 	ldp->link = link;
 	list_add_tail(&ldp->in_link, &link->ldps);
 	ldp->dp = dp;
 	list_add_tail(&ldp->in_dp, &dp->ldps);
 	PA_DEBUG("Creating Link/Delegated Prefix pair: "PA_LDP_P, PA_LDP_PA(ldp));
+	pa_timeline(ldp, PA_TL_CREATED);
+	pa_trace_ldp(ldp, PA_TRACE_LDP_CREATE, 0);
 	pa_routine_schedule(ldp);
 	return 0;
 }
@@ -480,16 +1333,29 @@ static int pa_ldp_create(struct pa_core *core, struct pa_link *link, struct pa_d
 static void pa_ldp_destroy(struct pa_ldp *ldp)
 {
 	PA_DEBUG("Destroying Link/Delegated Prefix pair: "PA_LDP_P, PA_LDP_PA(ldp));
+	pa_trace_ldp(ldp, PA_TRACE_LDP_DESTROY, 0);
+#if PA_USER_BATCH_SIZE != 0
+	pa_batch_flush(ldp->link->core); //Events may refer to this ldp
+#endif
 	list_del(&ldp->in_link);
 	list_del(&ldp->in_dp);
-	uloop_timeout_cancel(&ldp->backoff_to);
-	uloop_timeout_cancel(&ldp->routine_to);
-	free(ldp);
+	pa_ldp_unwait(ldp);
+	if(ldp->sched) {
+		if(ldp->sched->routine_to.pending) {
+			ldp->link->core->routines_pending--;
+			pa_quiesce_schedule(ldp->link->core);
+		}
+		uloop_timeout_cancel(&ldp->sched->routine_to);
+		uloop_timeout_cancel(&ldp->sched->backoff_to);
+		pa_ldp_sched_free(ldp->link->core, ldp->sched);
+	}
+	pa_ldp_free(ldp);
 }
 
 static void _pa_dp_del(struct pa_dp *dp)
 {
 	struct pa_ldp *ldp, *ldp2;
+	dp->removing = 1;
 	//Public part
 	pa_for_each_ldp_in_dp(dp, ldp)
 		pa_ldp_unassign(ldp);
@@ -498,11 +1364,13 @@ static void _pa_dp_del(struct pa_dp *dp)
 	pa_for_each_ldp_in_dp_safe(dp, ldp, ldp2)
 		pa_ldp_destroy(ldp);
 	list_del(&dp->le);
+	dp->removing = 0;
 }
 
 void pa_dp_del(struct pa_dp *dp)
 {
 	PA_INFO("Removing Delegated Prefix "PA_DP_P, PA_DP_PA(dp));
+	pa_record(dp->record, PA_RECORD_DP_DEL, dp, 0);
 	_pa_dp_del(dp);
 }
 
@@ -510,15 +1378,23 @@ int pa_dp_add(struct pa_core *core, struct pa_dp *dp)
 {
 	PA_INFO("Adding Delegated Prefix "PA_DP_P, PA_DP_PA(dp));
 	INIT_LIST_HEAD(&dp->ldps);
+	INIT_LIST_HEAD(&dp->waiters);
+	dp->removing = 0;
+	dp->config_sched = 0;
+#if PA_RECORD != 0
+	dp->record = NULL;
+#endif
 	list_add_tail(&dp->le, &core->dps);
+	if(core->lazy_ldps && core->config_depth) {
+		core->config_populate = 1; //Pairs are created when committing
+		pa_record(core->record, PA_RECORD_DP_ADD, dp, 0);
+		return 0;
+	}
 	struct pa_link *link;
 	pa_for_each_link(core, link) {
-#ifdef PA_HIERARCHICAL
-		/* If dp is from higher level and the link is the child of a higher level link.
-		 * Compare the two links.  */
-		if(dp->ha_ldp && link->ha_parent && link->ha_parent != dp->ha_ldp->link)
+		if(!pa_ldp_pairable(link, dp) ||
+				(core->lazy_ldps && !pa_ldp_wanted(core, link, dp)))
 			continue;
-#endif
 
 		if(pa_ldp_create(core, link, dp)) {
 			PA_WARNING("FAILED to add Delegated Prefix "PA_DP_P, PA_DP_PA(dp));
@@ -526,6 +1402,7 @@ int pa_dp_add(struct pa_core *core, struct pa_dp *dp)
 			return -1;
 		}
 	}
+	pa_record(core->record, PA_RECORD_DP_ADD, dp, 0);
 	return 0;
 }
 
@@ -535,6 +1412,8 @@ void pa_dp_init(struct pa_dp *dp, pa_prefix *prefix, pa_plen plen)
 #ifdef PA_DP_TYPE
 	dp->type = PA_DP_TYPE_NONE;
 #endif
+	dp->removing = 0;
+	dp->config_sched = 0;
 #ifdef PA_HIERARCHICAL
 	dp->ha_ldp = NULL;
 #endif
@@ -543,6 +1422,10 @@ void pa_dp_init(struct pa_dp *dp, pa_prefix *prefix, pa_plen plen)
 static void _pa_link_del(struct pa_link *link)
 {
 	struct pa_ldp *ldp, *ldp2;
+	if(link->suspend_to.pending)
+		uloop_timeout_cancel(&link->suspend_to);
+	link->suspended = 0;
+
 	//Public part
 	pa_for_each_ldp_in_link(link, ldp)
 		pa_ldp_unassign(ldp);
@@ -551,40 +1434,153 @@ static void _pa_link_del(struct pa_link *link)
 	pa_for_each_ldp_in_link_safe(link, ldp, ldp2)
 	pa_ldp_destroy(ldp);
 
+	if(link->le.next == link->le.prev)
+		pa_ldp_sched_flush(link->core); //Last link, so no pair is left
 	list_del(&link->le);
 }
 
 void pa_link_del(struct pa_link *link)
 {
 	PA_INFO("Removing Link "PA_LINK_P, PA_LINK_PA(link));
+	pa_record(link->record, PA_RECORD_LINK_DEL, link, 0);
 	_pa_link_del(link);
 }
 
+/* Number of events generated when unassigning a pair. */
+#define pa_ldp_unassign_events(ldp) \
+	((size_t)((ldp)->assigned + (ldp)->published + (ldp)->applied))
+
+void pa_core_bulk_del(struct pa_core *core, struct pa_dp **dps, size_t dps_n,
+		struct pa_link **links, size_t links_n)
+{
+	struct pa_ldp *ldp;
+	size_t i, n = 0;
+	PA_INFO("Removing %zu Delegated Prefixes and %zu Links", dps_n, links_n);
+	pa_core_config_begin(core); //Remaining pairs are scheduled once
+	for(i = 0; i < dps_n; i++) {
+		dps[i]->removing = 1;
+		pa_for_each_ldp_in_dp(dps[i], ldp)
+			n += pa_ldp_unassign_events(ldp);
+	}
+	for(i = 0; i < links_n; i++)
+		pa_for_each_ldp_in_link(links[i], ldp)
+			n += pa_ldp_unassign_events(ldp);
+	pa_batch_reserve(core, n);
+
+	//Public part (siblings are not rescheduled)
+	for(i = 0; i < dps_n; i++)
+		pa_for_each_ldp_in_dp(dps[i], ldp)
+			pa_ldp_unassign(ldp);
+	for(i = 0; i < links_n; i++)
+		pa_for_each_ldp_in_link(links[i], ldp)
+			pa_ldp_unassign(ldp);
+
+	//Private part
+	for(i = 0; i < dps_n; i++) {
+		pa_record(dps[i]->record, PA_RECORD_DP_DEL, dps[i], 0);
+		_pa_dp_del(dps[i]);
+	}
+	for(i = 0; i < links_n; i++) {
+		pa_record(links[i]->record, PA_RECORD_LINK_DEL, links[i], 0);
+		_pa_link_del(links[i]);
+	}
+	pa_core_config_commit(core);
+}
+
+static void pa_link_suspend_to(struct uloop_timeout *to)
+{
+	struct pa_link *link = container_of(to, struct pa_link, suspend_to);
+	struct pa_ldp *ldp;
+	pa_record(link->record, PA_RECORD_SUSPEND_TO, link, 0);
+	PA_INFO("Grace period expired for suspended Link "PA_LINK_P, PA_LINK_PA(link));
+	pa_for_each_ldp_in_link(link, ldp)
+		pa_ldp_unassign(ldp);
+}
+
+void pa_link_suspend(struct pa_link *link, uint32_t grace)
+{
+	struct pa_ldp *ldp;
+	PA_INFO("Suspending Link "PA_LINK_P, PA_LINK_PA(link));
+	pa_record(link->record, PA_RECORD_LINK_SUSPEND, link, grace);
+	if(!link->suspended) {
+		link->suspended = 1;
+		pa_for_each_ldp_in_link(link, ldp) {
+			//Assigned pairs keep running conflict checks
+			if(!ldp->assigned && pa_ldp_routine_pending(ldp)) {
+				pa_ldp_timer_cancel(ldp, routine_to);
+				ldp->link->core->routines_pending--;
+				pa_quiesce_schedule(ldp->link->core);
+			}
+			//Backoff, adopt or apply timers are started again when resumed
+			pa_ldp_timer_cancel(ldp, backoff_to);
+			pa_ldp_unwait(ldp);
+		}
+	}
+
+	if(grace)
+		pa_timer_set(link->core, &link->suspend_to, grace);
+	else if(link->suspend_to.pending)
+		uloop_timeout_cancel(&link->suspend_to);
+}
+
+void pa_link_resume(struct pa_link *link)
+{
+	struct pa_ldp *ldp;
+	pa_record(link->record, PA_RECORD_LINK_RESUME, link, 0);
+	if(!link->suspended)
+		return;
+
+	PA_INFO("Resuming Link "PA_LINK_P, PA_LINK_PA(link));
+	link->suspended = 0;
+	if(link->suspend_to.pending)
+		uloop_timeout_cancel(&link->suspend_to);
+
+	pa_for_each_ldp_in_link(link, ldp) {
+		if(ldp->adopting)
+			pa_ldp_unadopt(ldp); //Restarts the apply timer
+		else if(ldp->assigned && !ldp->applied)
+			pa_ldp_timer_set(ldp, backoff_to, 2 * ldp->link->core->flooding_delay);
+		pa_routine_schedule(ldp);
+	}
+}
+
 int pa_link_add(struct pa_core *core, struct pa_link *link)
 {
 	PA_INFO("Adding Link "PA_LINK_P, PA_LINK_PA(link));
 	INIT_LIST_HEAD(&link->ldps);
+	link->core = core;
+	link->suspended = 0;
+	link->suspend_to.pending = 0;
+	link->suspend_to.cb = pa_link_suspend_to;
+#if PA_RECORD != 0
+	link->record = NULL;
+#endif
 	list_add_tail(&link->le, &core->links);
+	if(core->lazy_ldps && core->config_depth) {
+		core->config_populate = 1; //Pairs are created when committing
+		pa_record(core->record, PA_RECORD_LINK_ADD, link, 0);
+		return 0;
+	}
 	struct pa_dp *dp;
 	pa_for_each_dp(core, dp) {
-#ifdef PA_HIERARCHICAL
-		/* If dp is from higher level and the link is the child of a higher level link.
-		 * Compare the two links.  */
-		if(dp->ha_ldp && link->ha_parent && link->ha_parent != dp->ha_ldp->link)
+		if(!pa_ldp_pairable(link, dp) ||
+				(core->lazy_ldps && !pa_ldp_wanted(core, link, dp)))
 			continue;
-#endif
+
 		if(pa_ldp_create(core, link, dp)) {
 			PA_WARNING("FAILED to add Link "PA_LINK_P, PA_LINK_PA(link));
 			_pa_link_del(link);
 			return -1;
 		}
 	}
+	pa_record(core->record, PA_RECORD_LINK_ADD, link, 0);
 	return 0;
 }
 
 void pa_link_init(struct pa_link *link, const char *name)
 {
 	link->name = name;
+	link->suspended = 0;
 #ifdef PA_LINK_TYPE
 	link->type = PA_LINK_TYPE_NONE;
 #endif
@@ -593,10 +1589,95 @@ void pa_link_init(struct pa_link *link, const char *name)
 #endif
 }
 
+/* Creates missing pairs (for the given link, if not NULL), either all of them
+ * or only the needed ones when in lazy mode. */
+static void pa_ldp_populate(struct pa_core *core, struct pa_link *only)
+{
+	struct pa_link *link;
+	struct pa_dp *dp;
+	struct pa_ldp *ldp;
+	pa_for_each_link(core, link) {
+		if(only && link != only)
+			continue;
+
+		pa_for_each_dp(core, dp) {
+			if(!pa_ldp_pairable(link, dp))
+				continue;
+
+			pa_for_each_ldp_in_link(link, ldp) {
+				if(ldp->dp == dp)
+					goto next;
+			}
+
+			if((!core->lazy_ldps || pa_ldp_wanted(core, link, dp)) &&
+					pa_ldp_create(core, link, dp))
+				PA_WARNING("FAILED to create state for "PA_LINK_P"/"PA_DP_P,
+						PA_LINK_PA(link), PA_DP_PA(dp));
+next:
+			continue;
+		}
+	}
+}
+
+void pa_dp_update(struct pa_core *core, struct pa_dp *dp)
+{
+	struct pa_ldp *ldp;
+	bool populate = core->lazy_ldps;
+	PA_INFO("Updating Delegated Prefix "PA_DP_P, PA_DP_PA(dp));
+	pa_record(core->record, PA_RECORD_DP_UPDATE, dp, 0);
+#ifdef PA_HIERARCHICAL
+	//The higher-level pair may have changed, and with it the paired links
+	struct pa_ldp *ldp2;
+	struct pa_link *link;
+	pa_for_each_ldp_in_dp(dp, ldp) {
+		link = ldp->link;
+		if(!pa_ldp_pairable(link, dp))
+			pa_ldp_unassign(ldp);
+	}
+
+	pa_for_each_ldp_in_dp_safe(dp, ldp, ldp2) {
+		link = ldp->link;
+		if(!pa_ldp_pairable(link, dp))
+			pa_ldp_destroy(ldp);
+	}
+	populate = true;
+#endif
+	if(populate) {
+		if(core->config_depth)
+			core->config_populate = 1;
+		else
+			pa_ldp_populate(core, NULL);
+	}
+
+	pa_for_each_ldp_in_dp(dp, ldp) {
+#ifdef PA_HIERARCHICAL
+		if(ldp->applied && dp->ha_ldp && !dp->ha_ldp->applied) {
+			//Applied again once the new higher-level prefix is
+			PA_DEBUG("Higher-level prefix of "PA_LDP_P" is not applied", PA_LDP_PA(ldp));
+			ldp->applied = 0;
+			ldp->ha_apply_pending = 1;
+			pa_trace_ldp(ldp, PA_TRACE_APPLY, 0);
+			pa_user_notify(ldp, applied);
+		} else if(ldp->ha_apply_pending && (!dp->ha_ldp || dp->ha_ldp->applied)) {
+			//The higher-level prefix may have changed
+			pa_ldp_apply(ldp);
+		}
+#endif
+		pa_routine_schedule(ldp);
+	}
+}
+
 static void _pa_advp_update(struct pa_core *core, struct pa_advp *advp)
 {
 	struct pa_dp *dp;
 	struct pa_ldp *ldp;
+	if(core->lazy_ldps && advp->link) {
+		if(core->config_depth)
+			core->config_populate = 1;
+		else
+			pa_ldp_populate(core, advp->link);
+	}
+
 	pa_for_each_dp(core, dp) {
 		/* Schedule all for dps overlapping with the advp. */
 		//TODO: Maybe not necessary to schedule if we have Current and advp is not overlapping with it.
@@ -611,6 +1692,9 @@ static void _pa_advp_update(struct pa_core *core, struct pa_advp *advp)
 void pa_advp_update(struct pa_core *core, struct pa_advp *advp)
 {
 	PA_DEBUG("Updating Advertised Prefix "PA_ADVP_P, PA_ADVP_PA(advp));
+	pa_record(core->record, PA_RECORD_ADVP_UPDATE, advp, 0);
+	pa_stat(core, advp_update);
+	pa_trace_advp(core, advp, PA_TRACE_ADVP_UPDATE);
 	_pa_advp_update(core, advp);
 }
 
@@ -624,6 +1708,9 @@ int pa_advp_add(struct pa_core *core, struct pa_advp *advp)
 		return -1;
 	}
 
+	pa_record(core->record, PA_RECORD_ADVP_ADD, advp, 0);
+	pa_stat(core, advp_add);
+	pa_trace_advp(core, advp, PA_TRACE_ADVP_ADD);
 	_pa_advp_update(core, advp);
 	return 0;
 }
@@ -632,6 +1719,9 @@ int pa_advp_add(struct pa_core *core, struct pa_advp *advp)
 void pa_advp_del(struct pa_core *core, struct pa_advp *advp)
 {
 	PA_DEBUG("Deleting Advertised Prefix "PA_ADVP_P, PA_ADVP_PA(advp));
+	pa_record(core->record, PA_RECORD_ADVP_DEL, advp, 0);
+	pa_stat(core, advp_del);
+	pa_trace_advp(core, advp, PA_TRACE_ADVP_DEL);
 	btrie_remove(&advp->in_core.be);
 	_pa_advp_update(core, advp);
 }
@@ -639,7 +1729,18 @@ void pa_advp_del(struct pa_core *core, struct pa_advp *advp)
 void pa_rule_add(struct pa_core *core, struct pa_rule *rule)
 {
 	PA_DEBUG("Adding rule "PA_RULE_P, PA_RULE_PA(rule));
+	pa_record(core->record, PA_RECORD_RULE_ADD, rule, 0);
+#if PA_RULE_STATS != 0
+	pa_rule_reset_stats(rule);
+#endif
 	list_add_tail(&rule->le, &core->rules);
+	if(core->config_depth) {
+		core->config_all = 1;
+		core->config_populate = core->lazy_ldps;
+		return;
+	}
+	if(core->lazy_ldps)
+		pa_ldp_populate(core, NULL);
 	/* Schedule all routines */
 	struct pa_link *link;
 	struct pa_ldp *ldp;
@@ -651,6 +1752,7 @@ void pa_rule_add(struct pa_core *core, struct pa_rule *rule)
 void pa_rule_del(struct pa_core *core, struct pa_rule *rule)
 {
 	PA_DEBUG("Deleting rule "PA_RULE_P, PA_RULE_PA(rule));
+	pa_record(core->record, PA_RECORD_RULE_DEL, rule, 0);
 	list_del(&rule->le);
 	struct pa_link *link;
 	struct pa_ldp *ldp;
@@ -664,25 +1766,136 @@ void pa_rule_del(struct pa_core *core, struct pa_rule *rule)
 		}
 }
 
+#if PA_RULE_STATS != 0
+void pa_rule_get_stats(struct pa_rule *rule, struct pa_rule_stats *stats)
+{
+	*stats = rule->_stats;
+}
+
+void pa_rule_reset_stats(struct pa_rule *rule)
+{
+	memset(&rule->_stats, 0, sizeof(rule->_stats));
+}
+#endif
+
 void pa_core_set_flooding_delay(struct pa_core *core, uint32_t flooding_delay)
 {
 	PA_INFO("Set Flooding Delay to %"PRIu32, flooding_delay);
+	pa_record(core->record, PA_RECORD_FLOODING_DELAY, core, flooding_delay);
 	struct pa_link *link;
 	struct pa_ldp *ldp;
 	if(flooding_delay > core->flooding_delay) {
 		pa_for_each_link(core, link)
 			pa_for_each_ldp_in_link(link, ldp)
-				if(ldp->assigned && !ldp->adopting && ldp->backoff_to.pending)
-					uloop_timeout_set(&ldp->backoff_to, uloop_timeout_remaining(&ldp->backoff_to) + 2*(flooding_delay - core->flooding_delay));
+				if(ldp->assigned && !ldp->adopting && pa_ldp_backoff_pending(ldp))
+					pa_ldp_timer_set(ldp, backoff_to, uloop_timeout_remaining(&ldp->sched->backoff_to) + 2*(flooding_delay - core->flooding_delay));
 	} else if (flooding_delay < core->flooding_delay) {
 		pa_for_each_link(core, link)
 			pa_for_each_ldp_in_link(link, ldp)
-				if(ldp->assigned && !ldp->adopting && ldp->backoff_to.pending && ((uint32_t)uloop_timeout_remaining(&ldp->backoff_to) > 2*flooding_delay))
-					uloop_timeout_set(&ldp->backoff_to, 2*flooding_delay);
+				if(ldp->assigned && !ldp->adopting && pa_ldp_backoff_pending(ldp) && ((uint32_t)uloop_timeout_remaining(&ldp->sched->backoff_to) > 2*flooding_delay))
+					pa_ldp_timer_set(ldp, backoff_to, 2*flooding_delay);
 	}
 	core->flooding_delay = flooding_delay;
 }
 
+void pa_core_flooding_synced(struct pa_core *core, pa_prefix *prefix,
+		pa_plen plen, uint32_t delay)
+{
+	struct pa_pentry *pentry, *pentry2;
+	struct pa_ldp *ldp;
+	PA_DEBUG("Flooding synchronized for %s", pa_prefix_repr(prefix, plen));
+#if PA_RECORD != 0
+	if(core->record)
+		pa_record_synced(core->record, prefix, plen, delay);
+#endif
+	btrie_for_each_down_entry_safe(pentry, pentry2, &core->prefixes,
+			(btrie_key_t *)prefix, plen, be) {
+		if(pentry->type != PAT_ASSIGNED)
+			continue;
+
+		ldp = container_of(pentry, struct pa_ldp, in_core);
+		if(ldp->applied || ldp->adopting || !pa_ldp_backoff_pending(ldp))
+			continue;
+
+		if(!delay) {
+			pa_ldp_timer_cancel(ldp, backoff_to);
+			pa_ldp_apply(ldp);
+		} else if((uint32_t)uloop_timeout_remaining(&ldp->sched->backoff_to) > delay) {
+			pa_ldp_timer_set(ldp, backoff_to, delay);
+		}
+	}
+}
+
+void pa_core_config_begin(struct pa_core *core)
+{
+	pa_record(core->record, PA_RECORD_CONFIG_BEGIN, core, 0);
+	if(!core->config_depth++)
+		PA_INFO("Starting configuration transaction");
+}
+
+void pa_core_config_commit(struct pa_core *core)
+{
+	struct pa_link *link;
+	struct pa_dp *dp;
+	struct pa_ldp *ldp;
+	pa_record(core->record, PA_RECORD_CONFIG_COMMIT, core, 0);
+	if(!core->config_depth || --core->config_depth)
+		return;
+
+	PA_INFO("Committing configuration transaction");
+	if(core->config_populate)
+		pa_ldp_populate(core, NULL);
+
+	pa_for_each_dp(core, dp) {
+		if(dp->config_sched) {
+			dp->config_sched = 0;
+			pa_dp_wake(dp, dp->plen);
+		}
+	}
+
+	pa_for_each_link(core, link)
+		pa_for_each_ldp_in_link(link, ldp) {
+			if(core->config_all || ldp->config_sched) {
+				ldp->config_sched = 0;
+				pa_routine_schedule(ldp);
+			}
+		}
+
+	core->config_all = 0;
+	core->config_populate = 0;
+}
+
+void pa_core_set_lazy_ldps(struct pa_core *core, uint8_t lazy)
+{
+	struct pa_link *link;
+	struct pa_ldp *ldp;
+	PA_INFO("%s lazy Link/Delegated Prefix pairs", lazy?"Enable":"Disable");
+	pa_record(core->record, PA_RECORD_LAZY_LDPS, core, lazy);
+	core->lazy_ldps = !!lazy;
+	if(lazy) {
+		/* Idle pairs are reclaimed after their routine */
+		pa_for_each_link(core, link)
+			pa_for_each_ldp_in_link(link, ldp)
+				pa_routine_schedule(ldp);
+	} else {
+		pa_ldp_populate(core, NULL);
+	}
+}
+
+void pa_core_set_routine_budget(struct pa_core *core,
+		uint32_t max_routines, uint32_t max_us)
+{
+	PA_INFO("Set Routine Budget to %"PRIu32" routines and %"PRIu32"us",
+			max_routines, max_us);
+	core->routine_budget = max_routines;
+	core->routine_budget_us = max_us;
+	pa_record(core->record, PA_RECORD_ROUTINE_BUDGET, core, 0);
+	if(!max_routines && !max_us) {
+		uloop_timeout_cancel(&core->tick_to);
+		core->tick_routines = 0;
+	}
+}
+
 void pa_core_set_node_id(struct pa_core *core, const PA_NODE_ID_TYPE node_id[])
 {
 	PA_INFO("Set Node ID to "PA_NODE_ID_P, PA_NODE_ID_PA(node_id));
@@ -690,6 +1903,7 @@ void pa_core_set_node_id(struct pa_core *core, const PA_NODE_ID_TYPE node_id[])
 	struct pa_ldp *ldp;
 	if(memcmp(node_id, core->node_id, PA_NODE_ID_LEN*sizeof(PA_NODE_ID_TYPE))) {
 		memcpy(core->node_id, node_id, PA_NODE_ID_LEN*sizeof(PA_NODE_ID_TYPE));
+		pa_record(core->record, PA_RECORD_NODE_ID, core, 0);
 		/* Schedule routine for all pairs */
 		pa_for_each_link(core, link)
 			pa_for_each_ldp_in_link(link, ldp)
@@ -704,27 +1918,237 @@ void pa_core_init(struct pa_core *core)
 	INIT_LIST_HEAD(&core->links);
 	INIT_LIST_HEAD(&core->users);
 	INIT_LIST_HEAD(&core->rules);
+#if PA_LDP_SLAB_SIZE != 0
+	INIT_LIST_HEAD(&core->ldp_slabs);
+	INIT_LIST_HEAD(&core->sched_slabs);
+#endif
 	btrie_init(&core->prefixes);
 	memset(core->node_id, 0, PA_NODE_ID_LEN *sizeof(PA_NODE_ID_TYPE));
 	core->flooding_delay = PA_DEFAULT_FLOODING_DELAY;
 	core->adopt_delay = PA_ADOPT_DELAY_DEFAULT;
 	core->backoff_delay = PA_BACKOFF_DELAY_DEFAULT;
+	core->routine_budget = 0;
+	core->routine_budget_us = 0;
+	core->routines_pending = 0;
+	core->tick_routines = 0;
+	core->tick_start = 0;
+	core->tick_to.pending = 0;
+	core->tick_to.cb = pa_tick_to;
+	core->lazy_ldps = 0;
+	core->config_depth = 0;
+	core->config_all = 0;
+	core->config_populate = 0;
+	core->changed = 0;
+	core->quiesce_to.pending = 0;
+	core->quiesce_to.cb = pa_quiesce_to;
+#if PA_USER_BATCH_SIZE != 0
+	core->events_n = 0;
+	core->events_buf = core->events;
+	core->events_max = PA_USER_BATCH_SIZE;
+	core->batch_to.pending = 0;
+	core->batch_to.cb = pa_batch_to;
+#endif
+#if PA_CONFLICT_CACHE_SIZE != 0
+	core->conflicts_n = 0;
+	core->conflicts_next = 0;
+	core->conflicts_valid = 0;
+#endif
+#if PA_RECORD != 0
+	core->record = NULL;
+#endif
+#if PA_STATS != 0
+	pa_core_reset_stats(core);
+#endif
+#if PA_TIMELINE != 0
+	pa_core_reset_timeline(core);
+#endif
+#if PA_LATENCY != 0
+	pa_core_reset_latency(core);
+#endif
+#if PA_TRACE != 0
+	core->trace_n = 0;
+#endif
 #ifdef PA_HIERARCHICAL
 	core->ha_parent = NULL;
 #endif
 }
 
+#if PA_STATS != 0
+void pa_core_get_stats(struct pa_core *core, struct pa_core_stats *stats)
+{
+	*stats = core->stats;
+}
 
-int pa_rule_valid_assignment(struct pa_ldp *ldp, pa_prefix *prefix, pa_plen plen,
-		pa_rule_priority override_rule_priority, pa_priority override_priority,
-		uint8_t safety)
+void pa_core_reset_stats(struct pa_core *core)
+{
+	memset(&core->stats, 0, sizeof(core->stats));
+}
+#endif
+
+#if PA_TIMELINE != 0
+void pa_core_reset_timeline(struct pa_core *core)
+{
+	memset(core->timeline, 0, sizeof(core->timeline));
+}
+#endif
+
+#if PA_LATENCY != 0
+void pa_core_reset_latency(struct pa_core *core)
+{
+	struct pa_user *user;
+	memset(core->latency, 0, sizeof(core->latency));
+	pa_for_each_user(core, user)
+		memset(&user->latency, 0, sizeof(user->latency));
+}
+#endif
+
+void pa_core_term(struct pa_core *core)
+{
+	struct pa_link *link, *link2;
+	struct pa_dp *dp, *dp2;
+	struct pa_ldp *ldp, *ldp2;
+	struct pa_advp *advp, *advp2;
+	pa_prefix any;
+	size_t n = 0;
+
+	PA_INFO("Terminate Prefix Assignment Algorithm Core");
+	pa_record(core->record, PA_RECORD_CORE_TERM, core, 0);
+#ifdef PA_HIERARCHICAL
+	if(core->ha_parent)
+		pa_ha_detach(core);
+#endif
+
+	//Public part (siblings are not rescheduled)
+	pa_for_each_dp(core, dp) {
+		dp->removing = 1;
+		pa_for_each_ldp_in_dp(dp, ldp)
+			n += pa_ldp_unassign_events(ldp);
+	}
+	pa_batch_reserve(core, n);
+	pa_for_each_dp(core, dp)
+		pa_for_each_ldp_in_dp(dp, ldp)
+			pa_ldp_unassign(ldp);
+
+	//Private part
+	pa_for_each_dp_safe(core, dp, dp2) {
+		pa_for_each_ldp_in_dp_safe(dp, ldp, ldp2)
+			pa_ldp_destroy(ldp);
+		list_del(&dp->le);
+		dp->removing = 0;
+	}
+
+	pa_for_each_link_safe(core, link, link2) {
+		if(link->suspend_to.pending)
+			uloop_timeout_cancel(&link->suspend_to);
+		link->suspended = 0;
+		list_del(&link->le);
+	}
+	pa_ldp_sched_flush(core);
+
+	INIT_LIST_HEAD(&core->rules);
+
+	memset(&any, 0, sizeof(any));
+	btrie_for_each_down_entry_safe(advp, advp2, &core->prefixes,
+			(btrie_key_t *)&any, 0, in_core.be)
+		btrie_remove(&advp->in_core.be);
+
+#if PA_USER_BATCH_SIZE != 0
+	pa_batch_flush(core);
+#endif
+	if(core->tick_to.pending)
+		uloop_timeout_cancel(&core->tick_to);
+	if(core->quiesce_to.pending)
+		uloop_timeout_cancel(&core->quiesce_to);
+
+	core->routines_pending = 0;
+	core->tick_routines = 0;
+	core->config_depth = 0;
+	core->config_all = 0;
+	core->config_populate = 0;
+	core->changed = 0;
+#if PA_CONFLICT_CACHE_SIZE != 0
+	core->conflicts_n = 0;
+	core->conflicts_next = 0;
+	core->conflicts_valid = 0;
+#endif
+}
+
+
+#if PA_CONFLICT_CACHE_SIZE != 0
+/* Walks the prefix tree in order to summarize prefixes overlapping with a
+ * candidate prefix. */
+static void pa_conflict_fill(struct pa_core *core, struct pa_conflict *c,
+		pa_prefix *prefix, pa_plen plen)
 {
 	struct pa_pentry *p;
 	struct pa_advp *advp;
 	struct pa_ldp *ldp2;
 
-	if(ldp->best_assignment) {
-		if(ldp->best_assignment->priority >= override_priority)
+	pa_prefix_cpy(prefix, plen, &c->prefix, c->plen);
+	c->held = 0;
+	c->published = 0;
+	c->advertised = 0;
+	c->rule_priority = 0;
+	c->ldp_priority = 0;
+	c->advp_priority = 0;
+	pa_stat(core, updown_walks);
+	btrie_for_each_updown_entry(p, &core->prefixes, (btrie_key_t *)prefix, plen, be) {
+		pa_stat(core, updown_elements);
+		if(p->type == PAT_ASSIGNED) {
+			ldp2 = container_of(p, struct pa_ldp, in_core);
+			if(ldp2->published || ldp2->adopting) {
+				if(!c->held || ldp2->rule_priority > c->rule_priority)
+					c->rule_priority = ldp2->rule_priority;
+				c->held = 1;
+			}
+			if(ldp2->published) {
+				if(!c->published || ldp2->priority > c->ldp_priority)
+					c->ldp_priority = ldp2->priority;
+				c->published = 1;
+			}
+		} else if (p->type == PAT_ADVERTISED) {
+			advp = container_of(p, struct pa_advp, in_core);
+			if(!c->advertised || advp->priority > c->advp_priority)
+				c->advp_priority = advp->priority;
+			c->advertised = 1;
+		}
+	}
+}
+
+/* Returns the conflict summary of a candidate prefix, using the cache when
+ * called during the routine. */
+static struct pa_conflict *pa_conflict_get(struct pa_core *core,
+		struct pa_conflict *c, pa_prefix *prefix, pa_plen plen)
+{
+	uint8_t i;
+	if(!core->conflicts_valid) {
+		pa_conflict_fill(core, c, prefix, plen);
+		return c;
+	}
+
+	for(i = 0; i < core->conflicts_n; i++) {
+		if(pa_prefix_equals(prefix, plen, &core->conflicts[i].prefix, core->conflicts[i].plen))
+			return &core->conflicts[i];
+	}
+
+	if(core->conflicts_n < PA_CONFLICT_CACHE_SIZE) {
+		c = &core->conflicts[core->conflicts_n++];
+	} else {
+		c = &core->conflicts[core->conflicts_next];
+		core->conflicts_next = (core->conflicts_next + 1) % PA_CONFLICT_CACHE_SIZE;
+	}
+	pa_conflict_fill(core, c, prefix, plen);
+	return c;
+}
+#endif
+
+int pa_rule_valid_assignment(struct pa_ldp *ldp, pa_prefix *prefix, pa_plen plen,
+		pa_rule_priority override_rule_priority, pa_priority override_priority,
+		uint8_t safety)
+{
+	struct pa_advp *best_assignment = pa_ldp_best_assignment(ldp);
+	if(best_assignment) {
+		if(best_assignment->priority >= override_priority)
 			return 0;
 	} else if(ldp->assigned) {
 		if((ldp->published || ldp->adopting) && (ldp->rule_priority >= override_rule_priority))
@@ -733,7 +2157,22 @@ int pa_rule_valid_assignment(struct pa_ldp *ldp, pa_prefix *prefix, pa_plen plen
 			return 0;
 	}
 
-	btrie_for_each_updown_entry(p, &ldp->core->prefixes, (btrie_key_t *)prefix, plen, be) {
+#if PA_CONFLICT_CACHE_SIZE != 0
+	struct pa_conflict tmp, *c;
+	c = pa_conflict_get(ldp->link->core, &tmp, prefix, plen);
+	if(c->held && (c->rule_priority >= override_rule_priority))
+		return 0;
+	if(safety && c->published && (c->ldp_priority > override_priority))
+		return 0;
+	if(c->advertised && (c->advp_priority >= override_priority))
+		return 0;
+#else
+	struct pa_pentry *p;
+	struct pa_advp *advp;
+	struct pa_ldp *ldp2;
+	pa_stat(ldp->link->core, updown_walks);
+	btrie_for_each_updown_entry(p, &ldp->link->core->prefixes, (btrie_key_t *)prefix, plen, be) {
+		pa_stat(ldp->link->core, updown_elements);
 		if(p->type == PAT_ASSIGNED) {
 			ldp2 = container_of(p, struct pa_ldp, in_core);
 			if((ldp2->published || ldp2->adopting) && (ldp2->rule_priority >= override_rule_priority))
@@ -746,6 +2185,7 @@ int pa_rule_valid_assignment(struct pa_ldp *ldp, pa_prefix *prefix, pa_plen plen
 				return 0;
 		}
 	}
+#endif
 	return 1;
 }
 
@@ -838,9 +2278,15 @@ static void pa_ha_applied_cb(struct pa_user *user, struct pa_ldp *ldp)
 
 void pa_ha_attach(struct pa_core *child, struct pa_core *parent, uint8_t fast_assignment)
 {
+	child->ha_user.name = "ha";
 	child->ha_user.applied = pa_ha_applied_cb;
 	child->ha_user.assigned = fast_assignment?pa_ha_assigned_cb:NULL;
 	child->ha_user.published = NULL;
+	child->ha_user.republished = NULL;
+	child->ha_user.quiescent = NULL;
+#if PA_USER_BATCH_SIZE != 0
+	child->ha_user.batch = NULL;
+#endif
 	child->ha_parent = parent;
 
 	/* Attach to parent */
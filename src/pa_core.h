@@ -57,6 +57,67 @@ const char *pa_hex_dump(uint8_t *ptr, size_t len, char *s);
 #define PA_RUN_DELAY 20
 #endif
 
+#ifndef PA_CONFLICT_CACHE_SIZE
+#define PA_CONFLICT_CACHE_SIZE 8
+#endif
+
+#ifndef PA_USER_BATCH_SIZE
+#define PA_USER_BATCH_SIZE 64
+#endif
+
+#ifndef PA_LDP_SLAB_SIZE
+#define PA_LDP_SLAB_SIZE 64
+#endif
+#if PA_LDP_SLAB_SIZE > 256
+#error "PA_LDP_SLAB_SIZE must be at most 256"
+#endif
+
+#ifndef PA_RECORD
+#define PA_RECORD 0
+#endif
+
+#ifndef PA_STATS
+#define PA_STATS 0
+#endif
+
+#ifndef PA_RULE_STATS
+#define PA_RULE_STATS 0
+#endif
+
+#ifndef PA_TIMELINE
+#define PA_TIMELINE 0
+#endif
+
+#ifndef PA_LATENCY
+#define PA_LATENCY 0
+#endif
+
+#ifndef PA_TRACE
+#define PA_TRACE 0
+#endif
+
+#ifndef PA_TRACE_RULE_NAME_LEN
+#define PA_TRACE_RULE_NAME_LEN 16
+#endif
+
+#if (PA_TRACE & (PA_TRACE - 1)) != 0
+#error "PA_TRACE must be a power of two"
+#endif
+
+/* Histograms are compiled when some option needs them. */
+#define PA_HISTOGRAMS (PA_TIMELINE != 0 || PA_LATENCY != 0)
+
+#ifndef pa_clock_us
+#include <time.h>
+static inline uint64_t pa_clock_monotonic_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+#define pa_clock_us() pa_clock_monotonic_us()
+#endif
+
 #include "bitops.h"
 #define pa_prefix_cpy(sp, splen, dp, dplen) \
 			do {bmemcpy(dp, sp, 0, splen); dplen = splen; } while(0)
@@ -72,16 +133,157 @@ const char *pa_hex_dump(uint8_t *ptr, size_t len, char *s);
 
 struct pa_ldp;
 
+#if PA_CONFLICT_CACHE_SIZE != 0
+/**
+ * Summary of all Assigned and Advertised Prefixes overlapping with a
+ * candidate prefix. Used by pa_rule_valid_assignment.
+ */
+struct pa_conflict {
+	/* The candidate prefix. */
+	pa_prefix prefix;
+	pa_plen plen;
+
+	/* Some overlapping Assigned Prefix is published or adopted. */
+	uint8_t held       : 1;
+
+	/* Some overlapping Assigned Prefix is published. */
+	uint8_t published  : 1;
+
+	/* Some overlapping Advertised Prefix exists. */
+	uint8_t advertised : 1;
+
+	/* Highest rule priority of published or adopted overlapping ldps. */
+	pa_rule_priority rule_priority;
+
+	/* Highest priority of published overlapping ldps. */
+	pa_priority ldp_priority;
+
+	/* Highest priority of overlapping Advertised Prefixes. */
+	pa_priority advp_priority;
+};
+#endif
+
+#if PA_HISTOGRAMS != 0
+/* Number of histogram buckets. */
+#define PA_HISTOGRAM_BUCKETS 32
+
+/**
+ * Log-bucketed histogram.
+ *
+ * Bucket 0 counts null values, and bucket i > 0 counts values within
+ * [2^(i-1), 2^i - 1]. The last bucket also counts larger values.
+ */
+struct pa_histogram {
+	uint64_t count; /* Number of values. */
+	uint64_t sum;   /* Sum of all values. */
+	uint64_t max;   /* Largest value. */
+	uint32_t buckets[PA_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Adds a value to a histogram.
+ */
+void pa_histogram_add(struct pa_histogram *h, uint64_t value);
+
+/**
+ * Returns an upper bound of the given percentile (0 to 100) of the values
+ * added to the histogram, or 0 if it is empty.
+ */
+uint64_t pa_histogram_percentile(const struct pa_histogram *h,
+		unsigned int percent);
+#endif
+
+#if PA_TRACE != 0
+/**
+ * Traced event types.
+ */
+enum pa_trace_type {
+	PA_TRACE_NONE = 0,
+	PA_TRACE_LDP_CREATE,  /* A pair was created. */
+	PA_TRACE_LDP_DESTROY, /* A pair was destroyed. */
+	PA_TRACE_ROUTINE,     /* Routine executed (value is 1 for backoff). */
+	PA_TRACE_RULE,        /* Best rule result (value is the rule target,
+	                         prefix is the published one, if any). */
+	PA_TRACE_BACKOFF,     /* Backoff timer started. */
+	PA_TRACE_WAIT,        /* No prefix found, waiting for space. */
+	PA_TRACE_ASSIGN,      /* Assigned (value) or un-assigned. */
+	PA_TRACE_PUBLISH,     /* Published (value) or un-published. */
+	PA_TRACE_ADOPT,       /* Adoption started. */
+	PA_TRACE_APPLY,       /* Applied (value) or un-applied. */
+	PA_TRACE_ADVP_ADD,    /* Advertised Prefix added. */
+	PA_TRACE_ADVP_DEL,    /* Advertised Prefix removed. */
+	PA_TRACE_ADVP_UPDATE, /* Advertised Prefix updated. */
+	PA_TRACE_TYPE_MAX,
+};
+
+/**
+ * Fixed-size trace record.
+ */
+struct pa_trace_event {
+	uint64_t time;           /* pa_clock_us() value. */
+	const void *object;      /* The pair or Advertised Prefix (Only used as
+	                            an identifier). */
+	pa_prefix prefix;
+	pa_plen plen;
+	uint8_t type;            /* enum pa_trace_type */
+	uint8_t value;           /* Type specific value. */
+	pa_priority priority;
+	pa_rule_priority rule_priority;
+	char rule[PA_TRACE_RULE_NAME_LEN]; /* Name of the winning rule of
+	                            PA_TRACE_RULE events (truncated). */
+};
+#endif
+
 /***************************
  *         User API        *
  ***************************/
 
+#if PA_USER_BATCH_SIZE != 0
+/**
+ * Assigned Prefix event types.
+ */
+enum pa_event_type {
+	PA_EVENT_ASSIGNED,
+	PA_EVENT_PUBLISHED,
+	PA_EVENT_APPLIED,
+	PA_EVENT_REPUBLISHED,
+};
+
+/**
+ * Assigned Prefix event, as delivered to batch users.
+ *
+ * The Assigned Prefix state may have changed since the event occurred.
+ * Event attributes are a copy of the ldp state at the time it occurred.
+ */
+struct pa_event {
+	/* The Assigned Prefix. Valid during the batch callback. */
+	struct pa_ldp *ldp;
+
+	/* What happened. */
+	enum pa_event_type type;
+
+	/* Value of the assigned, published or applied flag (1 when
+	 * republished). */
+	uint8_t value;
+
+	/* Assigned prefix. */
+	pa_prefix prefix;
+	pa_plen plen;
+
+	/* Advertised priority. */
+	pa_priority priority;
+};
+#endif
+
 /**
  * Users may subscribe to PA events using this structure.
  */
 struct pa_user {
 	struct list_head le; /* Linked in pa_core. */
 
+	/* User name, reported in metrics (may be NULL). */
+	const char *name;
+
 	/**
 	 * A prefix is assigned or unassigned.
 	 *
@@ -97,12 +299,51 @@ struct pa_user {
 	 */
 	void (*published)(struct pa_user *, struct pa_ldp *);
 
+	/**
+	 * A published prefix is still published, but with a different priority
+	 * or by a different rule.
+	 *
+	 * When NULL, published is called instead.
+	 */
+	void (*republished)(struct pa_user *, struct pa_ldp *);
+
 	/**
 	 * A prefix can be used or should stop being used.
 	 *
 	 * Always called with assigned == 1.
 	 */
 	void (*applied)(struct pa_user *, struct pa_ldp *);
+
+	/**
+	 * A burst of changes is over.
+	 *
+	 * Called once after one or more of the above callbacks were called, when
+	 * no routine is pending and nothing changed for PA_RUN_DELAY. Flooding
+	 * users may use it in order to send a single consolidated update.
+	 */
+	void (*quiescent)(struct pa_user *);
+
+#if PA_USER_BATCH_SIZE != 0
+	/**
+	 * Batched assigned, published, applied and republished events.
+	 *
+	 * Events are buffered and delivered in order, once control is given
+	 * back to the event loop, or when PA_USER_BATCH_SIZE events are
+	 * buffered (bulk removals buffer as many as needed), or before some
+	 * Assigned Prefix is destroyed.
+	 * Users may use it instead of, or in addition to, the per-event
+	 * callbacks.
+	 */
+	void (*batch)(struct pa_user *, const struct pa_event *events, size_t n);
+#endif
+
+#if PA_LATENCY != 0
+	/**
+	 * Execution time, in microseconds, of the user callbacks.
+	 * Reset when the user is registered.
+	 */
+	struct pa_histogram latency;
+#endif
 };
 
 /**
@@ -111,10 +352,19 @@ struct pa_user {
  * When added, the user *does not* receive callbacks for existing prefixes.
  * Use iterators (pa_for_each_ldp_in_link) if it is desired.
  */
+#if PA_LATENCY != 0
+#include <string.h>
+#define pa_user_register(core, user) do { \
+		memset(&(user)->latency, 0, sizeof((user)->latency)); \
+		list_add(&(user)->le, &(core)->users); } while(0)
+#else
 #define pa_user_register(core, user) list_add(&(user)->le, &(core)->users)
+#endif
 
 /**
  * Unregister a user.
+ *
+ * A user may unregister, and free, itself from within its callbacks.
  */
 #define pa_user_unregister(user) list_del(&(user)->le)
 
@@ -123,6 +373,67 @@ struct pa_user {
  *       Generic API       *
  ***************************/
 
+#if PA_STATS != 0
+/**
+ * Performance counters of a core, counted since pa_core_init or the last
+ * pa_core_reset_stats call.
+ */
+struct pa_core_stats {
+	uint64_t routines;          /* Regular routines executed. */
+	uint64_t routines_backoff;  /* Routines executed when backoff expired. */
+	uint64_t rule_filter;       /* Rule filter_accept calls. */
+	uint64_t rule_max_priority; /* Rule get_max_priority calls. */
+	uint64_t rule_match;        /* Rule match calls. */
+	uint64_t updown_walks;      /* Walks over overlapping prefixes. */
+	uint64_t updown_elements;   /* Prefixes visited during these walks. */
+	uint64_t timers;            /* Core and pair timers armed. */
+	uint64_t assign;            /* Prefixes assigned. */
+	uint64_t publish;           /* Assigned Prefixes published. */
+	uint64_t apply;             /* Assigned Prefixes applied. */
+	uint64_t unassign;          /* Assigned Prefixes removed. */
+	uint64_t advp_add;          /* Advertised Prefixes added. */
+	uint64_t advp_del;          /* Advertised Prefixes removed. */
+	uint64_t advp_update;       /* Advertised Prefixes updated. */
+};
+#endif
+
+#if PA_TIMELINE != 0
+/* Events remembered by each Link/Delegated Prefix pair. */
+enum pa_timeline_event {
+	PA_TL_CREATED,    /* Pair creation. */
+	PA_TL_ROUTINE,    /* First routine execution. */
+	PA_TL_BACKOFF,    /* Last backoff timer start. */
+	PA_TL_ASSIGNED,   /* Last time a prefix was assigned. */
+	PA_TL_PUBLISHED,  /* Last time the prefix was published. */
+	PA_TL_ADOPTED,    /* Last time the prefix was adopted. */
+	PA_TL_APPLIED,    /* Last time the prefix was applied. */
+	PA_TL_UNASSIGNED, /* Last time the prefix was un-assigned. */
+	PA_TL_MAX,
+};
+
+/* Convergence latencies, in milliseconds, aggregated by the core. */
+enum pa_timeline_histogram {
+	PA_TL_H_CREATED_ASSIGNED, /* From creation to the first assignment. */
+	PA_TL_H_BACKOFF_ASSIGNED, /* From backoff start to the assignment made
+	                             by the backoff routine. */
+	PA_TL_H_ASSIGNED_APPLIED, /* From assignment to application. */
+	PA_TL_H_CREATED_APPLIED,  /* From creation to the first application. */
+	PA_TL_H_MAX,
+};
+#endif
+
+#if PA_LATENCY != 0
+/* Event loop latencies, in microseconds, measured by the core. */
+enum pa_latency_histogram {
+	PA_LAT_ROUTINE_LAG, /* From routine timer expiry to its execution. */
+	PA_LAT_BACKOFF_LAG, /* From backoff, adopt or apply timer expiry to its
+	                       execution. */
+	PA_LAT_ROUTINE,     /* Routine execution time. */
+	PA_LAT_USER,        /* User callbacks execution time. */
+	PA_LAT_MAX,
+};
+#endif
+
 /**
  * Structure containing state specific to the overall algorithm.
  */
@@ -157,6 +468,105 @@ struct pa_core {
 	/* List of all PA rules. */
 	struct list_head rules;
 
+#if PA_LDP_SLAB_SIZE != 0
+	/* Slabs ldps are allocated from. Slabs with free slots come first. */
+	struct list_head ldp_slabs;
+
+	/* Slabs ldp scheduling states are allocated from, the same way. */
+	struct list_head sched_slabs;
+#endif
+
+	/* Maximum number of routines executed during a single event loop
+	 * iteration (0 means unlimited). */
+	uint32_t routine_budget;
+
+	/* Maximum time, in microseconds, spent executing routines during a single
+	 * event loop iteration (0 means unlimited). */
+	uint32_t routine_budget_us;
+
+	/* Number of scheduled routines, including deferred ones. */
+	uint32_t routines_pending;
+
+	/* Number of routines executed during the current iteration, and the time
+	 * the first one was executed at (only when a budget is set). */
+	uint32_t tick_routines;
+	uint64_t tick_start;
+
+	/* Fires once control was given back to the event loop. */
+	struct uloop_timeout tick_to;
+
+	/* Link/Delegated Prefix pairs are only created when needed. */
+	uint8_t lazy_ldps;
+
+	/* Configuration transactions nesting depth. */
+	uint32_t config_depth;
+
+	/* (in transaction) All pairs must be scheduled when committing. */
+	uint8_t config_all;
+
+	/* (in transaction and lazy) Missing pairs must be created when
+	 * committing. */
+	uint8_t config_populate;
+
+	/* Set when users were notified of some change since the last time they
+	 * were told about quiescence. */
+	uint8_t changed;
+
+	/* Fires when no change occurred and no routine was pending for
+	 * PA_RUN_DELAY. */
+	struct uloop_timeout quiesce_to;
+
+#if PA_USER_BATCH_SIZE != 0
+	/* Events buffered for batch users. */
+	struct pa_event events[PA_USER_BATCH_SIZE];
+	size_t events_n;
+
+	/* Either events, or a larger buffer reserved for a bulk removal. */
+	struct pa_event *events_buf;
+	size_t events_max;
+
+	/* Delivers buffered events once control is given back to the event loop. */
+	struct uloop_timeout batch_to;
+#endif
+
+#if PA_CONFLICT_CACHE_SIZE != 0
+	/* (in routine) Conflict summaries of already checked candidates.
+	 * Only used while rules are executed, as the prefix tree and ldps
+	 * states do not change in the meantime. */
+	struct pa_conflict conflicts[PA_CONFLICT_CACHE_SIZE];
+	uint8_t conflicts_n;     /* Number of cached summaries. */
+	uint8_t conflicts_next;  /* Next entry to be replaced when full. */
+	uint8_t conflicts_valid; /* Whether caching is currently enabled. */
+#endif
+
+#if PA_RECORD != 0
+	/* Recorder or replayer the core is attached to, or NULL
+	 * (See pa_record.h). */
+	struct pa_record *record;
+#endif
+
+#if PA_STATS != 0
+	/* Performance counters. */
+	struct pa_core_stats stats;
+#endif
+
+#if PA_TIMELINE != 0
+	/* Convergence latency histograms. */
+	struct pa_histogram timeline[PA_TL_H_MAX];
+#endif
+
+#if PA_LATENCY != 0
+	/* Event loop latency histograms. */
+	struct pa_histogram latency[PA_LAT_MAX];
+#endif
+
+#if PA_TRACE != 0
+	/* Trace ring buffer, and total number of traced events
+	 * (See pa_trace.h). */
+	struct pa_trace_event trace[PA_TRACE];
+	uint32_t trace_n;
+#endif
+
 #ifdef PA_HIERARCHICAL
 
 	/* When not-null, points to the parent pa_core structure. */
@@ -180,6 +590,23 @@ struct pa_core {
  */
 void pa_core_init(struct pa_core *core);
 
+/**
+ * Terminates a pa_core structure.
+ *
+ * All Assigned Prefixes are removed, and users are notified as usual.
+ * Unassign events are delivered to batch users in a single call, unless the
+ * events buffer cannot be allocated, in which case they are delivered
+ * PA_USER_BATCH_SIZE at a time.
+ * All Delegated Prefixes, links, rules and Advertised Prefixes are then
+ * removed at once, without scheduling any routine, and all memory is freed.
+ * Users stay registered, and the structure may be used again.
+ *
+ * When the core is attached to a parent, it is detached first.
+ *
+ * @param core The PA core structure.
+ */
+void pa_core_term(struct pa_core *core);
+
 /**
  * Sets the local node ID.
  *
@@ -204,6 +631,155 @@ void pa_core_set_node_id(struct pa_core *core,
  */
 void pa_core_set_flooding_delay(struct pa_core *core, uint32_t flooding_delay);
 
+/**
+ * Notifies that the flooding mechanism is synchronized.
+ *
+ * The flooding mechanism may know that all nodes received the current state,
+ * in which case waiting for the whole apply delay is not necessary.
+ * Running apply timers of Assigned Prefixes included in the given prefix are
+ * set to 'min(remaining, delay)'. When the delay is 0, prefixes are applied
+ * right away.
+ *
+ * @param core The PA core structure.
+ * @param prefix The synchronized prefix.
+ * @param plen The synchronized prefix length (0 for all prefixes).
+ * @param delay The remaining apply delay in milliseconds.
+ */
+void pa_core_flooding_synced(struct pa_core *core, pa_prefix *prefix,
+		pa_plen plen, uint32_t delay);
+
+/**
+ * Bounds the work done by PA during a single event loop iteration.
+ *
+ * When many routines are scheduled at once, they are all executed in a row
+ * by default. When a budget is set, routines exceeding the budget are
+ * deferred to the next event loop iteration, such that other event loop
+ * users are not starved.
+ *
+ * @param core The PA core structure.
+ * @param max_routines Maximum number of routines per iteration
+ *        (0 means unlimited).
+ * @param max_us Maximum time spent in routines per iteration, in
+ *        microseconds (0 means unlimited).
+ */
+void pa_core_set_routine_budget(struct pa_core *core,
+		uint32_t max_routines, uint32_t max_us);
+
+/**
+ * Starts a configuration transaction.
+ *
+ * Links, Delegated Prefixes, rules and other configuration changes made
+ * until the matching pa_core_config_commit() call are applied at once:
+ * routines are not scheduled during the transaction, and each affected pair
+ * is scheduled a single time when committing.
+ *
+ * Transactions may be nested. Only the outermost commit has an effect.
+ *
+ * @param core The PA core structure.
+ */
+void pa_core_config_begin(struct pa_core *core);
+
+/**
+ * Ends a configuration transaction started with pa_core_config_begin().
+ *
+ * Removing links or Delegated Prefixes within a transaction is cheap, as
+ * remaining pairs are scheduled once when committing rather than after
+ * each removed Assigned Prefix.
+ *
+ * @param core The PA core structure.
+ */
+void pa_core_config_commit(struct pa_core *core);
+
+/**
+ * Enables or disables lazy Link/Delegated Prefix pairs.
+ *
+ * By default, a pair is created for every Link and Delegated Prefix
+ * combination. In lazy mode, a pair is only created when some rule filter
+ * accepts it, or when an Advertised Prefix is advertised on the link within
+ * the Delegated Prefix. Pairs which stay unassigned and are not needed
+ * anymore are destroyed once their routine was executed.
+ *
+ * Rule filters are evaluated on a temporary pair which only has its core,
+ * link and dp attributes set. In lazy mode, filters must therefore only
+ * depend on these, and rules must be added again when their filter
+ * changes.
+ *
+ * When disabled, missing pairs are created.
+ *
+ * @param core The PA core structure.
+ * @param lazy Whether pairs are created lazily.
+ */
+void pa_core_set_lazy_ldps(struct pa_core *core, uint8_t lazy);
+
+/**
+ * Returns the number of routines which are scheduled or were deferred
+ * because of the routine budget.
+ */
+#define pa_core_pending_routines(core) ((core)->routines_pending)
+
+#if PA_STATS != 0
+/**
+ * Copies the performance counters of the core.
+ *
+ * @param core The PA core structure.
+ * @param stats The structure the counters are copied into.
+ */
+void pa_core_get_stats(struct pa_core *core, struct pa_core_stats *stats);
+
+/**
+ * Sets all performance counters of the core to zero.
+ *
+ * @param core The PA core structure.
+ */
+void pa_core_reset_stats(struct pa_core *core);
+#endif
+
+#if PA_TIMELINE != 0
+/**
+ * Returns one of the convergence latency histograms of the core.
+ */
+#define pa_core_timeline(core, histogram) \
+	((const struct pa_histogram *)&(core)->timeline[histogram])
+
+/**
+ * Empties the convergence latency histograms of the core.
+ *
+ * @param core The PA core structure.
+ */
+void pa_core_reset_timeline(struct pa_core *core);
+#endif
+
+#if PA_LATENCY != 0
+/**
+ * Returns one of the event loop latency histograms of the core.
+ * The time spent in each user's callbacks is also available in the user
+ * structure.
+ */
+#define pa_core_latency(core, histogram) \
+	((const struct pa_histogram *)&(core)->latency[histogram])
+
+/**
+ * Empties the event loop latency histograms of the core and of its users.
+ *
+ * @param core The PA core structure.
+ */
+void pa_core_reset_latency(struct pa_core *core);
+#endif
+
+/**
+ * Random values used by the core and the rules. When the core is recorded,
+ * values are written into the record, and when replayed, recorded values are
+ * returned instead.
+ */
+#if PA_RECORD != 0
+struct pa_record;
+int pa_record_rand(struct pa_record *record, int value);
+#define pa_core_rand(core) ((core)->record? \
+		pa_record_rand((core)->record, pa_rand()):pa_rand())
+#else
+#define pa_core_rand(core) pa_rand()
+#endif
+
 
 
 /**
@@ -220,6 +796,21 @@ struct pa_link {
 	/* Link name. Only used for logging (NULL is ok). */
 	const char *name;
 
+	/* (private) The core the link was added to. */
+	struct pa_core *core;
+
+	/* (private) The link is suspended. */
+	uint8_t suspended;
+
+	/* (private) Grace period timer of a suspended link. */
+	struct uloop_timeout suspend_to;
+
+#if PA_RECORD != 0
+	/* (private) Recorder and identifier in the record. */
+	struct pa_record *record;
+	uint32_t record_id;
+#endif
+
 #ifdef PA_LINK_TYPE
 	/* Link type identifier provided by user.
 	 * Set to PA_LINK_TYPE_NONE if it has no type.
@@ -261,6 +852,31 @@ int pa_link_add(struct pa_core *, struct pa_link *);
  */
 void pa_link_del(struct pa_link *);
 
+/**
+ * Suspends a Link, e.g. while it is flapping.
+ *
+ * Routines are not executed for the Link/Delegated Prefix pairs of a
+ * suspended link, and Assigned and Applied Prefixes are kept as they are,
+ * unless another node's Advertised Prefix takes precedence, in which case
+ * the Assigned Prefix is given up.
+ * When the link is not resumed within the grace period, Assigned Prefixes
+ * are removed, but the link remains suspended.
+ *
+ * @param link The suspended link.
+ * @param grace The grace period in milliseconds, or 0 in order to keep
+ *        Assigned Prefixes until the link is resumed, removed, or
+ *        overridden.
+ */
+void pa_link_suspend(struct pa_link *link, uint32_t grace);
+
+/**
+ * Resumes a suspended Link.
+ *
+ * Routines are scheduled for all pairs of the link, and timers which were
+ * pending when the link was suspended are started again.
+ */
+void pa_link_resume(struct pa_link *link);
+
 /* Iterates over all links. */
 #define pa_for_each_link(pa_core, pa_link) \
 	list_for_each_entry(pa_link, &(pa_core)->links, le)
@@ -285,6 +901,10 @@ struct pa_dp {
 	 * Delegated Prefix. */
 	struct list_head ldps;
 
+	/* (private) Pairs waiting for space to be released in this Delegated
+	 * Prefix, in arrival order. */
+	struct list_head waiters;
+
 	/* The delegated prefix value. */
 	pa_prefix prefix;
 
@@ -295,6 +915,20 @@ struct pa_dp {
 	/* Delegated Prefix type identifier provided by user. */
 	uint8_t type;
 #endif
+
+	/* (private) The Delegated Prefix is being removed. */
+	uint8_t removing    : 1;
+
+	/* (private, in configuration transaction) Waiting pairs must be
+	 * scheduled when committing. */
+	uint8_t config_sched : 1;
+
+#if PA_RECORD != 0
+	/* (private) Recorder and identifier in the record. */
+	struct pa_record *record;
+	uint32_t record_id;
+#endif
+
 #ifdef PA_HIERARCHICAL
 	/* NULL, or the higher-level Link/Delegated Prefix this Delegated Prefix
 	 * is associated with.
@@ -322,6 +956,35 @@ int pa_dp_add(struct pa_core *, struct pa_dp *);
  */
 void pa_dp_del(struct pa_dp *);
 
+/**
+ * Removes several Delegated Prefixes and Links at once.
+ *
+ * All their pairs are unassigned first, without rescheduling siblings which
+ * are removed as well, and unassign events are delivered to batch users in a
+ * single call. Remaining pairs are scheduled once all removals are done.
+ *
+ * @param core The PA core structure.
+ * @param dps The removed Delegated Prefixes.
+ * @param dps_n Number of removed Delegated Prefixes.
+ * @param links The removed Links.
+ * @param links_n Number of removed Links.
+ */
+void pa_core_bulk_del(struct pa_core *core, struct pa_dp **dps, size_t dps_n,
+		struct pa_link **links, size_t links_n);
+
+/**
+ * Notify a change in a Delegated Prefix.
+ *
+ * Any attribute but the prefix and plen attributes may be updated this way.
+ * Link/Delegated Prefix pairs are kept, and so are their Assigned and Applied
+ * Prefixes, while routines are scheduled in order for rules to take the
+ * changes into account.
+ * When ha_ldp changes, pairs are created or destroyed following the links
+ * hierarchy, and Applied Prefixes are un-applied until the new higher-level
+ * prefix is applied.
+ */
+void pa_dp_update(struct pa_core *, struct pa_dp *);
+
 /* Iterates over all delegated prefixes. */
 #define pa_for_each_dp(pa_core, pa_dp) \
 	list_for_each_entry(pa_dp, &(pa_core)->dps, le)
@@ -347,11 +1010,51 @@ struct pa_pentry {
 #define PAT_ADVERTISED 0x02  /* For advertised prefixes. */
 };
 
+/**
+ * Scheduling state of a Link/Delegated Prefix pair.
+ *
+ * It is only allocated while a timer is pending, the routine is executed,
+ * a speculative candidate is kept or the pair waits for space, such that
+ * idle pairs stay small.
+ */
+struct pa_ldp_sched {
+
+	/* The associated pair. */
+	struct pa_ldp *ldp;
+
+	/* Timer used to schedule the routine. */
+	struct uloop_timeout routine_to;
+
+	/* Timer used to backoff prefix generation, adoption or apply. */
+	struct uloop_timeout backoff_to;
+
+	/* (in routine) Best on-link assignment. */
+	struct pa_advp *best_assignment;
+
+	/* (if waiting) Linked in the Delegated Prefix waiting list. */
+	struct list_head in_waiters;
+
+	/* (if candidate) The speculative candidate prefix. Rules must check it
+	 * is still valid before using it. */
+	pa_prefix candidate_prefix;
+	pa_plen candidate_plen;
+
+#if PA_LDP_SLAB_SIZE != 0
+	/* (private) Position in the slab the state was allocated from. */
+	uint8_t slab_index;
+#endif
+
+#if PA_LATENCY != 0
+	/* Time, in microseconds, at which timers are expected to fire. */
+	uint64_t routine_to_due;
+	uint64_t backoff_to_due;
+#endif
+};
+
 /**
  * Link/Delegated Prefix pair.
  */
 struct pa_ldp {
-
 	/* (if assigned) Linked in pa_core. */
 	struct pa_pentry in_core;
 
@@ -361,14 +1064,31 @@ struct pa_ldp {
 	/* Linked in the Delegated Prefix structure. */
 	struct list_head in_dp;
 
-	/* The associated Link. */
+	/* The associated Link. Its core is the one the pair belongs to. */
 	struct pa_link *link;
 
 	/* The associated Delegated Prefix. */
 	struct pa_dp *dp;
 
-	/* Back-pointer to the associated pa_core struct */
-	struct pa_core *core;
+	/* (if published or adopting)
+	 * The rule used to publish or adopt this prefix. */
+	struct pa_rule *rule;
+
+	/* Scheduling state, or NULL when the pair is idle.
+	 * (in routine) Always allocated. */
+	struct pa_ldp_sched *sched;
+
+	/* (if assigned or in user->assigned)
+	 * The Assigned Prefix. */
+	pa_prefix prefix;
+
+	/* (if assigned or in user->assigned)
+	 * The Assigned Prefix length. */
+	pa_plen plen;
+
+	/* (if published or in user->published)
+	 * The Advertised Prefix Priority. */
+	pa_priority priority;
 
 	/* There is an associated Assigned Prefix. */
 	uint8_t assigned  : 1;
@@ -392,34 +1112,37 @@ struct pa_ldp {
 	uint8_t ha_apply_pending : 1;
 #endif
 
-	/* (if assigned or in user->assigned)
-	 * The Assigned Prefix. */
-	pa_prefix prefix;
+	/* (if !assigned) A rule proposed a speculative candidate when starting the
+	 * backoff timer. It is kept in the scheduling state and forgotten once
+	 * the backoff routine was executed. */
+	uint8_t candidate : 1;
 
-	/* (if assigned or in user->assigned)
-	 * The Assigned Prefix length. */
-	pa_plen plen;
+	/* The routine will be scheduled when the configuration transaction is
+	 * committed. */
+	uint8_t config_sched : 1;
 
-	/* (if published or in user->published)
-	 * The Advertised Prefix Priority. */
-	pa_priority priority;
+	/* (if !assigned) The routine found no prefix. The pair waits for some
+	 * space to be released in the Delegated Prefix. */
+	uint8_t waiting : 1;
+
+	/* (private) The routine is being executed. */
+	uint8_t in_routine : 1;
+
+#if PA_LDP_SLAB_SIZE != 0
+	/* (private) Position in the slab the ldp was allocated from. */
+	uint8_t slab_index;
+#endif
 
 	/* (if published or adopting)
 	 * The internal rule priority. */
 	pa_rule_priority rule_priority;
 
-	/* (if published or adopting)
-	 * The rule used to publish or adopt this prefix. */
-	struct pa_rule *rule;
-
-	/* Timer used to schedule the routine. */
-	struct uloop_timeout routine_to;
-
-	/* Timer used to backoff prefix generation, adoption or apply. */
-	struct uloop_timeout backoff_to;
-
-	/* (in routine) Best on-link assignment. */
-	struct pa_advp *best_assignment;
+#if PA_TIMELINE != 0
+	/* Time, in microseconds, at which events occurred, if their bit is set in
+	 * timeline_set (See enum pa_timeline_event). */
+	uint64_t timeline[PA_TL_MAX];
+	uint8_t timeline_set;
+#endif
 
 #if PA_LDP_USERS != 0
 	/* Generic pointers, initialized to NULL, for use by users. */
@@ -427,6 +1150,19 @@ struct pa_ldp {
 #endif
 };
 
+/* Whether the routine of a pair is scheduled. */
+#define pa_ldp_routine_pending(pa_ldp) \
+	((pa_ldp)->sched && (pa_ldp)->sched->routine_to.pending)
+
+/* Whether the backoff, adoption or apply timer of a pair is pending. */
+#define pa_ldp_backoff_pending(pa_ldp) \
+	((pa_ldp)->sched && (pa_ldp)->sched->backoff_to.pending)
+
+/* The Best Assignment found by the last routine, or NULL. Idle pairs have
+ * no scheduling state, hence no Best Assignment. */
+#define pa_ldp_best_assignment(pa_ldp) \
+	((pa_ldp)->sched?(pa_ldp)->sched->best_assignment:NULL)
+
 /* Assigned Prefix print format and arguments */
 #define PA_LDP_P "%s%%"PA_LINK_P" from "PA_DP_P" flags (%s %s %s)"
 #define PA_LDP_PA(pa_ldp) ((pa_ldp)->assigned)? \
@@ -457,6 +1193,11 @@ struct pa_advp {
 
 	/* Advertised Prefix associated Shared Link (or null). */
 	struct pa_link *link;
+
+#if PA_RECORD != 0
+	/* (private) Identifier in the record. */
+	uint32_t record_id;
+#endif
 };
 
 /* Advertised Prefix print format and arguments. */
@@ -528,6 +1269,22 @@ void pa_advp_update(struct pa_core *, struct pa_advp *);
  * User-friendly rules are defined in pa_rules.h.
  */
 
+#if PA_RULE_STATS != 0
+/**
+ * Rule profiling counters, counted since the rule was added or the last
+ * pa_rule_reset_stats call. Times are in microseconds.
+ */
+struct pa_rule_stats {
+	uint64_t filter_calls;
+	uint64_t filter_us;
+	uint64_t max_priority_calls;
+	uint64_t max_priority_us;
+	uint64_t match_calls;
+	uint64_t match_us;
+	uint64_t wins;  /* Routines in which the rule provided the target. */
+};
+#endif
+
 /* The rule target indicates the desired behavior of a rule on a given ldp. */
 enum pa_rule_target {
 	/* The rule does not match.
@@ -568,6 +1325,13 @@ struct pa_rule_arg {
 	 * will be advertised.
 	 */
 	pa_priority priority;
+
+	/* May be set by the match function when it returns PA_RULE_BACKOFF.
+	 * The prefix and plen are then stored in the ldp scheduling state as a
+	 * speculative candidate (See struct pa_ldp_sched), such that the search does not need to be
+	 * done again when the backoff timer fires.
+	 * Reset to 0 before calling the match function. */
+	uint8_t speculative;
 };
 
 /**
@@ -629,6 +1393,12 @@ struct pa_rule {
 	 /* PRIVATE - Used by pa_core. */
 	 pa_rule_priority _max_priority;
 	 struct list_head _le;
+#if PA_RECORD != 0
+	 uint32_t _record_id;
+#endif
+#if PA_RULE_STATS != 0
+	 struct pa_rule_stats _stats;
+#endif
 };
 
 /* pa_rule print format and argument */
@@ -645,6 +1415,23 @@ void pa_rule_add(struct pa_core *, struct pa_rule *);
  */
 void pa_rule_del(struct pa_core *, struct pa_rule *);
 
+#if PA_RULE_STATS != 0
+/**
+ * Copies the profiling counters of a rule.
+ *
+ * @param rule The rule.
+ * @param stats The structure the counters are copied into.
+ */
+void pa_rule_get_stats(struct pa_rule *rule, struct pa_rule_stats *stats);
+
+/**
+ * Sets all profiling counters of a rule to zero.
+ *
+ * @param rule The rule.
+ */
+void pa_rule_reset_stats(struct pa_rule *rule);
+#endif
+
 
 /***************************
  * Rules Utility Functions *
@@ -668,6 +1455,11 @@ void pa_rule_del(struct pa_core *, struct pa_rule *);
  *           If you don't understand why it is safer to set the safety, please
  *           set the safety. You'll be safer.
  * @return Whether the candidate assignment would be valid.
+ *
+ * When called from a rule during the routine execution, overlapping prefixes
+ * are summarized once per candidate (see PA_CONFLICT_CACHE_SIZE), such that
+ * successive checks of the same candidate do not walk the prefix tree again.
+ * It may also be called out of the routine, including for idle pairs.
  */
 int pa_rule_valid_assignment(struct pa_ldp *ldp, pa_prefix *prefix, pa_plen plen,
 		pa_rule_priority override_rule_priority, pa_priority override_priority,
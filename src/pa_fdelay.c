@@ -0,0 +1,128 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ */
+
+#include "pa_fdelay.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#ifndef container_of
+#define container_of(ptr, type, member) (           \
+    (type *)( (char *)ptr - offsetof(type,member) ))
+#endif
+
+static struct pa_fdelay_pending *pa_fdelay_pending_get(struct pa_fdelay *fdelay,
+		pa_prefix *prefix, pa_plen plen)
+{
+	uint16_t i;
+	for(i = 0; i < PA_FDELAY_PENDING; i++) {
+		if(fdelay->pending[i].used &&
+				!pa_prefix_cmp(&fdelay->pending[i].prefix, fdelay->pending[i].plen, prefix, plen))
+			return &fdelay->pending[i];
+	}
+	return NULL;
+}
+
+static void pa_fdelay_published_cb(struct pa_user *user, struct pa_ldp *ldp)
+{
+	struct pa_fdelay *fdelay = container_of(user, struct pa_fdelay, user);
+	struct pa_fdelay_pending *p = pa_fdelay_pending_get(fdelay, &ldp->prefix, ldp->plen);
+
+	if(!ldp->published) {
+		if(p)
+			p->used = 0;
+		return;
+	}
+
+	if(p) //Republished
+		return;
+
+	p = &fdelay->pending[fdelay->pending_next];
+	fdelay->pending_next = (fdelay->pending_next + 1) % PA_FDELAY_PENDING;
+	pa_prefix_cpy(&ldp->prefix, ldp->plen, &p->prefix, p->plen);
+	p->time_us = pa_clock_us();
+	p->used = 1;
+}
+
+uint32_t pa_fdelay_estimate(struct pa_fdelay *fdelay)
+{
+	uint32_t sorted[PA_FDELAY_SAMPLES], v;
+	uint16_t i, j, n = fdelay->samples_n;
+	uint64_t estimate;
+
+	if(!n || n < fdelay->min_samples)
+		return 0;
+
+	/* Insertion sort, as there are only a few samples. */
+	for(i = 0; i < n; i++) {
+		v = fdelay->samples[i];
+		for(j = i; j && sorted[j - 1] > v; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = v;
+	}
+
+	i = (n * fdelay->percentile + 99) / 100;
+	estimate = ((uint64_t)sorted[i?(i - 1):0]) * fdelay->factor / 100;
+	if(estimate < fdelay->min_delay)
+		estimate = fdelay->min_delay;
+	if(estimate > fdelay->max_delay)
+		estimate = fdelay->max_delay;
+	return (uint32_t)estimate;
+}
+
+void pa_fdelay_sample(struct pa_fdelay *fdelay, uint32_t latency)
+{
+	uint32_t estimate;
+	PA_DEBUG("Flooding latency sample %"PRIu32"ms", latency);
+	fdelay->samples[fdelay->samples_next] = latency;
+	fdelay->samples_next = (fdelay->samples_next + 1) % PA_FDELAY_SAMPLES;
+	if(fdelay->samples_n < PA_FDELAY_SAMPLES)
+		fdelay->samples_n++;
+
+	estimate = pa_fdelay_estimate(fdelay);
+	if(estimate && estimate != fdelay->core->flooding_delay)
+		pa_core_set_flooding_delay(fdelay->core, estimate);
+}
+
+void pa_fdelay_confirmed(struct pa_fdelay *fdelay, pa_prefix *prefix, pa_plen plen)
+{
+	struct pa_fdelay_pending *p = pa_fdelay_pending_get(fdelay, prefix, plen);
+	uint64_t now = pa_clock_us();
+	if(!p)
+		return;
+
+	p->used = 0;
+	pa_fdelay_sample(fdelay, (now > p->time_us)?(uint32_t)((now - p->time_us) / 1000):0);
+}
+
+void pa_fdelay_init(struct pa_fdelay *fdelay, struct pa_core *core)
+{
+	fdelay->core = core;
+	fdelay->percentile = 95;
+	fdelay->factor = 200;
+	fdelay->min_delay = 100;
+	fdelay->max_delay = PA_DEFAULT_FLOODING_DELAY;
+	fdelay->min_samples = 5;
+	fdelay->samples_n = 0;
+	fdelay->samples_next = 0;
+	fdelay->pending_next = 0;
+	memset(fdelay->pending, 0, sizeof(fdelay->pending));
+	fdelay->user.name = "fdelay";
+	fdelay->user.applied = NULL;
+	fdelay->user.assigned = NULL;
+	fdelay->user.published = pa_fdelay_published_cb;
+	fdelay->user.republished = NULL;
+	fdelay->user.quiescent = NULL;
+#if PA_USER_BATCH_SIZE != 0
+	fdelay->user.batch = NULL;
+#endif
+	pa_user_register(core, &fdelay->user);
+}
+
+void pa_fdelay_term(struct pa_fdelay *fdelay)
+{
+	pa_user_unregister(&fdelay->user);
+}
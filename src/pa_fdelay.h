@@ -0,0 +1,122 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ *
+ * Flooding delay estimation module for the prefix assignment algorithm.
+ *
+ * The flooding delay drives apply and adoption timers. Instead of using a
+ * static value, this module measures the time between the local publication
+ * of a prefix and the confirmation, by the flooding mechanism, that other
+ * nodes received it. An upper percentile of the measured latencies is fed
+ * back to the core using pa_core_set_flooding_delay.
+ *
+ */
+
+#ifndef PA_FDELAY_H_
+#define PA_FDELAY_H_
+
+#include "pa_core.h"
+
+/**
+ * Number of latency samples the estimation is computed from.
+ */
+#ifndef PA_FDELAY_SAMPLES
+#define PA_FDELAY_SAMPLES 32
+#endif
+
+/**
+ * Maximum number of published prefixes waiting for a confirmation.
+ * When full, the oldest publication is forgotten.
+ */
+#ifndef PA_FDELAY_PENDING
+#define PA_FDELAY_PENDING 16
+#endif
+
+/* A published prefix waiting for confirmation. */
+struct pa_fdelay_pending {
+	pa_prefix prefix;
+	pa_plen plen;
+	uint8_t used;
+	uint64_t time_us;
+};
+
+/**
+ * Flooding delay estimator structure.
+ */
+struct pa_fdelay {
+	/* The PA core the module is operating on. */
+	struct pa_core *core;
+
+	/* PA user used to receive publish notifications. */
+	struct pa_user user;
+
+	/* The percentile of measured latencies which is used (1 to 100). */
+	uint8_t percentile;
+
+	/* The flooding delay is set to the measured percentile multiplied by
+	 * this factor, in percents (e.g. 200 for twice the measured latency). */
+	uint16_t factor;
+
+	/* Bounds of the flooding delay, in milliseconds. */
+	uint32_t min_delay;
+	uint32_t max_delay;
+
+	/* Number of samples required before the flooding delay is changed. */
+	uint16_t min_samples;
+
+	/* PRIVATE to pa_fdelay */
+	uint32_t samples[PA_FDELAY_SAMPLES]; /* Latencies in milliseconds. */
+	uint16_t samples_n;                  /* Number of valid samples. */
+	uint16_t samples_next;               /* Next overwritten sample. */
+	struct pa_fdelay_pending pending[PA_FDELAY_PENDING];
+	uint16_t pending_next;               /* Next overwritten entry. */
+};
+
+/**
+ * Initializes the flooding delay estimator and registers it to the core.
+ *
+ * Parameters are set to default values (95th percentile, factor of 200,
+ * bounds from 100ms to the default flooding delay, 5 samples) and may be
+ * modified afterward.
+ *
+ * @param fdelay The estimator structure to be initialized.
+ * @param core The associated core structure.
+ */
+void pa_fdelay_init(struct pa_fdelay *fdelay, struct pa_core *core);
+
+/**
+ * Unregisters the estimator from the core.
+ *
+ * The current flooding delay is kept.
+ */
+void pa_fdelay_term(struct pa_fdelay *fdelay);
+
+/**
+ * Notifies that the flooding mechanism got confirmation that other nodes
+ * received a locally published prefix.
+ *
+ * The time since publication is used as a latency sample. Confirmations of
+ * unknown prefixes, or of prefixes which were already confirmed, are ignored.
+ *
+ * @param fdelay The estimator structure.
+ * @param prefix The confirmed prefix.
+ * @param plen The confirmed prefix length.
+ */
+void pa_fdelay_confirmed(struct pa_fdelay *fdelay, pa_prefix *prefix, pa_plen plen);
+
+/**
+ * Adds a latency sample measured by other means.
+ *
+ * @param fdelay The estimator structure.
+ * @param latency The measured latency in milliseconds.
+ */
+void pa_fdelay_sample(struct pa_fdelay *fdelay, uint32_t latency);
+
+/**
+ * Returns the current flooding delay estimation, in milliseconds, or 0 when
+ * there are not enough samples.
+ */
+uint32_t pa_fdelay_estimate(struct pa_fdelay *fdelay);
+
+#endif /* PA_FDELAY_H_ */
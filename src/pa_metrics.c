@@ -0,0 +1,451 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ */
+
+#include "pa_metrics.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define PA_METRICS_DEFAULT_PLEN 64
+
+#define pa_metrics_family(f, name, type, help) \
+	fprintf(f, "# HELP "PA_METRICS_PREFIX"%s %s\n# TYPE "PA_METRICS_PREFIX"%s %s\n", \
+			name, help, name, type)
+
+static void pa_metrics_gauge(FILE *f, const char *name, const char *help,
+		uint64_t value)
+{
+	pa_metrics_family(f, name, "gauge", help);
+	fprintf(f, PA_METRICS_PREFIX"%s %"PRIu64"\n", name, value);
+}
+
+#if PA_STATS != 0
+static const struct {
+	const char *name;
+	const char *help;
+	size_t offset;
+} pa_metrics_stats[] = {
+	{"routines_total", "Regular routines executed.",
+			offsetof(struct pa_core_stats, routines)},
+	{"backoff_routines_total", "Routines executed when backoff expired.",
+			offsetof(struct pa_core_stats, routines_backoff)},
+	{"rule_filter_calls_total", "Rule filter_accept calls.",
+			offsetof(struct pa_core_stats, rule_filter)},
+	{"rule_max_priority_calls_total", "Rule get_max_priority calls.",
+			offsetof(struct pa_core_stats, rule_max_priority)},
+	{"rule_match_calls_total", "Rule match calls.",
+			offsetof(struct pa_core_stats, rule_match)},
+	{"updown_walks_total", "Walks over overlapping prefixes.",
+			offsetof(struct pa_core_stats, updown_walks)},
+	{"updown_elements_total", "Prefixes visited during overlapping prefixes walks.",
+			offsetof(struct pa_core_stats, updown_elements)},
+	{"timers_total", "Core and pair timers armed.",
+			offsetof(struct pa_core_stats, timers)},
+	{"assign_total", "Prefixes assigned.",
+			offsetof(struct pa_core_stats, assign)},
+	{"publish_total", "Assigned Prefixes published.",
+			offsetof(struct pa_core_stats, publish)},
+	{"apply_total", "Assigned Prefixes applied.",
+			offsetof(struct pa_core_stats, apply)},
+	{"unassign_total", "Assigned Prefixes removed.",
+			offsetof(struct pa_core_stats, unassign)},
+	{"advp_add_total", "Advertised Prefixes added.",
+			offsetof(struct pa_core_stats, advp_add)},
+	{"advp_del_total", "Advertised Prefixes removed.",
+			offsetof(struct pa_core_stats, advp_del)},
+	{"advp_update_total", "Advertised Prefixes updated.",
+			offsetof(struct pa_core_stats, advp_update)},
+};
+
+static void pa_metrics_write_stats(struct pa_metrics *metrics, FILE *f)
+{
+	struct pa_core_stats stats;
+	size_t i;
+	pa_core_get_stats(metrics->core, &stats);
+	for(i = 0; i < sizeof(pa_metrics_stats)/sizeof(pa_metrics_stats[0]); i++) {
+		pa_metrics_family(f, pa_metrics_stats[i].name, "counter",
+				pa_metrics_stats[i].help);
+		fprintf(f, PA_METRICS_PREFIX"%s %"PRIu64"\n", pa_metrics_stats[i].name,
+				*(uint64_t *)((char *)&stats + pa_metrics_stats[i].offset));
+	}
+}
+#endif
+
+#if PA_RULE_STATS != 0 || PA_HISTOGRAMS != 0
+/* Writes a label value, escaped as required by the exposition format. */
+static void pa_metrics_label(FILE *f, const char *value)
+{
+	for(; value && *value; value++) {
+		switch(*value) {
+		case '\\':
+			fputs("\\\\", f);
+			break;
+		case '"':
+			fputs("\\\"", f);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		default:
+			fputc(*value, f);
+		}
+	}
+}
+#endif
+
+#if PA_RULE_STATS != 0
+
+static void pa_metrics_rule_sample(FILE *f, const char *name,
+		struct pa_rule *rule, const char *function, uint64_t value)
+{
+	fprintf(f, PA_METRICS_PREFIX"%s{rule=\"", name);
+	pa_metrics_label(f, rule->name);
+	if(function)
+		fprintf(f, "\",function=\"%s", function);
+	fprintf(f, "\"} %"PRIu64"\n", value);
+}
+
+static void pa_metrics_write_rules(struct pa_metrics *metrics, FILE *f)
+{
+	struct pa_rule_stats stats;
+	struct pa_rule *rule;
+
+	pa_metrics_family(f, "rule_calls_total", "counter",
+			"Rule function calls.");
+	list_for_each_entry(rule, &metrics->core->rules, le) {
+		pa_rule_get_stats(rule, &stats);
+		pa_metrics_rule_sample(f, "rule_calls_total", rule, "filter",
+				stats.filter_calls);
+		pa_metrics_rule_sample(f, "rule_calls_total", rule, "max_priority",
+				stats.max_priority_calls);
+		pa_metrics_rule_sample(f, "rule_calls_total", rule, "match",
+				stats.match_calls);
+	}
+
+	pa_metrics_family(f, "rule_microseconds_total", "counter",
+			"Time spent in rule functions.");
+	list_for_each_entry(rule, &metrics->core->rules, le) {
+		pa_rule_get_stats(rule, &stats);
+		pa_metrics_rule_sample(f, "rule_microseconds_total", rule, "filter",
+				stats.filter_us);
+		pa_metrics_rule_sample(f, "rule_microseconds_total", rule,
+				"max_priority", stats.max_priority_us);
+		pa_metrics_rule_sample(f, "rule_microseconds_total", rule, "match",
+				stats.match_us);
+	}
+
+	pa_metrics_family(f, "rule_wins_total", "counter",
+			"Routines in which the rule provided the target.");
+	list_for_each_entry(rule, &metrics->core->rules, le) {
+		pa_rule_get_stats(rule, &stats);
+		pa_metrics_rule_sample(f, "rule_wins_total", rule, NULL, stats.wins);
+	}
+}
+#endif
+
+#if PA_HISTOGRAMS != 0
+/* Writes the samples of a histogram. Bucket bounds are inclusive, as
+ * Prometheus 'le' bounds are. */
+static void pa_metrics_histogram(FILE *f, const char *name,
+		const char *label, const char *value, const struct pa_histogram *h)
+{
+	uint64_t count = 0;
+	int i;
+	for(i = 0; i < PA_HISTOGRAM_BUCKETS - 1; i++) {
+		count += h->buckets[i];
+		fprintf(f, PA_METRICS_PREFIX"%s_bucket{%s=\"", name, label);
+		pa_metrics_label(f, value);
+		fprintf(f, "\",le=\"%"PRIu64"\"} %"PRIu64"\n",
+				i?((((uint64_t)1) << i) - 1):0, count);
+	}
+	fprintf(f, PA_METRICS_PREFIX"%s_bucket{%s=\"", name, label);
+	pa_metrics_label(f, value);
+	fprintf(f, "\",le=\"+Inf\"} %"PRIu64"\n", h->count);
+	fprintf(f, PA_METRICS_PREFIX"%s_sum{%s=\"", name, label);
+	pa_metrics_label(f, value);
+	fprintf(f, "\"} %"PRIu64"\n", h->sum);
+	fprintf(f, PA_METRICS_PREFIX"%s_count{%s=\"", name, label);
+	pa_metrics_label(f, value);
+	fprintf(f, "\"} %"PRIu64"\n", h->count);
+}
+#endif
+
+#if PA_TIMELINE != 0
+static const char *pa_metrics_timeline[PA_TL_H_MAX] = {
+	[PA_TL_H_CREATED_ASSIGNED] = "created_assigned",
+	[PA_TL_H_BACKOFF_ASSIGNED] = "backoff_assigned",
+	[PA_TL_H_ASSIGNED_APPLIED] = "assigned_applied",
+	[PA_TL_H_CREATED_APPLIED] = "created_applied",
+};
+#endif
+
+#if PA_LATENCY != 0
+static const char *pa_metrics_latency[PA_LAT_MAX] = {
+	[PA_LAT_ROUTINE_LAG] = "routine_lag",
+	[PA_LAT_BACKOFF_LAG] = "backoff_lag",
+	[PA_LAT_ROUTINE] = "routine",
+	[PA_LAT_USER] = "user",
+};
+#endif
+
+static void pa_metrics_write_dps(struct pa_metrics *metrics, FILE *f)
+{
+	struct pa_core *core = metrics->core;
+	char dp_str[PA_PREFIX_STRLEN];
+	struct pa_dp *dp;
+	struct pa_ldp *ldp;
+	uint64_t space, n;
+	pa_plen plen;
+
+	pa_metrics_family(f, "dp_available_ratio", "gauge",
+			"Fraction of the Delegated Prefix which is available.");
+	pa_for_each_dp(core, dp) {
+		plen = (metrics->available_plen > dp->plen)?metrics->available_plen:dp->plen;
+		space = btrie_available_space(&core->prefixes,
+				(const btrie_key_t *)&dp->prefix, dp->plen, plen);
+		fprintf(f, PA_METRICS_PREFIX"dp_available_ratio{dp=\"%s\"} %.6g\n",
+				pa_prefix_tostring(dp_str, &dp->prefix, dp->plen),
+				(double)space / BTRIE_AVAILABLE_ALL);
+	}
+
+	pa_metrics_family(f, "dp_available_prefixes", "gauge",
+			"Available prefixes of the counted length in the Delegated Prefix.");
+	pa_for_each_dp(core, dp) {
+		if(metrics->available_plen < dp->plen ||
+				metrics->available_plen - dp->plen > 63)
+			continue;
+		n = btrie_available_prefixes_count(&core->prefixes,
+				(const btrie_key_t *)&dp->prefix, dp->plen,
+				metrics->available_plen);
+		fprintf(f, PA_METRICS_PREFIX"dp_available_prefixes{dp=\"%s\",plen=\"%d\"} %"PRIu64"\n",
+				pa_prefix_tostring(dp_str, &dp->prefix, dp->plen),
+				(int)metrics->available_plen, n);
+	}
+
+	pa_metrics_family(f, "dp_assigned_prefixes", "gauge",
+			"Prefixes assigned from the Delegated Prefix.");
+	pa_for_each_dp(core, dp) {
+		n = 0;
+		pa_for_each_ldp_in_dp(dp, ldp)
+			n += ldp->assigned;
+		fprintf(f, PA_METRICS_PREFIX"dp_assigned_prefixes{dp=\"%s\"} %"PRIu64"\n",
+				pa_prefix_tostring(dp_str, &dp->prefix, dp->plen), n);
+	}
+
+	pa_metrics_family(f, "dp_waiting_pairs", "gauge",
+			"Pairs waiting for space to be released in the Delegated Prefix.");
+	pa_for_each_dp(core, dp) {
+		n = 0;
+		pa_for_each_ldp_in_dp(dp, ldp)
+			n += ldp->waiting;
+		fprintf(f, PA_METRICS_PREFIX"dp_waiting_pairs{dp=\"%s\"} %"PRIu64"\n",
+				pa_prefix_tostring(dp_str, &dp->prefix, dp->plen), n);
+	}
+}
+
+int pa_metrics_write(struct pa_metrics *metrics, FILE *f)
+{
+	struct pa_core *core = metrics->core;
+	uint64_t links = 0, dps = 0, ldps = 0, assigned = 0, published = 0,
+			applied = 0;
+	struct pa_link *link;
+	struct pa_dp *dp;
+	struct pa_ldp *ldp;
+#if PA_HISTOGRAMS != 0
+	int i;
+#endif
+#if PA_LATENCY != 0
+	struct pa_user *user;
+	char user_str[12];
+#endif
+
+	pa_for_each_link(core, link)
+		links++;
+	pa_for_each_dp(core, dp) {
+		dps++;
+		pa_for_each_ldp_in_dp(dp, ldp) {
+			ldps++;
+			assigned += ldp->assigned;
+			published += ldp->published;
+			applied += ldp->applied;
+		}
+	}
+
+	pa_metrics_gauge(f, "links", "Links.", links);
+	pa_metrics_gauge(f, "dps", "Delegated Prefixes.", dps);
+	pa_metrics_gauge(f, "pairs", "Link/Delegated Prefix pairs.", ldps);
+	pa_metrics_gauge(f, "assigned_prefixes", "Assigned Prefixes.", assigned);
+	pa_metrics_gauge(f, "published_prefixes", "Published Assigned Prefixes.",
+			published);
+	pa_metrics_gauge(f, "applied_prefixes", "Applied Assigned Prefixes.",
+			applied);
+	pa_metrics_gauge(f, "pending_routines",
+			"Routines scheduled or deferred by the routine budget.",
+			pa_core_pending_routines(core));
+	pa_metrics_gauge(f, "flooding_delay_milliseconds", "Flooding delay.",
+			core->flooding_delay);
+	pa_metrics_write_dps(metrics, f);
+
+	if(metrics->store) {
+		pa_metrics_gauge(f, "store_cached_prefixes",
+				"Prefixes cached by the storage module.",
+				metrics->store->n_prefixes);
+		pa_metrics_gauge(f, "store_max_prefixes",
+				"Maximum number of prefixes cached by the storage module.",
+				metrics->store->max_prefixes);
+	}
+
+#if PA_STATS != 0
+	pa_metrics_write_stats(metrics, f);
+#endif
+
+#if PA_RULE_STATS != 0
+	pa_metrics_write_rules(metrics, f);
+#endif
+
+#if PA_TIMELINE != 0
+	pa_metrics_family(f, "convergence_milliseconds", "histogram",
+			"Pairs convergence latencies.");
+	for(i = 0; i < PA_TL_H_MAX; i++)
+		pa_metrics_histogram(f, "convergence_milliseconds", "interval",
+				pa_metrics_timeline[i], pa_core_timeline(core, i));
+#endif
+
+#if PA_LATENCY != 0
+	pa_metrics_family(f, "event_loop_microseconds", "histogram",
+			"Event loop latencies.");
+	for(i = 0; i < PA_LAT_MAX; i++)
+		pa_metrics_histogram(f, "event_loop_microseconds", "kind",
+				pa_metrics_latency[i], pa_core_latency(core, i));
+
+	//Unnamed users are identified by their position in the user list
+	pa_metrics_family(f, "user_callback_microseconds", "histogram",
+			"Execution time of the user callbacks.");
+	i = 0;
+	list_for_each_entry(user, &core->users, le) {
+		snprintf(user_str, sizeof(user_str), "%d", i++);
+		pa_metrics_histogram(f, "user_callback_microseconds", "user",
+				user->name?user->name:user_str, &user->latency);
+	}
+#endif
+
+	return (fflush(f) || ferror(f))?-1:0;
+}
+
+void pa_metrics_init(struct pa_metrics *metrics, struct pa_core *core,
+		struct pa_store *store)
+{
+	metrics->core = core;
+	metrics->store = store;
+	metrics->available_plen = PA_METRICS_DEFAULT_PLEN;
+	metrics->fd = -1;
+	metrics->sockpath = NULL;
+}
+
+void pa_metrics_term(struct pa_metrics *metrics)
+{
+	if(metrics->fd < 0)
+		return;
+
+	close(metrics->fd);
+	unlink(metrics->sockpath);
+	metrics->fd = -1;
+	metrics->sockpath = NULL;
+}
+
+int pa_metrics_save(struct pa_metrics *metrics, const char *path)
+{
+	size_t len = strlen(path);
+	char *tmp;
+	FILE *f;
+	int ret;
+
+	if(!(tmp = malloc(len + 5)))
+		return -1;
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, ".tmp", 5);
+
+	if(!(f = fopen(tmp, "w"))) {
+		PA_WARNING("Cannot open file %s (write mode) - %s", tmp, strerror(errno));
+		free(tmp);
+		return -1;
+	}
+
+	ret = pa_metrics_write(metrics, f);
+	if(fclose(f))
+		ret = -1;
+	if(!ret && rename(tmp, path))
+		ret = -1;
+	if(ret) {
+		PA_WARNING("Could not write metrics to %s - %s", path, strerror(errno));
+		unlink(tmp);
+	}
+	free(tmp);
+	return ret;
+}
+
+int pa_metrics_listen(struct pa_metrics *metrics, const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int fd;
+
+	if(metrics->fd >= 0 || strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		goto err;
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 4)) {
+		close(fd);
+		goto err;
+	}
+
+	metrics->fd = fd;
+	metrics->sockpath = path;
+	return fd;
+err:
+	PA_WARNING("Cannot listen on %s - %s", path, strerror(errno));
+	return -1;
+}
+
+int pa_metrics_serve(struct pa_metrics *metrics)
+{
+	char *buf;
+	size_t len;
+	ssize_t n;
+	FILE *f;
+	int fd, served = 0;
+
+	if(metrics->fd < 0)
+		return -1;
+
+	while((fd = accept4(metrics->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		//Rendered in memory, then sent without raising SIGPIPE on closed sockets
+		buf = NULL;
+		n = -1;
+		if((f = open_memstream(&buf, &len))) {
+			pa_metrics_write(metrics, f);
+			fclose(f);
+			n = send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		}
+		//Never wait for slow clients
+		if(n < 0 || (size_t)n != len)
+			PA_INFO("Dropping metrics client - %s",
+					(n < 0)?strerror(errno):"Socket buffer full");
+		else
+			served++;
+		free(buf);
+		close(fd);
+	}
+	return served;
+}
@@ -0,0 +1,115 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ *
+ * Metrics export module for the prefix assignment algorithm.
+ *
+ * The state of a core is rendered in the Prometheus text exposition format:
+ * Links, pairs and pending routines, the space still available in each
+ * Delegated Prefix, the pa_store cache occupancy, as well as the counters
+ * and histograms enabled with PA_STATS, PA_RULE_STATS, PA_TIMELINE and
+ * PA_LATENCY (including the callback execution time of each user).
+ *
+ * Metrics are either written into a file, which is atomically replaced, or
+ * served on request through a local UNIX socket. The listening socket is
+ * not registered into any event loop. The caller must call
+ * pa_metrics_serve when it becomes readable (e.g. from a uloop_fd handler).
+ */
+
+#ifndef PA_METRICS_H_
+#define PA_METRICS_H_
+
+#include <stdio.h>
+
+#include "pa_core.h"
+#include "pa_store.h"
+
+/* Prefix of all exported metric names. */
+#ifndef PA_METRICS_PREFIX
+#define PA_METRICS_PREFIX "pa_"
+#endif
+
+/**
+ * Metrics exporter structure.
+ */
+struct pa_metrics {
+	/* The PA core the module is operating on. */
+	struct pa_core *core;
+
+	/* The storage module whose cache is reported (NULL if none). */
+	struct pa_store *store;
+
+	/* Length of the prefixes counted as available in each Delegated
+	 * Prefix. */
+	pa_plen available_plen;
+
+	/* PRIVATE to pa_metrics */
+	int fd;                /* Listening socket, or -1. */
+	const char *sockpath;  /* Listening socket path. */
+};
+
+/**
+ * Initializes the metrics exporter.
+ *
+ * Available space is counted in /64 prefixes by default.
+ *
+ * @param metrics The exporter structure to be initialized.
+ * @param core The associated core structure.
+ * @param store The associated storage module, or NULL.
+ */
+void pa_metrics_init(struct pa_metrics *metrics, struct pa_core *core,
+		struct pa_store *store);
+
+/**
+ * Closes the listening socket, if any.
+ */
+void pa_metrics_term(struct pa_metrics *metrics);
+
+/**
+ * Writes all metrics into a stream.
+ *
+ * @param metrics The exporter structure.
+ * @param f The stream, which is not closed.
+ * @return 0 on success, -1 if the stream could not be written.
+ */
+int pa_metrics_write(struct pa_metrics *metrics, FILE *f);
+
+/**
+ * Writes all metrics into a file.
+ *
+ * Metrics are first written into a temporary file ('.tmp' is appended to
+ * the path) which is then renamed, such that readers never see a partially
+ * written file.
+ *
+ * @param metrics The exporter structure.
+ * @param path The file path.
+ * @return 0 on success, -1 otherwise.
+ */
+int pa_metrics_save(struct pa_metrics *metrics, const char *path);
+
+/**
+ * Listens for metrics requests on a local UNIX stream socket.
+ *
+ * Any existing file at the given path is removed first. The path must
+ * remain valid until pa_metrics_term is called.
+ *
+ * @param metrics The exporter structure.
+ * @param path The socket path.
+ * @return The non-blocking listening socket, or -1 on error.
+ */
+int pa_metrics_listen(struct pa_metrics *metrics, const char *path);
+
+/**
+ * Serves pending metrics requests.
+ *
+ * Must be called when the listening socket is readable. Each accepted
+ * connection receives all metrics and is closed. The call never blocks:
+ * Connections which cannot take all metrics at once are dropped.
+ *
+ * @param metrics The exporter structure.
+ * @return The number of served connections, or -1 if not listening.
+ */
+int pa_metrics_serve(struct pa_metrics *metrics);
+
+#endif /* PA_METRICS_H_ */
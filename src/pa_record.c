@@ -0,0 +1,922 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ *
+ */
+
+#include "pa_record.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pa_rules.h"
+
+#ifndef container_of
+#define container_of(ptr, type, member) (           \
+    (type *)( (char *)ptr - offsetof(type,member) ))
+#endif
+
+static const uint8_t pa_record_magic[4] = {'P', 'A', 'R', 'C'};
+
+#define PA_RECORD_NODE_ID_SIZE (PA_NODE_ID_LEN * sizeof(PA_NODE_ID_TYPE))
+
+/* Built-in rule types. */
+enum pa_record_rule_type {
+	PA_RECORD_RULE_OTHER,
+	PA_RECORD_RULE_ADOPT,
+	PA_RECORD_RULE_RANDOM,
+	PA_RECORD_RULE_STATIC,
+};
+
+/* Link created by the replayer. */
+struct pa_record_link {
+	struct pa_link link;
+	char name[];
+};
+
+/* Rule created or obtained by the replayer. */
+struct pa_record_rule {
+	struct pa_rule *rule;
+	union {
+		struct pa_rule_adopt adopt;
+		struct pa_rule_random random;
+		struct pa_rule_static stat;
+	} u;
+	char name[]; /* Followed by the pseudo-random seed. */
+};
+
+static int pa_replay_read(struct pa_record *rec, struct pa_record_event *e);
+
+/*
+ * Identifiers
+ */
+
+static uint32_t pa_record_id_get(struct pa_record *rec, enum pa_record_kind kind)
+{
+	if(rec->free_n[kind])
+		return rec->free_ids[kind][--rec->free_n[kind]];
+	return ++rec->ids_n[kind];
+}
+
+static void pa_record_id_put(struct pa_record *rec, enum pa_record_kind kind, uint32_t id)
+{
+	uint32_t *ids;
+	if(!(rec->free_n[kind] & 0x3f)) {
+		if(!(ids = realloc(rec->free_ids[kind], (rec->free_n[kind] + 64) * sizeof(uint32_t))))
+			return; //The identifier is not reused
+		rec->free_ids[kind] = ids;
+	}
+	rec->free_ids[kind][rec->free_n[kind]++] = id;
+}
+
+/*
+ * Writing
+ */
+
+static void pa_record_write(struct pa_record *rec, const void *buff, size_t len)
+{
+	if(len && fwrite(buff, len, 1, rec->file) != 1)
+		PA_WARNING("Could not write record");
+}
+
+static void pa_record_varint(struct pa_record *rec, uint64_t v)
+{
+	uint8_t buff[10];
+	size_t i = 0;
+	do {
+		buff[i] = v & 0x7f;
+		v >>= 7;
+		if(v)
+			buff[i] |= 0x80;
+		i++;
+	} while(v);
+	pa_record_write(rec, buff, i);
+}
+
+static void pa_record_prefix(struct pa_record *rec, pa_prefix *prefix, pa_plen plen)
+{
+	pa_record_varint(rec, plen);
+	pa_record_write(rec, prefix, (plen + 7) / 8);
+}
+
+static void pa_record_string(struct pa_record *rec, const char *s)
+{
+	size_t len = s?strlen(s):0;
+	pa_record_varint(rec, s?(len + 1):0);
+	pa_record_write(rec, s, len);
+}
+
+static void pa_record_header(struct pa_record *rec, enum pa_record_type type)
+{
+	uint8_t t = type;
+	uint64_t now = pa_clock_us() / 1000 - rec->start;
+	if(now < rec->last)
+		now = rec->last;
+	pa_record_write(rec, &t, 1);
+	pa_record_varint(rec, now - rec->last);
+	rec->last = now;
+	rec->events++;
+}
+
+static void pa_record_rule(struct pa_record *rec, struct pa_rule *rule)
+{
+	struct pa_rule_adopt *adopt;
+	struct pa_rule_random *random;
+	struct pa_rule_static *stat;
+	uint16_t seedlen;
+
+	pa_record_string(rec, rule->name);
+	if(rule->filter_accept) {
+		//Filters can't be recorded
+		pa_record_varint(rec, PA_RECORD_RULE_OTHER);
+	} else if(rule->match == pa_rule_adopt_match) {
+		adopt = container_of(rule, struct pa_rule_adopt, rule);
+		pa_record_varint(rec, PA_RECORD_RULE_ADOPT);
+		pa_record_varint(rec, adopt->rule_priority);
+		pa_record_varint(rec, adopt->priority);
+	} else if(rule->match == pa_rule_random_match) {
+		random = container_of(rule, struct pa_rule_random, rule);
+		pa_record_varint(rec, PA_RECORD_RULE_RANDOM);
+		pa_record_varint(rec, random->rule_priority);
+		pa_record_varint(rec, random->priority);
+		pa_record_varint(rec, random->desired_plen);
+		pa_record_varint(rec, random->random_set_size);
+		pa_record_varint(rec, random->pseudo_random_tentatives);
+		pa_record_varint(rec, random->speculative);
+		//The seed is only used with pseudo-random tentatives
+		seedlen = random->pseudo_random_tentatives?random->pseudo_random_seedlen:0;
+		pa_record_varint(rec, seedlen);
+		pa_record_write(rec, random->pseudo_random_seed, seedlen);
+	} else if(rule->match == pa_rule_static_match) {
+		stat = container_of(rule, struct pa_rule_static, rule);
+		pa_record_varint(rec, PA_RECORD_RULE_STATIC);
+		pa_record_prefix(rec, &stat->prefix, stat->plen);
+		pa_record_varint(rec, stat->rule_priority);
+		pa_record_varint(rec, stat->priority);
+		pa_record_varint(rec, stat->override_priority);
+		pa_record_varint(rec, stat->override_rule_priority);
+		pa_record_varint(rec, stat->safety);
+	} else {
+		pa_record_varint(rec, PA_RECORD_RULE_OTHER);
+	}
+}
+
+static void pa_record_advp(struct pa_record *rec, struct pa_advp *advp)
+{
+	pa_record_varint(rec, advp->record_id);
+	pa_record_prefix(rec, &advp->prefix, advp->plen);
+	pa_record_varint(rec, advp->priority);
+	pa_record_write(rec, advp->node_id, PA_RECORD_NODE_ID_SIZE);
+	pa_record_varint(rec, (advp->link && advp->link->record)?advp->link->record_id:0);
+}
+
+int pa_record_rand(struct pa_record *rec, int value)
+{
+	if(rec->replaying) {
+		if(rec->next.type != PA_RECORD_RAND) {
+			PA_WARNING("Replay diverged: unexpected random value");
+			rec->diverged++;
+			return value;
+		}
+		value = (int) rec->next.value;
+		rec->events++;
+		if(pa_replay_read(rec, &rec->next) < 0)
+			rec->next.type = PA_RECORD_NONE;
+		return value;
+	}
+	pa_record_header(rec, PA_RECORD_RAND);
+	pa_record_varint(rec, (uint32_t) value);
+	return value;
+}
+
+void pa_record_synced(struct pa_record *rec, pa_prefix *prefix,
+		pa_plen plen, uint32_t delay)
+{
+	if(rec->replaying)
+		return;
+	pa_record_header(rec, PA_RECORD_FLOODING_SYNCED);
+	pa_record_prefix(rec, prefix, plen);
+	pa_record_varint(rec, delay);
+}
+
+void pa_record_event(struct pa_record *rec, enum pa_record_type type,
+		void *object, uint32_t value)
+{
+	struct pa_core *core = rec->core;
+	struct pa_link *link = object;
+	struct pa_dp *dp = object;
+	struct pa_rule *rule = object;
+	struct pa_advp *advp = object;
+	struct pa_ldp *ldp = object;
+	int i;
+
+	if(rec->replaying)
+		return;
+
+	pa_record_header(rec, type);
+	switch (type) {
+	case PA_RECORD_NODE_ID:
+		pa_record_write(rec, core->node_id, PA_RECORD_NODE_ID_SIZE);
+		break;
+	case PA_RECORD_FLOODING_DELAY:
+	case PA_RECORD_LAZY_LDPS:
+		pa_record_varint(rec, value);
+		break;
+	case PA_RECORD_ROUTINE_BUDGET:
+		pa_record_varint(rec, core->routine_budget);
+		pa_record_varint(rec, core->routine_budget_us);
+		break;
+	case PA_RECORD_LINK_ADD:
+		link->record = rec;
+		link->record_id = pa_record_id_get(rec, PA_RECORD_K_LINK);
+		pa_record_varint(rec, link->record_id);
+#ifdef PA_LINK_TYPE
+		pa_record_varint(rec, link->type);
+#else
+		pa_record_varint(rec, 0);
+#endif
+		pa_record_string(rec, link->name);
+		break;
+	case PA_RECORD_LINK_DEL:
+		pa_record_varint(rec, link->record_id);
+		pa_record_id_put(rec, PA_RECORD_K_LINK, link->record_id);
+		link->record = NULL;
+		break;
+	case PA_RECORD_LINK_SUSPEND:
+		pa_record_varint(rec, link->record_id);
+		pa_record_varint(rec, value);
+		break;
+	case PA_RECORD_LINK_RESUME:
+	case PA_RECORD_SUSPEND_TO:
+		pa_record_varint(rec, link->record_id);
+		break;
+	case PA_RECORD_DP_ADD:
+		dp->record = rec;
+		dp->record_id = pa_record_id_get(rec, PA_RECORD_K_DP);
+		pa_record_varint(rec, dp->record_id);
+		pa_record_prefix(rec, &dp->prefix, dp->plen);
+#ifdef PA_DP_TYPE
+		pa_record_varint(rec, dp->type);
+#else
+		pa_record_varint(rec, 0);
+#endif
+		break;
+	case PA_RECORD_DP_DEL:
+		pa_record_varint(rec, dp->record_id);
+		pa_record_id_put(rec, PA_RECORD_K_DP, dp->record_id);
+		dp->record = NULL;
+		break;
+	case PA_RECORD_DP_UPDATE:
+		pa_record_varint(rec, dp->record_id);
+		pa_record_prefix(rec, &dp->prefix, dp->plen);
+		break;
+	case PA_RECORD_RULE_ADD:
+		rule->_record_id = pa_record_id_get(rec, PA_RECORD_K_RULE);
+		pa_record_varint(rec, rule->_record_id);
+		pa_record_rule(rec, rule);
+		break;
+	case PA_RECORD_RULE_DEL:
+		pa_record_varint(rec, rule->_record_id);
+		pa_record_id_put(rec, PA_RECORD_K_RULE, rule->_record_id);
+		break;
+	case PA_RECORD_ADVP_ADD:
+		advp->record_id = pa_record_id_get(rec, PA_RECORD_K_ADVP);
+		pa_record_advp(rec, advp);
+		break;
+	case PA_RECORD_ADVP_UPDATE:
+		pa_record_advp(rec, advp);
+		break;
+	case PA_RECORD_ADVP_DEL:
+		pa_record_varint(rec, advp->record_id);
+		pa_record_id_put(rec, PA_RECORD_K_ADVP, advp->record_id);
+		break;
+	case PA_RECORD_CORE_TERM:
+		for(i = 0; i < PA_RECORD_K_MAX; i++) {
+			rec->ids_n[i] = 0;
+			rec->free_n[i] = 0;
+		}
+		break;
+	case PA_RECORD_ROUTINE_TO:
+	case PA_RECORD_BACKOFF_TO:
+		pa_record_varint(rec, ldp->link->record_id);
+		pa_record_varint(rec, ldp->dp->record_id);
+		break;
+	default:
+		break;
+	}
+}
+
+static void pa_record_free(struct pa_record *rec)
+{
+	int i;
+	for(i = 0; i < PA_RECORD_K_MAX; i++) {
+		free(rec->free_ids[i]);
+		rec->free_ids[i] = NULL;
+		rec->free_n[i] = 0;
+		rec->ids_n[i] = 0;
+	}
+}
+
+int pa_record_start(struct pa_record *rec, struct pa_core *core, FILE *f)
+{
+	struct pa_pentry *pentry;
+	pa_prefix any;
+	uint8_t header[6];
+	int i;
+
+	memset(&any, 0, sizeof(any));
+	btrie_for_each_down_entry(pentry, &core->prefixes, (btrie_key_t *)&any, 0, be)
+		if(pentry->type == PAT_ADVERTISED)
+			return -1;
+
+	if(!list_empty(&core->links) || !list_empty(&core->dps) ||
+			!list_empty(&core->rules))
+		return -1;
+
+	memcpy(header, pa_record_magic, 4);
+	header[4] = PA_RECORD_VERSION;
+	header[5] = PA_RECORD_NODE_ID_SIZE;
+	if(fwrite(header, sizeof(header), 1, f) != 1)
+		return -1;
+
+	rec->core = core;
+	rec->file = f;
+	rec->events = 0;
+	rec->diverged = 0;
+	rec->replaying = 0;
+	rec->start = pa_clock_us() / 1000;
+	rec->last = 0;
+	for(i = 0; i < PA_RECORD_K_MAX; i++) {
+		rec->objects[i] = NULL;
+		rec->free_ids[i] = NULL;
+		rec->free_n[i] = 0;
+		rec->ids_n[i] = 0;
+	}
+	core->record = rec;
+
+	/* Initial configuration. */
+	pa_record_event(rec, PA_RECORD_NODE_ID, core, 0);
+	pa_record_event(rec, PA_RECORD_FLOODING_DELAY, core, core->flooding_delay);
+	pa_record_event(rec, PA_RECORD_LAZY_LDPS, core, core->lazy_ldps);
+	pa_record_event(rec, PA_RECORD_ROUTINE_BUDGET, core, 0);
+	for(i = 0; i < (int)core->config_depth; i++)
+		pa_record_event(rec, PA_RECORD_CONFIG_BEGIN, core, 0);
+	return 0;
+}
+
+/* Detaches Links and Delegated Prefixes from the record. */
+static void pa_record_detach(struct pa_record *rec)
+{
+	struct pa_link *link;
+	struct pa_dp *dp;
+	pa_for_each_link(rec->core, link)
+		link->record = NULL;
+	pa_for_each_dp(rec->core, dp)
+		dp->record = NULL;
+	rec->core->record = NULL;
+}
+
+void pa_record_stop(struct pa_record *rec)
+{
+	pa_record_detach(rec);
+	fflush(rec->file);
+	pa_record_free(rec);
+}
+
+/*
+ * Reading
+ */
+
+static int pa_replay_bytes(struct pa_record *rec, void *buff, size_t len)
+{
+	return (!len || fread(buff, len, 1, rec->file) == 1)?0:-1;
+}
+
+static int pa_replay_varint(struct pa_record *rec, uint32_t *v)
+{
+	uint64_t value = 0;
+	int shift = 0, c;
+	do {
+		if((c = fgetc(rec->file)) == EOF || shift > 35)
+			return -1;
+		value |= ((uint64_t)(c & 0x7f)) << shift;
+		shift += 7;
+	} while(c & 0x80);
+	*v = (uint32_t) value;
+	return 0;
+}
+
+static int pa_replay_prefix(struct pa_record *rec, pa_prefix *prefix, pa_plen *plen)
+{
+	uint32_t l;
+	if(pa_replay_varint(rec, &l) || l > sizeof(pa_prefix) * 8)
+		return -1;
+	memset(prefix, 0, sizeof(*prefix));
+	*plen = l;
+	return pa_replay_bytes(rec, prefix, (l + 7) / 8);
+}
+
+/* Reads a string into a newly allocated buffer of len + extra bytes.
+ * The string is placed at the given offset. */
+static void *pa_replay_string(struct pa_record *rec, size_t offset, size_t extra,
+		char **string)
+{
+	uint32_t len;
+	char *buff;
+	if(pa_replay_varint(rec, &len) || len > 65536 ||
+			!(buff = calloc(1, offset + len + 1 + extra)))
+		return NULL;
+
+	*string = len?(buff + offset):NULL;
+	if(len && pa_replay_bytes(rec, buff + offset, len - 1)) {
+		free(buff);
+		return NULL;
+	}
+	return buff;
+}
+
+static struct pa_record_rule *pa_replay_rule(struct pa_record *rec)
+{
+	struct pa_record_rule *r;
+	struct pa_rule *rule;
+	char *name;
+	uint32_t type, v[7];
+	pa_prefix prefix;
+	pa_plen plen;
+	int i;
+
+	if(!(r = pa_replay_string(rec, offsetof(struct pa_record_rule, name), 256, &name)) ||
+			pa_replay_varint(rec, &type))
+		goto err;
+
+	switch (type) {
+	case PA_RECORD_RULE_ADOPT:
+		if(pa_replay_varint(rec, &v[0]) || pa_replay_varint(rec, &v[1]))
+			goto err;
+		pa_rule_adopt_init(&r->u.adopt);
+		r->u.adopt.rule_priority = v[0];
+		r->u.adopt.priority = v[1];
+		r->rule = &r->u.adopt.rule;
+		break;
+	case PA_RECORD_RULE_RANDOM:
+		for(i = 0; i < 6; i++)
+			if(pa_replay_varint(rec, &v[i]))
+				goto err;
+		pa_rule_random_init(&r->u.random);
+		r->u.random.rule_priority = v[0];
+		r->u.random.priority = v[1];
+		r->u.random.desired_plen = v[2];
+		r->u.random.random_set_size = v[3];
+		r->u.random.pseudo_random_tentatives = v[4];
+		r->u.random.speculative = v[5];
+		if(pa_replay_varint(rec, &v[6]) || v[6] > 256)
+			goto err;
+		r->u.random.pseudo_random_seedlen = v[6];
+		r->u.random.pseudo_random_seed = (uint8_t *)r->name + (name?strlen(name):0) + 1;
+		if(pa_replay_bytes(rec, r->u.random.pseudo_random_seed, v[6]))
+			goto err;
+		r->rule = &r->u.random.rule;
+		break;
+	case PA_RECORD_RULE_STATIC:
+		if(pa_replay_prefix(rec, &prefix, &plen))
+			goto err;
+		for(i = 0; i < 5; i++)
+			if(pa_replay_varint(rec, &v[i]))
+				goto err;
+		pa_rule_static_init(&r->u.stat);
+		r->u.stat.prefix = prefix;
+		r->u.stat.plen = plen;
+		r->u.stat.rule_priority = v[0];
+		r->u.stat.priority = v[1];
+		r->u.stat.override_priority = v[2];
+		r->u.stat.override_rule_priority = v[3];
+		r->u.stat.safety = v[4];
+		r->rule = &r->u.stat.rule;
+		break;
+	case PA_RECORD_RULE_OTHER:
+		break;
+	default:
+		goto err;
+	}
+
+	if(r->rule)
+		r->rule->name = name;
+
+	if(rec->rule_get && (rule = rec->rule_get(rec, name)))
+		r->rule = rule;
+
+	return r;
+
+err:
+	free(r);
+	return NULL;
+}
+
+/* Reads the next event. Returns 1 on success, 0 at the end of the file and
+ * -1 when the file is corrupted. */
+static int pa_replay_read(struct pa_record *rec, struct pa_record_event *e)
+{
+	struct pa_record_link *l;
+	struct pa_dp *dp;
+	struct pa_advp *advp;
+	char *name;
+	uint32_t delta, type;
+	int c;
+
+	memset(e, 0, sizeof(*e));
+	if((c = fgetc(rec->file)) == EOF)
+		return 0;
+
+	if(c <= PA_RECORD_NONE || c >= PA_RECORD_TYPE_MAX ||
+			pa_replay_varint(rec, &delta))
+		return -1;
+
+	e->type = c;
+	rec->last += delta;
+	e->time = rec->last;
+	switch (e->type) {
+	case PA_RECORD_NODE_ID:
+		return pa_replay_bytes(rec, e->node_id, PA_RECORD_NODE_ID_SIZE)?-1:1;
+	case PA_RECORD_FLOODING_DELAY:
+	case PA_RECORD_LAZY_LDPS:
+	case PA_RECORD_RAND:
+		return pa_replay_varint(rec, &e->value)?-1:1;
+	case PA_RECORD_ROUTINE_BUDGET:
+		return (pa_replay_varint(rec, &e->value) ||
+				pa_replay_varint(rec, &e->value2))?-1:1;
+	case PA_RECORD_LINK_ADD:
+		if(pa_replay_varint(rec, &e->id) || pa_replay_varint(rec, &type) ||
+				!(l = pa_replay_string(rec, offsetof(struct pa_record_link, name), 0, &name)))
+			return -1;
+		pa_link_init(&l->link, name);
+#ifdef PA_LINK_TYPE
+		l->link.type = type;
+#endif
+		e->object = l;
+		return 1;
+	case PA_RECORD_LINK_SUSPEND:
+		return (pa_replay_varint(rec, &e->id) ||
+				pa_replay_varint(rec, &e->value))?-1:1;
+	case PA_RECORD_LINK_DEL:
+	case PA_RECORD_LINK_RESUME:
+	case PA_RECORD_SUSPEND_TO:
+	case PA_RECORD_DP_DEL:
+	case PA_RECORD_RULE_DEL:
+	case PA_RECORD_ADVP_DEL:
+		return pa_replay_varint(rec, &e->id)?-1:1;
+	case PA_RECORD_DP_ADD:
+		if(pa_replay_varint(rec, &e->id) ||
+				pa_replay_prefix(rec, &e->prefix, &e->plen) ||
+				pa_replay_varint(rec, &type) ||
+				!(dp = calloc(1, sizeof(*dp))))
+			return -1;
+		pa_dp_init(dp, &e->prefix, e->plen);
+#ifdef PA_DP_TYPE
+		dp->type = type;
+#endif
+		e->object = dp;
+		return 1;
+	case PA_RECORD_DP_UPDATE:
+		return (pa_replay_varint(rec, &e->id) ||
+				pa_replay_prefix(rec, &e->prefix, &e->plen))?-1:1;
+	case PA_RECORD_RULE_ADD:
+		if(pa_replay_varint(rec, &e->id) || !(e->object = pa_replay_rule(rec)))
+			return -1;
+		return 1;
+	case PA_RECORD_ADVP_ADD:
+	case PA_RECORD_ADVP_UPDATE:
+		if(pa_replay_varint(rec, &e->id) ||
+				pa_replay_prefix(rec, &e->prefix, &e->plen) ||
+				pa_replay_varint(rec, &e->value) ||
+				pa_replay_bytes(rec, e->node_id, PA_RECORD_NODE_ID_SIZE) ||
+				pa_replay_varint(rec, &e->id2))
+			return -1;
+		if(e->type == PA_RECORD_ADVP_ADD) {
+			if(!(advp = calloc(1, sizeof(*advp))))
+				return -1;
+			e->object = advp;
+		}
+		return 1;
+	case PA_RECORD_FLOODING_SYNCED:
+		return (pa_replay_prefix(rec, &e->prefix, &e->plen) ||
+				pa_replay_varint(rec, &e->value))?-1:1;
+	case PA_RECORD_ROUTINE_TO:
+	case PA_RECORD_BACKOFF_TO:
+		return (pa_replay_varint(rec, &e->id) ||
+				pa_replay_varint(rec, &e->id2))?-1:1;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Replaying
+ */
+
+static void *pa_replay_object(struct pa_record *rec, enum pa_record_kind kind, uint32_t id)
+{
+	if(!id || id > rec->ids_n[kind] || !rec->objects[kind][id - 1]) {
+		PA_WARNING("Replay diverged: unknown object %d:%"PRIu32, (int)kind, id);
+		rec->diverged++;
+		return NULL;
+	}
+	return rec->objects[kind][id - 1];
+}
+
+static int pa_replay_object_set(struct pa_record *rec, enum pa_record_kind kind,
+		uint32_t id, void *object)
+{
+	void **objects;
+	uint32_t n;
+	if(!id)
+		return -1;
+
+	if(id > rec->ids_n[kind]) {
+		for(n = rec->ids_n[kind]?rec->ids_n[kind]:16; n < id; n *= 2);
+		if(!(objects = realloc(rec->objects[kind], n * sizeof(void *))))
+			return -1;
+		memset(objects + rec->ids_n[kind], 0, (n - rec->ids_n[kind]) * sizeof(void *));
+		rec->objects[kind] = objects;
+		rec->ids_n[kind] = n;
+	}
+
+	if(object && rec->objects[kind][id - 1]) {
+		PA_WARNING("Replay diverged: object %d:%"PRIu32" already exists", (int)kind, id);
+		rec->diverged++;
+		return -1;
+	}
+
+	rec->objects[kind][id - 1] = object;
+	return 0;
+}
+
+/* Releases all replayed objects, once removed from the core. */
+static void pa_replay_objects_free(struct pa_record *rec)
+{
+	uint32_t i;
+	int kind;
+	for(kind = 0; kind < PA_RECORD_K_MAX; kind++) {
+		for(i = 0; i < rec->ids_n[kind]; i++)
+			if(rec->objects[kind][i])
+				free(rec->objects[kind][i]);
+		free(rec->objects[kind]);
+		rec->objects[kind] = NULL;
+		rec->ids_n[kind] = 0;
+	}
+}
+
+static struct pa_ldp *pa_replay_ldp(struct pa_record *rec, uint32_t link_id, uint32_t dp_id)
+{
+	struct pa_record_link *l = pa_replay_object(rec, PA_RECORD_K_LINK, link_id);
+	struct pa_dp *dp = pa_replay_object(rec, PA_RECORD_K_DP, dp_id);
+	struct pa_ldp *ldp;
+	if(!l || !dp)
+		return NULL;
+
+	pa_for_each_ldp_in_link(&l->link, ldp)
+		if(ldp->dp == dp)
+			return ldp;
+
+	return NULL;
+}
+
+/* Fires a timer the way the event loop would. */
+static void pa_replay_fire(struct pa_record *rec, struct uloop_timeout *to)
+{
+	if(!to || !to->pending) {
+		PA_WARNING("Replay diverged: timer is not pending");
+		rec->diverged++;
+		return;
+	}
+	uloop_timeout_cancel(to);
+	to->cb(to);
+}
+
+static void pa_replay_apply(struct pa_record *rec, struct pa_record_event *e)
+{
+	struct pa_core *core = rec->core;
+	struct pa_record_link *l;
+	struct pa_record_rule *r;
+	struct pa_dp *dp;
+	struct pa_advp *advp;
+	struct pa_ldp *ldp;
+
+	switch (e->type) {
+	case PA_RECORD_NODE_ID:
+		pa_core_set_node_id(core, e->node_id);
+		break;
+	case PA_RECORD_FLOODING_DELAY:
+		pa_core_set_flooding_delay(core, e->value);
+		break;
+	case PA_RECORD_LAZY_LDPS:
+		pa_core_set_lazy_ldps(core, e->value);
+		break;
+	case PA_RECORD_ROUTINE_BUDGET:
+		pa_core_set_routine_budget(core, e->value, e->value2);
+		break;
+	case PA_RECORD_CONFIG_BEGIN:
+		pa_core_config_begin(core);
+		break;
+	case PA_RECORD_CONFIG_COMMIT:
+		pa_core_config_commit(core);
+		break;
+	case PA_RECORD_LINK_ADD:
+		l = e->object;
+		e->object = NULL;
+		if(pa_replay_object_set(rec, PA_RECORD_K_LINK, e->id, l) ||
+				pa_link_add(core, &l->link)) {
+			pa_replay_object_set(rec, PA_RECORD_K_LINK, e->id, NULL);
+			free(l);
+		}
+		break;
+	case PA_RECORD_LINK_DEL:
+		if((l = pa_replay_object(rec, PA_RECORD_K_LINK, e->id))) {
+			pa_link_del(&l->link);
+			pa_replay_object_set(rec, PA_RECORD_K_LINK, e->id, NULL);
+			free(l);
+		}
+		break;
+	case PA_RECORD_LINK_SUSPEND:
+		if((l = pa_replay_object(rec, PA_RECORD_K_LINK, e->id)))
+			pa_link_suspend(&l->link, e->value);
+		break;
+	case PA_RECORD_LINK_RESUME:
+		if((l = pa_replay_object(rec, PA_RECORD_K_LINK, e->id)))
+			pa_link_resume(&l->link);
+		break;
+	case PA_RECORD_SUSPEND_TO:
+		if((l = pa_replay_object(rec, PA_RECORD_K_LINK, e->id)))
+			pa_replay_fire(rec, &l->link.suspend_to);
+		break;
+	case PA_RECORD_DP_ADD:
+		dp = e->object;
+		e->object = NULL;
+		if(pa_replay_object_set(rec, PA_RECORD_K_DP, e->id, dp) ||
+				pa_dp_add(core, dp)) {
+			pa_replay_object_set(rec, PA_RECORD_K_DP, e->id, NULL);
+			free(dp);
+		}
+		break;
+	case PA_RECORD_DP_DEL:
+		if((dp = pa_replay_object(rec, PA_RECORD_K_DP, e->id))) {
+			pa_dp_del(dp);
+			pa_replay_object_set(rec, PA_RECORD_K_DP, e->id, NULL);
+			free(dp);
+		}
+		break;
+	case PA_RECORD_DP_UPDATE:
+		if((dp = pa_replay_object(rec, PA_RECORD_K_DP, e->id))) {
+			pa_prefix_cpy(&e->prefix, e->plen, &dp->prefix, dp->plen);
+			pa_dp_update(core, dp);
+		}
+		break;
+	case PA_RECORD_RULE_ADD:
+		r = e->object;
+		e->object = NULL;
+		if(!r->rule) {
+			PA_WARNING("Replay diverged: rule '%s' can't be created", r->name);
+			rec->diverged++;
+		}
+		if(!r->rule || pa_replay_object_set(rec, PA_RECORD_K_RULE, e->id, r)) {
+			free(r);
+			break;
+		}
+		pa_rule_add(core, r->rule);
+		break;
+	case PA_RECORD_RULE_DEL:
+		if((r = pa_replay_object(rec, PA_RECORD_K_RULE, e->id))) {
+			pa_rule_del(core, r->rule);
+			pa_replay_object_set(rec, PA_RECORD_K_RULE, e->id, NULL);
+			free(r);
+		}
+		break;
+	case PA_RECORD_ADVP_ADD:
+	case PA_RECORD_ADVP_UPDATE:
+		if(e->type == PA_RECORD_ADVP_ADD) {
+			advp = e->object;
+			e->object = NULL;
+		} else if(!(advp = pa_replay_object(rec, PA_RECORD_K_ADVP, e->id))) {
+			break;
+		}
+		pa_prefix_cpy(&e->prefix, e->plen, &advp->prefix, advp->plen);
+		advp->priority = e->value;
+		memcpy(advp->node_id, e->node_id, PA_RECORD_NODE_ID_SIZE);
+		advp->link = NULL;
+		if(e->id2 && (l = pa_replay_object(rec, PA_RECORD_K_LINK, e->id2)))
+			advp->link = &l->link;
+		if(e->type == PA_RECORD_ADVP_UPDATE) {
+			pa_advp_update(core, advp);
+		} else if(pa_replay_object_set(rec, PA_RECORD_K_ADVP, e->id, advp) ||
+				pa_advp_add(core, advp)) {
+			pa_replay_object_set(rec, PA_RECORD_K_ADVP, e->id, NULL);
+			free(advp);
+		}
+		break;
+	case PA_RECORD_ADVP_DEL:
+		if((advp = pa_replay_object(rec, PA_RECORD_K_ADVP, e->id))) {
+			pa_advp_del(core, advp);
+			pa_replay_object_set(rec, PA_RECORD_K_ADVP, e->id, NULL);
+			free(advp);
+		}
+		break;
+	case PA_RECORD_FLOODING_SYNCED:
+		pa_core_flooding_synced(core, &e->prefix, e->plen, e->value);
+		break;
+	case PA_RECORD_CORE_TERM:
+		pa_core_term(core);
+		pa_replay_objects_free(rec);
+		break;
+	case PA_RECORD_ROUTINE_TO:
+		ldp = pa_replay_ldp(rec, e->id, e->id2);
+		pa_replay_fire(rec, (ldp && ldp->sched)?&ldp->sched->routine_to:NULL);
+		break;
+	case PA_RECORD_BACKOFF_TO:
+		ldp = pa_replay_ldp(rec, e->id, e->id2);
+		pa_replay_fire(rec, (ldp && ldp->sched)?&ldp->sched->backoff_to:NULL);
+		break;
+	case PA_RECORD_TICK_TO:
+		pa_replay_fire(rec, &core->tick_to);
+		break;
+	case PA_RECORD_QUIESCE_TO:
+		pa_replay_fire(rec, &core->quiesce_to);
+		break;
+	case PA_RECORD_BATCH_TO:
+#if PA_USER_BATCH_SIZE != 0
+		pa_replay_fire(rec, &core->batch_to);
+#endif
+		break;
+	case PA_RECORD_RAND:
+		PA_WARNING("Replay diverged: random value was not used");
+		rec->diverged++;
+		break;
+	default:
+		break;
+	}
+}
+
+int pa_replay_start(struct pa_record *rec, struct pa_core *core, FILE *f)
+{
+	uint8_t header[6];
+	int i;
+
+	if(fread(header, sizeof(header), 1, f) != 1 ||
+			memcmp(header, pa_record_magic, 4) ||
+			header[4] != PA_RECORD_VERSION ||
+			header[5] != PA_RECORD_NODE_ID_SIZE)
+		return -1;
+
+	rec->core = core;
+	rec->file = f;
+	rec->events = 0;
+	rec->diverged = 0;
+	rec->replaying = 1;
+	rec->start = 0;
+	rec->last = 0;
+	for(i = 0; i < PA_RECORD_K_MAX; i++) {
+		rec->objects[i] = NULL;
+		rec->free_ids[i] = NULL;
+		rec->free_n[i] = 0;
+		rec->ids_n[i] = 0;
+	}
+
+	if(pa_replay_read(rec, &rec->next) < 0)
+		return -1;
+
+	core->record = rec;
+	return 0;
+}
+
+int pa_replay_step(struct pa_record *rec)
+{
+	struct pa_record_event e = rec->next;
+	int ret;
+
+	if(e.type == PA_RECORD_NONE)
+		return 0;
+
+	/* Random values used while applying the event follow it. */
+	if((ret = pa_replay_read(rec, &rec->next)) <= 0)
+		rec->next.type = PA_RECORD_NONE;
+
+	rec->set_time(rec, e.time);
+	pa_replay_apply(rec, &e);
+	rec->events++;
+	if(e.object)
+		free(e.object);
+
+	return (ret < 0)?-1:1;
+}
+
+void pa_replay_stop(struct pa_record *rec)
+{
+	if(rec->next.object)
+		free(rec->next.object);
+	rec->next.type = PA_RECORD_NONE;
+	rec->next.object = NULL;
+	pa_core_term(rec->core);
+	rec->core->record = NULL;
+	pa_replay_objects_free(rec);
+	pa_record_free(rec);
+}
@@ -0,0 +1,178 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ *
+ * Recording and offline replay of prefix assignment inputs.
+ *
+ * When PA_RECORD is set, every external input of a recorded core is written
+ * into a compact binary log: Links, Delegated Prefixes, rules and Advertised
+ * Prefixes changes, configuration changes, timer firings and random values.
+ * The log can later be fed back to a fresh core with virtual time, at full
+ * speed, in order to reproduce a CPU spike under a profiler or valgrind
+ * without rebuilding the network.
+ *
+ * Limitations:
+ * - Built-in rules (adopt, random and static rules without filters) are
+ *   recreated by the replayer. Other rules are obtained through the rule_get
+ *   callback.
+ * - Routine budgets in microseconds depend on the actual execution time, and
+ *   hierarchical assignments are not recorded. Replays of such setups may
+ *   diverge.
+ */
+
+#ifndef PA_RECORD_H_
+#define PA_RECORD_H_
+
+#include <stdio.h>
+
+#include "pa_core.h"
+
+#if PA_RECORD == 0
+#error "pa_record requires PA_RECORD to be set"
+#endif
+
+/* Record file format version. */
+#define PA_RECORD_VERSION 1
+
+enum pa_record_type {
+	PA_RECORD_NONE = 0,
+	PA_RECORD_NODE_ID,
+	PA_RECORD_FLOODING_DELAY,
+	PA_RECORD_LAZY_LDPS,
+	PA_RECORD_ROUTINE_BUDGET,
+	PA_RECORD_CONFIG_BEGIN,
+	PA_RECORD_CONFIG_COMMIT,
+	PA_RECORD_LINK_ADD,
+	PA_RECORD_LINK_DEL,
+	PA_RECORD_LINK_SUSPEND,
+	PA_RECORD_LINK_RESUME,
+	PA_RECORD_DP_ADD,
+	PA_RECORD_DP_DEL,
+	PA_RECORD_DP_UPDATE,
+	PA_RECORD_RULE_ADD,
+	PA_RECORD_RULE_DEL,
+	PA_RECORD_ADVP_ADD,
+	PA_RECORD_ADVP_UPDATE,
+	PA_RECORD_ADVP_DEL,
+	PA_RECORD_FLOODING_SYNCED,
+	PA_RECORD_CORE_TERM,
+	PA_RECORD_ROUTINE_TO,
+	PA_RECORD_BACKOFF_TO,
+	PA_RECORD_SUSPEND_TO,
+	PA_RECORD_TICK_TO,
+	PA_RECORD_QUIESCE_TO,
+	PA_RECORD_BATCH_TO,
+	PA_RECORD_RAND,
+	PA_RECORD_TYPE_MAX,
+};
+
+/* Recorded object kinds, each having its own identifier space. */
+enum pa_record_kind {
+	PA_RECORD_K_LINK,
+	PA_RECORD_K_DP,
+	PA_RECORD_K_RULE,
+	PA_RECORD_K_ADVP,
+	PA_RECORD_K_MAX,
+};
+
+/* A decoded event. */
+struct pa_record_event {
+	enum pa_record_type type;
+	uint64_t time;  /* Milliseconds since the start of the record. */
+	uint32_t id;    /* Object identifier. */
+	uint32_t id2;   /* Second object identifier (Delegated Prefix of a pair,
+	                   Link of an Advertised Prefix). */
+	uint32_t value; /* Type specific value. */
+	uint32_t value2;
+	pa_prefix prefix;
+	pa_plen plen;
+	PA_NODE_ID_TYPE node_id[PA_NODE_ID_LEN];
+	void *object;   /* Object created by the replayer for *_ADD events. */
+};
+
+/**
+ * Recorder and replayer structure.
+ */
+struct pa_record {
+	/* The core being recorded or fed. */
+	struct pa_core *core;
+
+	/* The log file. */
+	FILE *file;
+
+	/* Replay only. Called before each event with the event time, in
+	 * milliseconds since the start of the record. Must set the current time
+	 * accordingly (Timers are fired by the replayer itself). */
+	void (*set_time)(struct pa_record *, uint64_t time);
+
+	/* Replay only (may be NULL). Returns the rule to be added for a recorded
+	 * rule, or NULL for the replayer to recreate the rule when it is a
+	 * built-in rule. */
+	struct pa_rule *(*rule_get)(struct pa_record *, const char *name);
+
+	/* Number of events written or replayed. */
+	uint64_t events;
+
+	/* Replay only. Number of events which could not be replayed the way they
+	 * were recorded. */
+	uint64_t diverged;
+
+	/* PRIVATE to pa_record */
+	uint8_t replaying;
+	uint64_t start;           /* Record start, in ms. */
+	uint64_t last;            /* Last event time, in ms since start. */
+	struct pa_record_event next; /* Replay lookahead. */
+	void **objects[PA_RECORD_K_MAX];    /* Replay objects, by identifier. */
+	uint32_t *free_ids[PA_RECORD_K_MAX]; /* Released identifiers. */
+	uint32_t free_n[PA_RECORD_K_MAX];
+	uint32_t ids_n[PA_RECORD_K_MAX];     /* Allocated identifiers. */
+};
+
+/**
+ * Starts recording the given core into a file.
+ *
+ * Recording must start before any Link, Delegated Prefix, rule or Advertised
+ * Prefix is added to the core. The file is not closed by pa_record.
+ *
+ * @return 0 on success, -1 if the core is not empty or the file could not be
+ *         written.
+ */
+int pa_record_start(struct pa_record *record, struct pa_core *core, FILE *f);
+
+/**
+ * Stops recording and flushes the file.
+ */
+void pa_record_stop(struct pa_record *record);
+
+/**
+ * Starts replaying a record into a freshly initialized core.
+ *
+ * The set_time and rule_get callbacks must be set beforehand.
+ * Once started, events are fed one by one with pa_replay_step.
+ *
+ * @return 0 on success, -1 if the file is not a valid record.
+ */
+int pa_replay_start(struct pa_record *record, struct pa_core *core, FILE *f);
+
+/**
+ * Replays the next recorded event.
+ *
+ * @return 1 when an event was replayed, 0 at the end of the record, or -1
+ *         if the record is corrupted.
+ */
+int pa_replay_step(struct pa_record *record);
+
+/**
+ * Stops replaying. The core is terminated with pa_core_term, and all objects
+ * created by the replayer are released.
+ */
+void pa_replay_stop(struct pa_record *record);
+
+/* Hooks called by pa_core. */
+void pa_record_event(struct pa_record *record, enum pa_record_type type,
+		void *object, uint32_t value);
+void pa_record_synced(struct pa_record *record, pa_prefix *prefix,
+		pa_plen plen, uint32_t delay);
+
+#endif /* PA_RECORD_H_ */
@@ -31,7 +31,7 @@ void pa_rule_prefix_count(struct pa_ldp *ldp, uint16_t *count, pa_plen max_plen)
 	for(plen = 0; plen <= max_plen; plen++)
 		count[plen] = 0;
 
-	btrie_for_each_available(&ldp->core->prefixes, n, (btrie_key_t *)&p, (btrie_plen_t *)&plen, (btrie_key_t *)&ldp->dp->prefix, ldp->dp->plen) {
+	btrie_for_each_available(&ldp->link->core->prefixes, n, (btrie_key_t *)&p, (btrie_plen_t *)&plen, (btrie_key_t *)&ldp->dp->prefix, ldp->dp->plen) {
 		if(count[plen] != UINT16_MAX)
 			count[plen]++;
 	}
@@ -74,7 +74,7 @@ int pa_rule_candidate_pick(struct pa_ldp *ldp, uint32_t n, pa_prefix *p, pa_plen
 	pa_prefix iter;
 	int pass = 0;
 	do{
-		btrie_for_each_available(&ldp->core->prefixes, node, (btrie_key_t *)&iter, (btrie_plen_t *)&i,
+		btrie_for_each_available(&ldp->link->core->prefixes, node, (btrie_key_t *)&iter, (btrie_plen_t *)&i,
 				(btrie_key_t *)&ldp->dp->prefix, ldp->dp->plen) {
 			if((pass && i == min_plen) || (!pass && i > min_plen && i <= max_plen)) {
 				if((plen - i >= 32) || (n < (((uint32_t)1) << (plen - i)))) {
@@ -119,7 +119,7 @@ void pa_rule_prefix_prandom(const uint8_t *seed, size_t seedlen, uint32_t ctr,
 
 pa_rule_priority pa_rule_adopt_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
-	if(!ldp->assigned || ldp->best_assignment || ldp->published) //No override
+	if(!ldp->assigned || pa_ldp_best_assignment(ldp) || ldp->published) //No override
 		return 0;
 	return container_of(rule, struct pa_rule_adopt, rule)->rule_priority;
 }
@@ -141,25 +141,27 @@ enum pa_rule_target pa_rule_adopt_match(struct pa_rule *rule, __unused struct pa
 pa_rule_priority pa_rule_random_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
 	struct pa_rule_random *rule_r = container_of(rule, struct pa_rule_random, rule);
-	if(ldp->best_assignment || ldp->published) //No override
+	if(pa_ldp_best_assignment(ldp) || ldp->published) //No override
 			return 0;
 
 	return rule_r->rule_priority;
 }
 
-enum pa_rule_target pa_rule_random_match(struct pa_rule *rule, struct pa_ldp *ldp,
-			__unused pa_rule_priority best_match_priority, struct pa_rule_arg *pa_arg)
+/* Returns whether the candidate computed when the backoff started can still be used. */
+static int pa_rule_random_candidate_valid(struct pa_rule_random *rule_r, struct pa_ldp *ldp)
 {
-	struct pa_rule_random *rule_r = container_of(rule, struct pa_rule_random, rule);
-	pa_prefix tentative;
-
-	pa_arg->priority = rule_r->priority;
-	pa_arg->rule_priority = rule_r->rule_priority;
-	//No need to check the best_match_priority because the rule uses a unique rule priority
-	if(!ldp->backoff)
-		return PA_RULE_BACKOFF; //Start or continue backoff timer.
+	return rule_r->speculative && !ldp->assigned && ldp->candidate &&
+			ldp->sched->candidate_plen == rule_r->desired_plen &&
+			ldp->sched->candidate_plen >= ldp->dp->plen &&
+			pa_prefix_contains(&ldp->dp->prefix, ldp->dp->plen, &ldp->sched->candidate_prefix) &&
+			!btrie_first_updown(&ldp->link->core->prefixes, (btrie_key_t *)&ldp->sched->candidate_prefix, ldp->sched->candidate_plen);
+}
 
-	uint16_t prefix_count[rule_r->desired_plen];
+static enum pa_rule_target pa_rule_random_search(struct pa_rule_random *rule_r,
+		struct pa_ldp *ldp, struct pa_rule_arg *pa_arg)
+{
+	pa_prefix tentative;
+	uint16_t prefix_count[rule_r->desired_plen + 1];
 	pa_rule_prefix_count(ldp, prefix_count, rule_r->desired_plen);
 
 	uint32_t found;
@@ -192,7 +194,7 @@ enum pa_rule_target pa_rule_random_match(struct pa_rule *rule, struct pa_ldp *ld
 		for(i=0; i<rule_r->pseudo_random_tentatives; i++) {
 			pa_rule_prefix_prandom(rule_r->pseudo_random_seed, rule_r->pseudo_random_seedlen, i, &ldp->dp->prefix, ldp->dp->plen, &tentative, rule_r->desired_plen);
 			PA_DEBUG("Trying pseudo-random %s", pa_prefix_repr(&tentative, rule_r->desired_plen));
-			btrie_for_each_available_loop_stop(&ldp->core->prefixes, n, n0, l0, (btrie_key_t *)&iter_p, &iter_plen, \
+			btrie_for_each_available_loop_stop(&ldp->link->core->prefixes, n, n0, l0, (btrie_key_t *)&iter_p, &iter_plen, \
 					(btrie_key_t *)&tentative, ldp->dp->plen, rule_r->desired_plen)
 			{
 				if(iter_plen > rule_r->desired_plen || //First available prefix is too small
@@ -210,7 +212,7 @@ enum pa_rule_target pa_rule_random_match(struct pa_rule *rule, struct pa_ldp *ld
 	}
 
 	/* Select a random prefix */
-	uint32_t id = pa_rand() % found;
+	uint32_t id = pa_core_rand(ldp->link->core) % found;
 	pa_rule_candidate_pick(ldp, id, &tentative, rule_r->desired_plen, min_plen, rule_r->desired_plen);
 
 choose:
@@ -218,6 +220,36 @@ choose:
 	return PA_RULE_PUBLISH;
 }
 
+enum pa_rule_target pa_rule_random_match(struct pa_rule *rule, struct pa_ldp *ldp,
+			__unused pa_rule_priority best_match_priority, struct pa_rule_arg *pa_arg)
+{
+	struct pa_rule_random *rule_r = container_of(rule, struct pa_rule_random, rule);
+
+	pa_arg->priority = rule_r->priority;
+	pa_arg->rule_priority = rule_r->rule_priority;
+	//No need to check the best_match_priority because the rule uses a unique rule priority
+
+	if(pa_rule_random_candidate_valid(rule_r, ldp)) {
+		//The candidate computed when the backoff started is still available.
+		pa_prefix_cpy(&ldp->sched->candidate_prefix, ldp->sched->candidate_plen,
+				&pa_arg->prefix, pa_arg->plen);
+		if(ldp->backoff)
+			return PA_RULE_PUBLISH;
+		pa_arg->speculative = 1;
+		return PA_RULE_BACKOFF;
+	}
+
+	if(!ldp->backoff) {
+		//Start or continue backoff timer.
+		//The search is done now, such that the backoff timeout is cheap.
+		if(rule_r->speculative && pa_rule_random_search(rule_r, ldp, pa_arg) == PA_RULE_PUBLISH)
+			pa_arg->speculative = 1;
+		return PA_RULE_BACKOFF;
+	}
+
+	return pa_rule_random_search(rule_r, ldp, pa_arg);
+}
+
 /**** Static rule ****/
 
 pa_rule_priority pa_rule_static_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
@@ -233,7 +265,7 @@ enum pa_rule_target pa_rule_static_match(struct pa_rule *rule, struct pa_ldp *ld
 			__unused pa_rule_priority best_match_priority, struct pa_rule_arg *pa_arg)
 {
 	struct pa_rule_static *srule = container_of(rule, struct pa_rule_static, rule);
-	if(!ldp->backoff && !ldp->best_assignment) //Do not return backoff when there is a best_assignment
+	if(!ldp->backoff && !pa_ldp_best_assignment(ldp)) //Do not return backoff when there is a best_assignment
 		return PA_RULE_BACKOFF;
 
 	pa_arg->rule_priority = srule->rule_priority;
@@ -82,14 +82,20 @@ struct pa_rule_random {
 	/* Seed and seed length used for the pseudo-random tentatives. */
 	uint8_t *pseudo_random_seed;
 	uint16_t pseudo_random_seedlen;
+
+	/* When set, the prefix is selected when the backoff timer is started
+	 * and only checked for availability when the timer fires. */
+	uint8_t speculative;
 };
 
 pa_rule_priority pa_rule_random_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp);
 enum pa_rule_target pa_rule_random_match(struct pa_rule *rule, struct pa_ldp *ldp,
 			pa_rule_priority, struct pa_rule_arg *);
 
-#define pa_rule_random_init(rule_random) pa_rule_init(&(rule_random)->rule,  \
-			pa_rule_random_get_max_priority, 0, pa_rule_random_match)
+#define pa_rule_random_init(rule_random) do { \
+			pa_rule_init(&(rule_random)->rule,  \
+				pa_rule_random_get_max_priority, 0, pa_rule_random_match); \
+			(rule_random)->speculative = 0; } while(0)
 
 
 /**
@@ -21,9 +21,12 @@ struct pa_store_prefix {
 	struct list_head in_link;
 	pa_prefix prefix;
 	pa_plen plen;
+	pa_prefix dp_prefix; /* Delegated Prefix the prefix was assigned from. */
+	pa_plen dp_plen;     /* 0 when unknown. */
 };
 
-static int pa_store_cache(struct pa_store *store, struct pa_store_link *link, pa_prefix *prefix, pa_plen plen);
+static int pa_store_cache(struct pa_store *store, struct pa_store_link *link,
+		pa_prefix *prefix, pa_plen plen, pa_prefix *dp_prefix, pa_plen dp_plen);
 
 static struct pa_store_link *pa_store_link_goc(struct pa_store *store, const char *name, int create)
 {
@@ -104,22 +107,26 @@ int pa_store_load(struct pa_store *store, const char *filepath)
 	int err = 0;
 	while ((read = getline(&line, &len, f)) != -1) {
 		linecnt++;
-		char *words[4];
-		pa_store_getwords(line, words, 4);
+		char *words[5];
+		pa_store_getwords(line, words, 5);
 
 		if(!words[0] || words[0][0] == '#')
 			continue;
 
 		if(!strcmp(words[0], PA_STORE_PREFIX)) {
-			pa_prefix px;
-			pa_plen plen;
+			pa_prefix px, dpx;
+			pa_plen plen, dplen = 0;
 			struct pa_store_link *l;
 			PAS_PE(!words[1] || !words[2], "Missing arguments");
-			PAS_PE(words[3] && words[3][0] != '#', "Too many arguments");
 			PAS_PE(!pa_prefix_fromstring(words[2], &px, &plen), "Invalid prefix");
+			if(words[3] && words[3][0] != '#') { //Optional delegated prefix
+				PAS_PE(words[4] && words[4][0] != '#', "Too many arguments");
+				PAS_PE(!pa_prefix_fromstring(words[3], &dpx, &dplen) || !dplen ||
+						plen < dplen || !pa_prefix_contains(&dpx, dplen, &px), "Invalid delegated prefix");
+			}
 			PAS_PE(strlen(words[1]) >= PA_STORE_NAMELEN, "Link name '%s' is too long", words[1]);
 			PAS_PE(!(l = pa_store_link_goc(store, words[1], 1)), "Internal error");
-			pa_store_cache(store, l, &px, plen);
+			pa_store_cache(store, l, &px, plen, &dpx, dplen);
 		} else if(!strcmp(words[0], PA_STORE_WTOKEN)) {
 			uint32_t token_count;
 			PAS_PE(!words[1] || sscanf(words[1], "%"SCNu32, &token_count) != 1, "Invalid token count");
@@ -153,7 +160,7 @@ int pa_store_save(struct pa_store *store)
 
 	struct pa_store_prefix *p;
 	struct pa_store_link *link;
-	char px[PA_PREFIX_STRLEN];
+	char px[PA_PREFIX_STRLEN], dpx[PA_PREFIX_STRLEN];
 	int err = 0;
 
 	if(fprintf(f, PA_STORE_WTOKEN" %"PRIu32"\n", store->token_count) < 0) {
@@ -166,9 +173,11 @@ int pa_store_save(struct pa_store *store)
 			continue;
 
 		if(!err) {
-			if(fprintf(f, PA_STORE_PREFIX" %s %s\n",
+			if(fprintf(f, PA_STORE_PREFIX" %s %s%s%s\n",
 					link->name,
-					pa_prefix_tostring(px, &p->prefix, p->plen)) < 0)
+					pa_prefix_tostring(px, &p->prefix, p->plen),
+					p->dp_plen?" ":"",
+					p->dp_plen?pa_prefix_tostring(dpx, &p->dp_prefix, p->dp_plen):"") < 0)
 				err = -2;
 		}
 		list_move(&p->in_link, &link->prefixes);
@@ -238,12 +247,15 @@ static void pa_store_uncache_last_from_store(struct pa_store *store)
 	pa_store_uncache(store, l, p);
 }
 
-static int pa_store_cache(struct pa_store *store, struct pa_store_link *link, pa_prefix *prefix, pa_plen plen)
+static int pa_store_cache(struct pa_store *store, struct pa_store_link *link,
+		pa_prefix *prefix, pa_plen plen, pa_prefix *dp_prefix, pa_plen dp_plen)
 {
 	PA_DEBUG("Caching %s %s", link->name, pa_prefix_repr(prefix, plen));
 	struct pa_store_prefix *p;
 	list_for_each_entry(p, &link->prefixes, in_link) {
 		if(pa_prefix_equals(prefix, plen, &p->prefix, p->plen)) {
+			if(dp_plen)
+				pa_prefix_cpy(dp_prefix, dp_plen, &p->dp_prefix, p->dp_plen);
 			//Put existing prefix at head
 			list_move(&p->in_store, &store->prefixes);
 			list_move(&p->in_link, &link->prefixes);
@@ -255,6 +267,9 @@ static int pa_store_cache(struct pa_store *store, struct pa_store_link *link, pa
 		return -1;
 	//Add the new prefix
 	pa_prefix_cpy(prefix, plen, &p->prefix, p->plen);
+	p->dp_plen = 0;
+	if(dp_plen)
+		pa_prefix_cpy(dp_prefix, dp_plen, &p->dp_prefix, p->dp_plen);
 	list_add(&p->in_link, &link->prefixes);
 	link->n_prefixes++;
 	list_add(&p->in_store, &store->prefixes);
@@ -272,16 +287,57 @@ static int pa_store_cache(struct pa_store *store, struct pa_store_link *link, pa
 	return 0;
 }
 
+/* Returns whether the prefix is included in one of the core's dps. */
+static int pa_store_dp_exists(struct pa_core *core, pa_prefix *prefix, pa_plen plen)
+{
+	struct pa_dp *dp;
+	pa_for_each_dp(core, dp) {
+		if(plen >= dp->plen && pa_prefix_contains(&dp->prefix, dp->plen, prefix))
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns whether a cached prefix comes from a former dp of the same length as the given one. */
+static int pa_store_renumberable(struct pa_core *core, struct pa_store_prefix *p, struct pa_dp *dp)
+{
+	return p->dp_plen && p->dp_plen == dp->plen && p->plen >= dp->plen &&
+			!pa_store_dp_exists(core, &p->prefix, p->plen);
+}
+
+/* Translates a cached prefix from its former dp into the given one. */
+static void pa_store_translate(struct pa_store_prefix *p, struct pa_dp *dp, pa_prefix *translated)
+{
+	bmemcpy(translated, &p->prefix, 0, p->plen);
+	bmemcpy(translated, &dp->prefix, 0, dp->plen);
+}
+
+enum pa_rule_target pa_store_renumber_match(struct pa_rule *rule, struct pa_ldp *ldp,
+		pa_rule_priority best_match_priority, struct pa_rule_arg *pa_arg);
+
 static void pa_store_applied_cb(struct pa_user *user, struct pa_ldp *ldp)
 {
 	struct pa_store *store = container_of(user, struct pa_store, user);
+	struct pa_store_prefix *p, *p2;
+	pa_prefix translated;
 	if(!ldp->applied)
 		return;
 
 	struct pa_store_link *link;
 	list_for_each_entry(link, &store->links, le) {
 		if(link->link == ldp->link) {
-			pa_store_cache(store, link, &ldp->prefix, ldp->plen);
+			//Renumbered prefixes replace the prefixes they were translated from
+			if(ldp->rule && ldp->rule->match == pa_store_renumber_match) {
+				list_for_each_entry_safe(p, p2, &link->prefixes, in_link) {
+					if(p->plen != ldp->plen || !pa_store_renumberable(store->core, p, ldp->dp))
+						continue;
+
+					pa_store_translate(p, ldp->dp, &translated);
+					if(pa_prefix_equals(&translated, p->plen, &ldp->prefix, ldp->plen))
+						pa_store_uncache(store, link, p);
+				}
+			}
+			pa_store_cache(store, link, &ldp->prefix, ldp->plen, &ldp->dp->prefix, ldp->dp->plen);
 			return;
 		}
 	}
@@ -404,9 +460,15 @@ void pa_store_init(struct pa_store *store, struct pa_core *core, uint32_t max_pr
 	store->max_prefixes = max_prefixes;
 	INIT_LIST_HEAD(&store->links);
 	INIT_LIST_HEAD(&store->prefixes);
+	store->user.name = "store";
 	store->user.applied = pa_store_applied_cb;
 	store->user.assigned = NULL;
 	store->user.published = NULL;
+	store->user.republished = NULL;
+	store->user.quiescent = NULL;
+#if PA_USER_BATCH_SIZE != 0
+	store->user.batch = NULL;
+#endif
 	store->filepath = NULL;
 	store->n_prefixes = 0;
 	store->pending_changes = 0;
@@ -421,7 +483,7 @@ void pa_store_init(struct pa_store *store, struct pa_core *core, uint32_t max_pr
 
 pa_rule_priority pa_store_get_max_priority(struct pa_rule *rule, struct pa_ldp *ldp)
 {
-	if(ldp->best_assignment || ldp->published) //No override
+	if(pa_ldp_best_assignment(ldp) || ldp->published) //No override
 		return 0;
 
 	struct pa_store_rule *rule_s = container_of(rule, struct pa_store_rule, rule);
@@ -479,3 +541,53 @@ void pa_store_rule_init(struct pa_store_rule *rule, struct pa_store *store)
 	rule->rule.get_max_priority = pa_store_get_max_priority;
 	rule->rule.match = pa_store_match;
 }
+
+enum pa_rule_target pa_store_renumber_match(struct pa_rule *rule, struct pa_ldp *ldp,
+		__attribute__ ((unused)) pa_rule_priority best_match_priority,
+		struct pa_rule_arg *pa_arg)
+{
+	struct pa_store_rule *rule_s = container_of(rule, struct pa_store_rule, rule);
+	struct pa_store *store = rule_s->store;
+
+	pa_arg->priority = rule_s->priority;
+	pa_arg->rule_priority = rule_s->rule_priority;
+	//No need to check the best_match_priority because the rule uses a unique rule priority
+
+	/* We checked that there is a candidate during get_max_priority call */
+	struct pa_store_link *l;
+	list_for_each_entry(l, &store->links, le) {
+		if(l->link == ldp->link) //Will happen
+			break;
+	}
+
+	//Only dps which were never used on the link are renumbered
+	struct pa_store_prefix *prefix;
+	list_for_each_entry(prefix, &l->prefixes, in_link) {
+		if(prefix->plen >= ldp->dp->plen &&
+				pa_prefix_contains(&ldp->dp->prefix, ldp->dp->plen, &prefix->prefix))
+			return PA_RULE_NO_MATCH;
+	}
+
+	//Translate a prefix from a former dp of the same length
+	pa_prefix translated;
+	list_for_each_entry(prefix, &l->prefixes, in_link) {
+		if(!pa_store_renumberable(ldp->link->core, prefix, ldp->dp))
+			continue;
+
+		pa_store_translate(prefix, ldp->dp, &translated);
+		if(pa_rule_valid_assignment(ldp, &translated, prefix->plen, 0, 0, 0)) {
+			PA_DEBUG("Renumbering %s", pa_prefix_repr(&prefix->prefix, prefix->plen));
+			pa_prefix_cpy(&translated, prefix->plen, &pa_arg->prefix, pa_arg->plen);
+			return PA_RULE_PUBLISH;
+		}
+	}
+	return PA_RULE_NO_MATCH;
+}
+
+void pa_store_renumber_rule_init(struct pa_store_rule *rule, struct pa_store *store)
+{
+	rule->store = store;
+	rule->rule.filter_accept = NULL;
+	rule->rule.get_max_priority = pa_store_get_max_priority;
+	rule->rule.match = pa_store_renumber_match;
+}
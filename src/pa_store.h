@@ -234,6 +234,24 @@ struct pa_store_rule {
  */
 void pa_store_rule_init(struct pa_store_rule *rule, struct pa_store *store);
 
+/**
+ * PA core renumbering rule.
+ *
+ * When no prefix is assigned on the given link and for the given delegated
+ * prefix, this rule translates prefixes which were applied to the same Link,
+ * from a Delegated Prefix which does not exist anymore, into the new
+ * Delegated Prefix. The offset within the old Delegated Prefix is kept.
+ *
+ * Only cached prefixes whose Delegated Prefix is known and of the same length
+ * as the new one are translated, and only into Delegated Prefixes which were
+ * never used on the Link. Once applied, the translated prefix replaces the
+ * prefix it was translated from in the cache.
+ *
+ * The translated prefix is published right away, without backoff, provided
+ * that it is a valid assignment.
+ */
+void pa_store_renumber_rule_init(struct pa_store_rule *rule, struct pa_store *store);
+
 
 
 
@@ -0,0 +1,125 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ */
+
+#include "pa_trace.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t pa_trace_magic[4] = {'P', 'A', 'T', 'R'};
+
+static const char *pa_trace_types[PA_TRACE_TYPE_MAX] = {
+	[PA_TRACE_NONE] = "none",
+	[PA_TRACE_LDP_CREATE] = "create",
+	[PA_TRACE_LDP_DESTROY] = "destroy",
+	[PA_TRACE_ROUTINE] = "routine",
+	[PA_TRACE_RULE] = "rule",
+	[PA_TRACE_BACKOFF] = "backoff",
+	[PA_TRACE_WAIT] = "wait",
+	[PA_TRACE_ASSIGN] = "assign",
+	[PA_TRACE_PUBLISH] = "publish",
+	[PA_TRACE_ADOPT] = "adopt",
+	[PA_TRACE_APPLY] = "apply",
+	[PA_TRACE_ADVP_ADD] = "advp-add",
+	[PA_TRACE_ADVP_DEL] = "advp-del",
+	[PA_TRACE_ADVP_UPDATE] = "advp-update",
+};
+
+static const char *pa_trace_targets[] = {
+	[PA_RULE_NO_MATCH] = "no-match",
+	[PA_RULE_ADOPT] = "adopt",
+	[PA_RULE_BACKOFF] = "backoff",
+	[PA_RULE_PUBLISH] = "publish",
+	[PA_RULE_DESTROY] = "destroy",
+};
+
+size_t pa_trace_get(struct pa_core *core, struct pa_trace_event *events,
+		size_t max)
+{
+	uint32_t n = (core->trace_n > PA_TRACE)?PA_TRACE:core->trace_n;
+	uint32_t i;
+	if(n > max)
+		n = max;
+
+	for(i = 0; i < n; i++)
+		events[i] = core->trace[(core->trace_n - n + i) & (PA_TRACE - 1)];
+	return n;
+}
+
+int pa_trace_write(struct pa_core *core, FILE *f, size_t max)
+{
+	uint32_t n = (core->trace_n > PA_TRACE)?PA_TRACE:core->trace_n;
+	uint16_t size = sizeof(struct pa_trace_event);
+	uint8_t header[7];
+	uint32_t i;
+	if(max && n > max)
+		n = max;
+
+	memcpy(header, pa_trace_magic, 4);
+	header[4] = PA_TRACE_VERSION;
+	header[5] = size & 0xff;
+	header[6] = size >> 8;
+	if(fwrite(header, sizeof(header), 1, f) != 1)
+		return -1;
+
+	for(i = 0; i < n; i++) {
+		if(fwrite(&core->trace[(core->trace_n - n + i) & (PA_TRACE - 1)],
+				sizeof(struct pa_trace_event), 1, f) != 1)
+			return -1;
+	}
+	return fflush(f)?-1:0;
+}
+
+int pa_trace_read_header(FILE *f)
+{
+	uint16_t size = sizeof(struct pa_trace_event);
+	uint8_t header[7];
+	if(fread(header, sizeof(header), 1, f) != 1 ||
+			memcmp(header, pa_trace_magic, 4) ||
+			header[4] != PA_TRACE_VERSION ||
+			header[5] != (size & 0xff) || header[6] != (size >> 8))
+		return -1;
+	return 0;
+}
+
+int pa_trace_read(FILE *f, struct pa_trace_event *event)
+{
+	size_t len = fread(event, 1, sizeof(*event), f);
+	if(!len)
+		return 0;
+	return (len == sizeof(*event))?1:-1;
+}
+
+const char *pa_trace_type_str(uint8_t type)
+{
+	return (type < PA_TRACE_TYPE_MAX)?pa_trace_types[type]:"unknown";
+}
+
+void pa_trace_print(FILE *out, const struct pa_trace_event *e)
+{
+	const char *type = pa_trace_type_str(e->type);
+	if(!e->value) {
+		if(e->type == PA_TRACE_ASSIGN)
+			type = "unassign";
+		else if(e->type == PA_TRACE_PUBLISH)
+			type = "unpublish";
+		else if(e->type == PA_TRACE_APPLY)
+			type = "unapply";
+	}
+
+	fprintf(out, "%"PRIu64".%06"PRIu64" %-11s %p %s", e->time / 1000000,
+			e->time % 1000000, type, e->object,
+			pa_prefix_repr(&e->prefix, e->plen));
+	if(e->type == PA_TRACE_RULE)
+		fprintf(out, " %s rule='%.*s'", (e->value <= PA_RULE_DESTROY)?
+				pa_trace_targets[e->value]:"unknown",
+				PA_TRACE_RULE_NAME_LEN, e->rule[0]?e->rule:"no-name");
+	else if(e->type == PA_TRACE_ROUTINE && e->value)
+		fprintf(out, " backoff");
+	fprintf(out, " priority="PA_PRIO_P" rule_priority="PA_RULE_PRIO_P"\n",
+			e->priority, e->rule_priority);
+}
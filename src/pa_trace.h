@@ -0,0 +1,75 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ *
+ * Binary trace of prefix assignment events.
+ *
+ * When PA_TRACE is set, each core writes fixed-size records into a ring
+ * buffer holding its last PA_TRACE events. Nothing is formatted when events
+ * occur. The buffer can be copied, or dumped into a file which is decoded
+ * later by a program built with the same configuration.
+ */
+
+#ifndef PA_TRACE_H_
+#define PA_TRACE_H_
+
+#include <stdio.h>
+
+#include "pa_core.h"
+
+#if PA_TRACE == 0
+#error "pa_trace requires PA_TRACE to be set"
+#endif
+
+/* Trace file format version. */
+#define PA_TRACE_VERSION 3
+
+/**
+ * Copies the last traced events of a core, oldest first.
+ *
+ * @param core The PA core structure.
+ * @param events The array events are copied into.
+ * @param max The size of the array.
+ * @return The number of copied events.
+ */
+size_t pa_trace_get(struct pa_core *core, struct pa_trace_event *events,
+		size_t max);
+
+/**
+ * Writes the last traced events of a core into a file, oldest first.
+ *
+ * @param core The PA core structure.
+ * @param f The file, which is not closed.
+ * @param max Maximum number of written events (0 for all kept events).
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int pa_trace_write(struct pa_core *core, FILE *f, size_t max);
+
+/**
+ * Reads the header of a trace file.
+ *
+ * @return 0 on success, -1 if the file is not a trace written with the same
+ *         configuration.
+ */
+int pa_trace_read_header(FILE *f);
+
+/**
+ * Reads the next event of a trace file.
+ *
+ * @return 1 when an event was read, 0 at the end of the file, or -1 if the
+ *         file is truncated.
+ */
+int pa_trace_read(FILE *f, struct pa_trace_event *event);
+
+/**
+ * Returns the name of a traced event type.
+ */
+const char *pa_trace_type_str(uint8_t type);
+
+/**
+ * Prints an event in a human readable form, on a single line.
+ */
+void pa_trace_print(FILE *out, const struct pa_trace_event *event);
+
+#endif /* PA_TRACE_H_ */
@@ -0,0 +1,390 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ *
+ * Prefix assignment core scale benchmark.
+ *
+ * Builds a single core with a given number of Links, Delegated Prefixes,
+ * rules and remote Advertised Prefixes, and runs it on fake_uloop virtual
+ * time. Reports the cost of the initial convergence, the steady-state cost of
+ * adding and removing a single Advertised Prefix, and memory usage per
+ * Link/Delegated Prefix pair.
+ *
+ * Usage: bench_pa_core [links] [dps] [rules] [advps] [iterations]
+ * Defaults are 1000 links, 10 dps, 2 rules, 10000 advps and 20 iterations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fake_uloop.h"
+
+/* Count allocations done by the core. */
+struct bench_alloc {
+	uint64_t count;
+	uint64_t live;
+	uint64_t live_max;
+} bench_alloc;
+
+#define BENCH_HDR 16
+
+static void *bench_malloc(size_t size)
+{
+	char *p;
+	if(!(p = malloc(size + BENCH_HDR)))
+		return NULL;
+	*((size_t *)p) = size;
+	bench_alloc.count++;
+	bench_alloc.live += size;
+	if(bench_alloc.live > bench_alloc.live_max)
+		bench_alloc.live_max = bench_alloc.live;
+	return p + BENCH_HDR;
+}
+
+static void *bench_calloc(size_t nmemb, size_t size)
+{
+	void *p;
+	if((p = bench_malloc(nmemb * size)))
+		memset(p, 0, nmemb * size);
+	return p;
+}
+
+static void bench_free(void *ptr)
+{
+	char *p = ptr;
+	if(!p)
+		return;
+	p -= BENCH_HDR;
+	bench_alloc.live -= *((size_t *)p);
+	free(p);
+}
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define free bench_free
+
+#include "pa_core.c"
+
+#undef malloc
+#undef calloc
+#undef free
+
+#include "pa_rules.h"
+
+/* Accounting for each kind of timer. */
+enum bench_timer {
+	BENCH_ROUTINE,
+	BENCH_BACKOFF,
+	BENCH_ADOPT,
+	BENCH_APPLY,
+	BENCH_DEFERRED,
+	BENCH_OTHER,
+	BENCH_TIMER_MAX,
+};
+
+static const char *bench_timer_names[BENCH_TIMER_MAX] = {
+	[BENCH_ROUTINE] = "routine",
+	[BENCH_BACKOFF] = "backoff routine",
+	[BENCH_ADOPT] = "adopt",
+	[BENCH_APPLY] = "apply",
+	[BENCH_DEFERRED] = "deferred",
+	[BENCH_OTHER] = "other",
+};
+
+struct bench_stats {
+	uint64_t count[BENCH_TIMER_MAX];
+	uint64_t us[BENCH_TIMER_MAX];
+	uint64_t allocs;
+	uint64_t us_total;
+};
+
+static uint64_t bench_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t bench_rss(void)
+{
+	unsigned long size, resident;
+	FILE *f;
+	if(!(f = fopen("/proc/self/statm", "r")))
+		return 0;
+	if(fscanf(f, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return ((uint64_t)resident) * sysconf(_SC_PAGESIZE);
+}
+
+static enum bench_timer bench_timer_kind(struct uloop_timeout *to)
+{
+	struct pa_ldp *ldp;
+	if(to->cb == pa_routine_to)
+		return BENCH_ROUTINE;
+	if(to->cb == pa_backoff_to) {
+		ldp = container_of(to, struct pa_ldp_sched, backoff_to)->ldp;
+		if(ldp->adopting)
+			return BENCH_ADOPT;
+		if(ldp->assigned)
+			return BENCH_APPLY;
+		return BENCH_BACKOFF;
+	}
+	return BENCH_OTHER;
+}
+
+/* Runs all timers, including ones scheduled while running. */
+static void bench_run(struct pa_core *core, struct bench_stats *stats)
+{
+	uint32_t ticks;
+	struct uloop_timeout *to;
+	enum bench_timer kind;
+	uint64_t start = bench_us(), t0, t1, allocs = bench_alloc.count;
+
+	memset(stats, 0, sizeof(*stats));
+	while((to = fu_next())) {
+		kind = bench_timer_kind(to);
+		ticks = core->tick_routines;
+		set_time(_to_time(&to->time));
+		t0 = bench_us();
+		fu_run_one(to);
+		t1 = bench_us();
+		/* Routines which are executed always increment tick_routines when
+		 * a routine budget is set. */
+		if((kind == BENCH_ROUTINE || kind == BENCH_BACKOFF) &&
+				(core->routine_budget || core->routine_budget_us) &&
+				core->tick_routines == ticks)
+			kind = BENCH_DEFERRED;
+		stats->count[kind]++;
+		stats->us[kind] += t1 - t0;
+	}
+	stats->us_total = bench_us() - start;
+	stats->allocs = bench_alloc.count - allocs;
+}
+
+static void bench_stats_add(struct bench_stats *dst, struct bench_stats *src)
+{
+	int i;
+	for(i = 0; i < BENCH_TIMER_MAX; i++) {
+		dst->count[i] += src->count[i];
+		dst->us[i] += src->us[i];
+	}
+	dst->allocs += src->allocs;
+	dst->us_total += src->us_total;
+}
+
+static void bench_stats_print(const char *name, struct bench_stats *stats, uint32_t n)
+{
+	int i;
+	printf("%s (x%"PRIu32")\n", name, n);
+	printf("  wall time        %12.1f us\n", (double)stats->us_total / n);
+	printf("  allocations      %12.1f\n", (double)stats->allocs / n);
+	for(i = 0; i < BENCH_TIMER_MAX; i++) {
+		if(!stats->count[i])
+			continue;
+		printf("  %-16s %12.1f runs %12.1f us\n", bench_timer_names[i],
+				(double)stats->count[i] / n, (double)stats->us[i] / n);
+	}
+}
+
+/* Sets the prefix of the given Delegated Prefix index (fd00::/8 based). */
+static void bench_dp_prefix(pa_prefix *p, uint32_t dp)
+{
+	memset(p, 0, sizeof(*p));
+	p->s6_addr[0] = 0xfd;
+	p->s6_addr[1] = (uint8_t)(dp >> 8);
+	p->s6_addr[2] = (uint8_t)dp;
+}
+
+/* Sets the /64 at a given position within a Delegated Prefix. */
+static void bench_slot_prefix(pa_prefix *p, uint32_t dp, pa_plen dp_plen, uint32_t slot)
+{
+	uint8_t bits[4];
+	pa_plen host = 64 - dp_plen;
+	slot = (slot << (32 - host)); //Left aligned
+	bits[0] = slot >> 24;
+	bits[1] = slot >> 16;
+	bits[2] = slot >> 8;
+	bits[3] = slot;
+	bench_dp_prefix(p, dp);
+	bmemcpy(p, bits, dp_plen, host);
+}
+
+static uint32_t links_n = 1000, dps_n = 10, rules_n = 2, advps_n = 10000, iter = 20;
+
+void pa_core_bench()
+{
+	uint32_t i, host, ldps_n = 0, assigned_n = 0;
+	pa_plen dp_plen;
+	struct pa_core core;
+	struct pa_link *links;
+	struct pa_dp *dps;
+	struct pa_rule_random *rules;
+	struct pa_rule_adopt arule;
+	struct pa_advp *advps, extra;
+	struct pa_ldp *ldp;
+	struct bench_stats stats, add, del;
+	uint64_t rss0, rss1, live0, allocs0, t0, setup_us;
+
+	/* Size Delegated Prefixes so that a fourth of the space is used. */
+	for(host = 1; host < 32 && (1u << host) < 4 * (links_n + advps_n / (dps_n?dps_n:1) + iter); host++);
+	dp_plen = 64 - host;
+	sput_fail_if(!dps_n || dps_n > 0xffff || dp_plen < 24 || !rules_n, "Valid parameters");
+	if(!dps_n || dps_n > 0xffff || dp_plen < 24 || !rules_n)
+		return;
+
+	links = calloc(links_n, sizeof(*links));
+	dps = calloc(dps_n, sizeof(*dps));
+	rules = calloc(rules_n, sizeof(*rules));
+	advps = calloc(advps_n, sizeof(*advps));
+	sput_fail_unless(links && dps && rules && advps, "Memory allocation");
+	if(!links || !dps || !rules || !advps)
+		return;
+
+	printf("links %"PRIu32", dps %"PRIu32" (/%d), rules %"PRIu32", advps %"PRIu32"\n",
+			links_n, dps_n, dp_plen, rules_n, advps_n);
+	printf("sizeof(struct pa_ldp) %zu, sizeof(struct pa_core) %zu\n",
+			sizeof(struct pa_ldp), sizeof(struct pa_core));
+
+	fu_init();
+	srandom(1);
+	rss0 = bench_rss();
+	live0 = bench_alloc.live;
+	allocs0 = bench_alloc.count;
+	t0 = bench_us();
+
+	pa_core_init(&core);
+	core.node_id[0] = 1;
+
+	/* Rules are all random rules with different priorities, such that all of
+	 * them are evaluated. */
+	for(i = 0; i < rules_n; i++) {
+		pa_rule_random_init(&rules[i]);
+		rules[i].rule.name = "random";
+		rules[i].rule_priority = 2 + i;
+		rules[i].priority = 2;
+		rules[i].desired_plen = 64;
+		rules[i].random_set_size = 64;
+		rules[i].pseudo_random_tentatives = 0;
+		pa_rule_add(&core, &rules[i].rule);
+	}
+	pa_rule_adopt_init(&arule);
+	arule.rule.name = "adopt";
+	arule.rule_priority = 1;
+	arule.priority = 2;
+	pa_rule_add(&core, &arule.rule);
+
+	/* Remote prefixes, spread over the Delegated Prefixes. */
+	for(i = 0; i < advps_n; i++) {
+		bench_slot_prefix(&advps[i].prefix, i % dps_n, dp_plen,
+				((i / dps_n) * 2654435761u) & ((1u << host) - 1));
+		advps[i].plen = 64;
+		advps[i].priority = 1 + (i % 3);
+		advps[i].node_id[0] = 2 + i;
+		advps[i].link = NULL;
+		pa_advp_add(&core, &advps[i]);
+	}
+
+	pa_core_config_begin(&core);
+	for(i = 0; i < dps_n; i++) {
+		pa_prefix p;
+		bench_dp_prefix(&p, i);
+		pa_dp_init(&dps[i], &p, dp_plen);
+		pa_dp_add(&core, &dps[i]);
+	}
+	for(i = 0; i < links_n; i++) {
+		pa_link_init(&links[i], NULL);
+		pa_link_add(&core, &links[i]);
+	}
+	pa_core_config_commit(&core);
+	setup_us = bench_us() - t0;
+
+	bench_run(&core, &stats);
+	rss1 = bench_rss();
+
+	for(i = 0; i < dps_n; i++) {
+		list_for_each_entry(ldp, &dps[i].ldps, in_dp) {
+			ldps_n++;
+			if(ldp->applied)
+				assigned_n++;
+		}
+	}
+
+	printf("\n");
+	printf("setup              %12"PRIu64" us\n", setup_us);
+	printf("setup allocations  %12"PRIu64"\n", bench_alloc.count - allocs0 - stats.allocs);
+	bench_stats_print("initial convergence", &stats, 1);
+	printf("  virtual time     %12"PRId64" ms\n", _fu_time - 10000000000);
+	printf("  ldps             %12"PRIu32" (%"PRIu32" applied)\n", ldps_n, assigned_n);
+	if(ldps_n) {
+		printf("  heap per ldp     %12.1f bytes\n",
+				(double)(bench_alloc.live - live0) / ldps_n);
+		printf("  rss per ldp      %12.1f bytes\n",
+				(double)(rss1 - rss0) / ldps_n);
+	}
+
+	/* Steady state: a single Advertised Prefix is added, then removed. */
+	memset(&add, 0, sizeof(add));
+	memset(&del, 0, sizeof(del));
+	for(i = 0; i < iter; i++) {
+		memset(&extra, 0, sizeof(extra));
+		bench_slot_prefix(&extra.prefix, random() % dps_n, dp_plen,
+				random() & ((1u << host) - 1));
+		extra.plen = 64;
+		extra.priority = 3;
+		extra.node_id[0] = 2 + advps_n + i;
+		extra.link = NULL;
+
+		t0 = bench_us();
+		if(pa_advp_add(&core, &extra))
+			continue;
+		bench_run(&core, &stats);
+		stats.us_total = bench_us() - t0;
+		bench_stats_add(&add, &stats);
+
+		t0 = bench_us();
+		pa_advp_del(&core, &extra);
+		bench_run(&core, &stats);
+		stats.us_total = bench_us() - t0;
+		bench_stats_add(&del, &stats);
+	}
+
+	printf("\n");
+	bench_stats_print("advp add", &add, iter);
+	printf("\n");
+	bench_stats_print("advp del", &del, iter);
+
+	pa_core_term(&core);
+	bench_run(&core, &stats);
+	printf("\nheap left after pa_core_term %"PRIu64" bytes\n", bench_alloc.live - live0);
+
+	free(links);
+	free(dps);
+	free(rules);
+	free(advps);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc > 1)
+		links_n = atoi(argv[1]);
+	if(argc > 2)
+		dps_n = atoi(argv[2]);
+	if(argc > 3)
+		rules_n = atoi(argv[3]);
+	if(argc > 4)
+		advps_n = atoi(argv[4]);
+	if(argc > 5)
+		iter = atoi(argv[5]);
+
+	sput_start_testing();
+	sput_enter_suite("Prefix Assignment core benchmark"); /* optional */
+	sput_run_test(pa_core_bench);
+	sput_leave_suite(); /* optional */
+	sput_finish_testing();
+	return sput_get_return_value();
+}
@@ -85,16 +85,18 @@ static inline int fu_timeout_set(struct uloop_timeout *timeout, int ms)
 
   _to_tv(v, &timeout->time);
 
+  /* Timeouts are usually set later than most pending ones, so the list is
+   * searched from its tail. Equal times keep insertion order. */
   struct uloop_timeout *tp;
-  list_for_each_entry(tp, &timeouts, list)
+  list_for_each_entry_reverse(tp, &timeouts, list)
     {
-      if (_to_time(&tp->time) > v)
+      if (_to_time(&tp->time) <= v)
         {
-          list_add_tail(&timeout->list, &tp->list);
+          list_add(&timeout->list, &tp->list);
           return 0;
         }
     }
-  list_add_tail(&timeout->list, &timeouts);
+  list_add(&timeout->list, &timeouts);
   return 0;
 }
 
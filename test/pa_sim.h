@@ -0,0 +1,614 @@
+/*
+ * Author: agent
+ *
+ * Copyright (c) 2026 agent
+ *
+ * Multi-node prefix assignment simulator.
+ *
+ * Runs many pa_core instances within a single process, using fake_uloop
+ * virtual time. Each node has a single private Link and a copy of the same
+ * Delegated Prefix, and picks prefixes with the random and adopt rules.
+ * Prefixes published by a node are flooded to all other nodes, where they are
+ * added as Advertised Prefixes. Flooding follows the shortest path in a
+ * configurable topology, with a per-hop latency and a per-hop loss
+ * probability. Lost updates are sent again after a retransmission delay, and
+ * updates between two nodes are always delivered in order.
+ *
+ * Updates in flight are kept in a heap ordered by delivery time, with a single
+ * timer armed for the first one, such that thousands of nodes can be simulated
+ * without filling the timer list with one timer per update.
+ *
+ * This file must be included after fake_uloop.h and pa_core.c.
+ */
+
+#ifndef PA_SIM_H_
+#define PA_SIM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pa_rules.h"
+
+enum pa_sim_topology {
+	PA_SIM_FULL, /* All nodes are neighbors. */
+	PA_SIM_LINE, /* Node i is connected to i-1 and i+1. */
+	PA_SIM_RING, /* A line, plus the first and last nodes are connected. */
+	PA_SIM_STAR, /* All nodes are connected to node 0. */
+	PA_SIM_TREE, /* Binary tree rooted at node 0. */
+	PA_SIM_GRID, /* Square grid, filled row by row. */
+};
+
+struct pa_sim_config {
+	/* Number of nodes. */
+	uint32_t nodes;
+
+	/* Flooding graph. */
+	enum pa_sim_topology topology;
+
+	/* Per-hop flooding latency, in milliseconds. */
+	uint32_t latency;
+
+	/* Per-hop loss probability, per thousand. */
+	uint16_t loss;
+
+	/* Delay before a lost update is sent again, in milliseconds. */
+	uint32_t retransmit;
+
+	/* Flooding delay configured on all nodes, in milliseconds. */
+	uint32_t flooding_delay;
+
+	/* The Delegated Prefix shared by all nodes. */
+	pa_prefix prefix;
+	pa_plen dp_plen;
+
+	/* The length of the prefixes assigned on each Link. */
+	pa_plen plen;
+
+	/* Random seed. */
+	unsigned int seed;
+};
+
+struct pa_sim;
+
+struct pa_sim_node {
+	struct pa_core core;
+	struct pa_user user;
+	struct pa_link link;
+	struct pa_dp dp;
+	struct pa_rule_random rrule;
+	struct pa_rule_adopt arule;
+	struct pa_sim *sim;
+	uint32_t index;
+
+	/* Flooding updates received by this node. */
+	uint32_t updates;
+
+	/* Prefix assignments, and assignments following a first one. */
+	uint32_t assignments;
+	uint32_t reassignments;
+
+	/* CPU time spent processing this node's timers. */
+	uint64_t cpu_us;
+};
+
+/* A flooding update being delivered. */
+struct pa_sim_update {
+	int64_t time;  /* Delivery time. */
+	uint64_t seq;  /* Orders updates delivered at the same time. */
+	uint32_t src;
+	uint32_t dst;
+	pa_prefix prefix;
+	pa_plen plen;
+	pa_priority priority;
+	uint8_t published;
+};
+
+struct pa_sim {
+	struct pa_sim_config conf;
+	struct pa_sim_node *nodes;
+
+	/* Hop counts between nodes (nodes x nodes). */
+	uint16_t *hops;
+
+	/* Last delivery time between nodes (nodes x nodes). */
+	int64_t *last;
+
+	/* Prefix received by a node from another node, or NULL (nodes x nodes).
+	 * Each node publishes at most one prefix. */
+	struct pa_advp **received;
+
+	/* Updates in flight, as a binary heap ordered by delivery time. */
+	struct pa_sim_update **queue;
+	uint32_t queue_n;
+	uint32_t queue_size;
+	uint64_t queue_seq;
+
+	/* Timer set for the first update in flight. */
+	struct uloop_timeout deliver_to;
+
+	/* Simulation start and last assignment change. */
+	int64_t start;
+	int64_t last_change;
+
+	/* Totals */
+	uint64_t updates;
+	uint64_t events;
+	uint64_t cpu_us;
+};
+
+/* Default configuration for a given number of nodes. */
+#define pa_sim_config_init(conf, n) do { \
+		memset(conf, 0, sizeof(*(conf))); \
+		(conf)->nodes = n; \
+		(conf)->topology = PA_SIM_FULL; \
+		(conf)->latency = 10; \
+		(conf)->retransmit = 1000; \
+		(conf)->flooding_delay = 1000; \
+		(conf)->prefix.s6_addr[0] = 0x20; \
+		(conf)->prefix.s6_addr[1] = 0x01; \
+		(conf)->prefix.s6_addr[2] = 0x0d; \
+		(conf)->prefix.s6_addr[3] = 0xb8; \
+		(conf)->dp_plen = 48; \
+		(conf)->plen = 64; \
+		(conf)->seed = 1; } while(0)
+
+static uint64_t pa_sim_cpu_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Fills neighbors, and returns their number. */
+static uint32_t pa_sim_neighbors(struct pa_sim *sim, uint32_t i, uint32_t *neigh)
+{
+	uint32_t n = sim->conf.nodes, k = 0, side;
+	switch (sim->conf.topology) {
+	case PA_SIM_FULL:
+		for(side = 0; side < n; side++)
+			if(side != i)
+				neigh[k++] = side;
+		break;
+	case PA_SIM_RING:
+		if(n > 2 && (i == 0 || i == n - 1))
+			neigh[k++] = i?0:(n - 1);
+		/* fall through */
+	case PA_SIM_LINE:
+		if(i)
+			neigh[k++] = i - 1;
+		if(i + 1 < n)
+			neigh[k++] = i + 1;
+		break;
+	case PA_SIM_STAR:
+		if(i) {
+			neigh[k++] = 0;
+		} else {
+			for(side = 1; side < n; side++)
+				neigh[k++] = side;
+		}
+		break;
+	case PA_SIM_TREE:
+		if(i)
+			neigh[k++] = (i - 1) / 2;
+		if(2 * i + 1 < n)
+			neigh[k++] = 2 * i + 1;
+		if(2 * i + 2 < n)
+			neigh[k++] = 2 * i + 2;
+		break;
+	case PA_SIM_GRID:
+		for(side = 1; side * side < n; side++);
+		if(i % side)
+			neigh[k++] = i - 1;
+		if((i + 1) % side && i + 1 < n)
+			neigh[k++] = i + 1;
+		if(i >= side)
+			neigh[k++] = i - side;
+		if(i + side < n)
+			neigh[k++] = i + side;
+		break;
+	}
+	return k;
+}
+
+/* Computes hop counts with a breadth-first search from each node. */
+static int pa_sim_hops(struct pa_sim *sim)
+{
+	uint32_t n = sim->conf.nodes, src, head, tail, k, neigh_n, *queue, *neigh;
+	if(!(queue = malloc(2 * n * sizeof(uint32_t))))
+		return -1;
+	neigh = queue + n;
+
+	for(src = 0; src < n; src++) {
+		uint16_t *hops = &sim->hops[src * n];
+		for(k = 0; k < n; k++)
+			hops[k] = UINT16_MAX;
+		hops[src] = 0;
+		queue[0] = src;
+		for(head = 0, tail = 1; head < tail; head++) {
+			neigh_n = pa_sim_neighbors(sim, queue[head], neigh);
+			for(k = 0; k < neigh_n; k++) {
+				if(hops[neigh[k]] == UINT16_MAX) {
+					hops[neigh[k]] = hops[queue[head]] + 1;
+					queue[tail++] = neigh[k];
+				}
+			}
+		}
+	}
+	free(queue);
+	return 0;
+}
+
+#define pa_sim_update_before(u1, u2) \
+	((u1)->time < (u2)->time || ((u1)->time == (u2)->time && (u1)->seq < (u2)->seq))
+
+static int pa_sim_queue_push(struct pa_sim *sim, struct pa_sim_update *u)
+{
+	struct pa_sim_update **queue;
+	uint32_t i, parent;
+
+	if(sim->queue_n == sim->queue_size) {
+		if(!(queue = realloc(sim->queue, (sim->queue_size * 2 + 64) * sizeof(*queue))))
+			return -1;
+		sim->queue = queue;
+		sim->queue_size = sim->queue_size * 2 + 64;
+	}
+
+	u->seq = sim->queue_seq++;
+	for(i = sim->queue_n++; i; i = parent) {
+		parent = (i - 1) / 2;
+		if(!pa_sim_update_before(u, sim->queue[parent]))
+			break;
+		sim->queue[i] = sim->queue[parent];
+	}
+	sim->queue[i] = u;
+	return 0;
+}
+
+static struct pa_sim_update *pa_sim_queue_pop(struct pa_sim *sim)
+{
+	struct pa_sim_update *first = sim->queue[0], *last = sim->queue[--sim->queue_n];
+	uint32_t i = 0, child;
+
+	while((child = 2 * i + 1) < sim->queue_n) {
+		if(child + 1 < sim->queue_n &&
+				pa_sim_update_before(sim->queue[child + 1], sim->queue[child]))
+			child++;
+		if(!pa_sim_update_before(sim->queue[child], last))
+			break;
+		sim->queue[i] = sim->queue[child];
+		i = child;
+	}
+	sim->queue[i] = last;
+	return first;
+}
+
+/* Sets the delivery timer for the first update in flight. */
+static void pa_sim_queue_schedule(struct pa_sim *sim)
+{
+	if(!sim->queue_n) {
+		uloop_timeout_cancel(&sim->deliver_to);
+	} else if(!sim->deliver_to.pending ||
+			_to_time(&sim->deliver_to.time) != sim->queue[0]->time) {
+		uloop_timeout_set(&sim->deliver_to, (int)(sim->queue[0]->time - _fu_time));
+	}
+}
+
+static void pa_sim_deliver(struct pa_sim *sim, struct pa_sim_update *u)
+{
+	struct pa_sim_node *node = &sim->nodes[u->dst];
+	struct pa_advp **advp = &sim->received[u->dst * sim->conf.nodes + u->src];
+
+	node->updates++;
+	sim->updates++;
+	if(*advp && (!u->published ||
+			pa_prefix_cmp(&(*advp)->prefix, (*advp)->plen, &u->prefix, u->plen))) {
+		pa_advp_del(&node->core, *advp);
+		free(*advp);
+		*advp = NULL;
+	}
+
+	if(u->published) {
+		if(*advp) {
+			(*advp)->priority = u->priority;
+			pa_advp_update(&node->core, *advp);
+		} else if((*advp = calloc(1, sizeof(**advp)))) {
+			pa_prefix_cpy(&u->prefix, u->plen, &(*advp)->prefix, (*advp)->plen);
+			(*advp)->priority = u->priority;
+			(*advp)->node_id[0] = u->src + 1;
+			(*advp)->link = NULL;
+			if(pa_advp_add(&node->core, *advp)) {
+				free(*advp);
+				*advp = NULL;
+			}
+		}
+	}
+	free(u);
+}
+
+/* Delivers all updates which are due. */
+static void pa_sim_deliver_to(struct uloop_timeout *to)
+{
+	struct pa_sim *sim = container_of(to, struct pa_sim, deliver_to);
+	struct pa_sim_node *node;
+	uint64_t t0;
+
+	while(sim->queue_n && sim->queue[0]->time <= _fu_time) {
+		node = &sim->nodes[sim->queue[0]->dst];
+		t0 = pa_sim_cpu_us();
+		pa_sim_deliver(sim, pa_sim_queue_pop(sim));
+		node->cpu_us += pa_sim_cpu_us() - t0;
+		sim->events++;
+	}
+	pa_sim_queue_schedule(sim);
+}
+
+/* Sends the published state of an ldp to all other nodes. */
+static void pa_sim_flood(struct pa_sim_node *node, struct pa_ldp *ldp)
+{
+	struct pa_sim *sim = node->sim;
+	struct pa_sim_update *u;
+	uint32_t n = sim->conf.nodes, dst, h;
+	int64_t now = _fu_time, time;
+
+	for(dst = 0; dst < n; dst++) {
+		if(dst == node->index || sim->hops[node->index * n + dst] == UINT16_MAX)
+			continue;
+
+		if(!(u = malloc(sizeof(*u))))
+			continue;
+
+		time = now;
+		for(h = 0; h < sim->hops[node->index * n + dst]; h++) {
+			time += sim->conf.latency;
+			while(sim->conf.loss && (uint32_t)(random() % 1000) < sim->conf.loss)
+				time += sim->conf.retransmit;
+		}
+		if(time < sim->last[node->index * n + dst])
+			time = sim->last[node->index * n + dst]; //Keep updates ordered
+		sim->last[node->index * n + dst] = time;
+
+		u->time = time;
+		u->src = node->index;
+		u->dst = dst;
+		pa_prefix_cpy(&ldp->prefix, ldp->plen, &u->prefix, u->plen);
+		u->priority = ldp->priority;
+		u->published = ldp->published;
+		if(pa_sim_queue_push(sim, u))
+			free(u);
+	}
+	pa_sim_queue_schedule(sim);
+}
+
+static void pa_sim_published_cb(struct pa_user *user, struct pa_ldp *ldp)
+{
+	struct pa_sim_node *node = container_of(user, struct pa_sim_node, user);
+	node->sim->last_change = _fu_time;
+	pa_sim_flood(node, ldp);
+}
+
+static void pa_sim_assigned_cb(struct pa_user *user, struct pa_ldp *ldp)
+{
+	struct pa_sim_node *node = container_of(user, struct pa_sim_node, user);
+	node->sim->last_change = _fu_time;
+	if(ldp->assigned && node->assignments++)
+		node->reassignments++;
+}
+
+/* Returns the node whose code is executed by a timeout, or NULL. */
+static struct pa_sim_node *pa_sim_owner(struct pa_sim *sim, struct uloop_timeout *to)
+{
+	struct pa_core *core;
+	if(to == &sim->deliver_to)
+		return NULL; //Accounted for each update
+	else if(to->cb == pa_routine_to)
+		core = container_of(to, struct pa_ldp_sched, routine_to)->ldp->link->core;
+	else if(to->cb == pa_backoff_to)
+		core = container_of(to, struct pa_ldp_sched, backoff_to)->ldp->link->core;
+	else
+		return NULL;
+	return container_of(core, struct pa_sim_node, core);
+}
+
+/**
+ * Creates all nodes, which start running at current virtual time.
+ * Returns 0 on success, -1 otherwise.
+ */
+static int pa_sim_init(struct pa_sim *sim, const struct pa_sim_config *conf)
+{
+	uint32_t i, n = conf->nodes;
+	struct pa_sim_node *node;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->conf = *conf;
+	if(!n || !(sim->nodes = calloc(n, sizeof(*sim->nodes))) ||
+			!(sim->hops = calloc((size_t)n * n, sizeof(*sim->hops))) ||
+			!(sim->last = calloc((size_t)n * n, sizeof(*sim->last))) ||
+			!(sim->received = calloc((size_t)n * n, sizeof(*sim->received))) ||
+			pa_sim_hops(sim)) {
+		free(sim->nodes);
+		free(sim->hops);
+		free(sim->last);
+		free(sim->received);
+		return -1;
+	}
+
+	sim->deliver_to.cb = pa_sim_deliver_to;
+	srandom(conf->seed);
+	sim->start = _fu_time;
+	sim->last_change = _fu_time;
+	for(i = 0; i < n; i++) {
+		node = &sim->nodes[i];
+		node->sim = sim;
+		node->index = i;
+		pa_core_init(&node->core);
+		node->core.node_id[0] = i + 1;
+		pa_core_set_flooding_delay(&node->core, conf->flooding_delay);
+
+		node->user.assigned = pa_sim_assigned_cb;
+		node->user.published = pa_sim_published_cb;
+		node->user.republished = NULL; //Falls back to published
+		node->user.applied = NULL;
+		node->user.quiescent = NULL;
+#if PA_USER_BATCH_SIZE != 0
+		node->user.batch = NULL;
+#endif
+		pa_user_register(&node->core, &node->user);
+
+		pa_rule_random_init(&node->rrule);
+		node->rrule.rule.name = "random";
+		node->rrule.rule_priority = 2;
+		node->rrule.priority = 2;
+		node->rrule.desired_plen = conf->plen;
+		node->rrule.random_set_size = 64;
+		node->rrule.pseudo_random_tentatives = 0;
+		pa_rule_adopt_init(&node->arule);
+		node->arule.rule.name = "adopt";
+		node->arule.rule_priority = 1;
+		node->arule.priority = 2;
+
+		pa_link_init(&node->link, NULL);
+		pa_dp_init(&node->dp, &sim->conf.prefix, conf->dp_plen);
+		pa_link_add(&node->core, &node->link);
+		pa_dp_add(&node->core, &node->dp);
+		pa_rule_add(&node->core, &node->rrule.rule);
+		pa_rule_add(&node->core, &node->arule.rule);
+	}
+	return 0;
+}
+
+/**
+ * Runs the simulation until no event is left, or until the given virtual
+ * duration is reached (in milliseconds, or -1 for no limit).
+ * Returns whether events are left.
+ */
+static int pa_sim_run(struct pa_sim *sim, int64_t duration)
+{
+	struct uloop_timeout *to;
+	struct pa_sim_node *node;
+	int64_t end = _fu_time + duration;
+	uint64_t t0, t;
+
+	while((to = fu_next())) {
+		if(duration >= 0 && _to_time(&to->time) > end)
+			return 1;
+
+		if(_to_time(&to->time) > _fu_time)
+			fu_set_time(_to_time(&to->time));
+
+		node = pa_sim_owner(sim, to);
+		t0 = pa_sim_cpu_us();
+		fu_run_one(to);
+		t = pa_sim_cpu_us() - t0;
+		sim->cpu_us += t;
+		if(node)
+			node->cpu_us += t;
+		if(to != &sim->deliver_to) //Deliveries are counted one by one
+			sim->events++;
+	}
+	return 0;
+}
+
+/* Returns the ldp of a node. */
+#define pa_sim_ldp(node) \
+	(list_empty(&(node)->link.ldps)?NULL:list_first_entry(&(node)->link.ldps, struct pa_ldp, in_link))
+
+struct pa_sim_prefix {
+	pa_prefix prefix;
+	pa_plen plen;
+};
+
+static int pa_sim_prefix_cmp(const void *a, const void *b)
+{
+	const struct pa_sim_prefix *p1 = a, *p2 = b;
+	return pa_prefix_cmp(&p1->prefix, p1->plen, &p2->prefix, p2->plen);
+}
+
+/**
+ * Returns the number of nodes without an applied prefix, plus the number of
+ * overlapping prefix pairs.
+ */
+static uint32_t pa_sim_conflicts(struct pa_sim *sim)
+{
+	uint32_t i, k = 0, errors = 0;
+	struct pa_sim_prefix *prefixes;
+	struct pa_ldp *ldp;
+
+	if(!(prefixes = calloc(sim->conf.nodes, sizeof(*prefixes))))
+		return sim->conf.nodes;
+
+	for(i = 0; i < sim->conf.nodes; i++) {
+		ldp = pa_sim_ldp(&sim->nodes[i]);
+		if(!ldp || !ldp->applied) {
+			errors++;
+			continue;
+		}
+		pa_prefix_cpy(&ldp->prefix, ldp->plen, &prefixes[k].prefix, prefixes[k].plen);
+		k++;
+	}
+
+	qsort(prefixes, k, sizeof(*prefixes), pa_sim_prefix_cmp);
+	for(i = 1; i < k; i++) {
+		if(pa_prefix_overlap(&prefixes[i - 1].prefix, prefixes[i - 1].plen,
+				&prefixes[i].prefix, prefixes[i].plen))
+			errors++;
+	}
+	free(prefixes);
+	return errors;
+}
+
+static void pa_sim_report(struct pa_sim *sim, FILE *f)
+{
+	uint32_t i, max_updates = 0, max_reassignments = 0, reassignments = 0;
+	uint64_t max_cpu = 0;
+	struct pa_sim_node *node;
+
+	for(i = 0; i < sim->conf.nodes; i++) {
+		node = &sim->nodes[i];
+		if(node->updates > max_updates)
+			max_updates = node->updates;
+		if(node->reassignments > max_reassignments)
+			max_reassignments = node->reassignments;
+		if(node->cpu_us > max_cpu)
+			max_cpu = node->cpu_us;
+		reassignments += node->reassignments;
+	}
+
+	fprintf(f, "nodes              %"PRIu32"\n", sim->conf.nodes);
+	fprintf(f, "convergence time   %"PRId64" ms\n", sim->last_change - sim->start);
+	fprintf(f, "conflicts          %"PRIu32"\n", pa_sim_conflicts(sim));
+	fprintf(f, "flooding updates   %"PRIu64" (%"PRIu64" per node, max %"PRIu32")\n",
+			sim->updates, sim->updates / sim->conf.nodes, max_updates);
+	fprintf(f, "reassignments      %"PRIu32" (max %"PRIu32" per node)\n",
+			reassignments, max_reassignments);
+	fprintf(f, "events             %"PRIu64"\n", sim->events);
+	fprintf(f, "cpu time           %"PRIu64" us (%"PRIu64" per node, max %"PRIu64")\n",
+			sim->cpu_us, sim->cpu_us / sim->conf.nodes, max_cpu);
+}
+
+/* Removes all nodes and pending updates. */
+static void pa_sim_term(struct pa_sim *sim)
+{
+	uint32_t i;
+
+	uloop_timeout_cancel(&sim->deliver_to);
+	for(i = 0; i < sim->queue_n; i++)
+		free(sim->queue[i]);
+	free(sim->queue);
+
+	for(i = 0; i < sim->conf.nodes; i++) {
+		pa_user_unregister(&sim->nodes[i].user);
+		pa_core_term(&sim->nodes[i].core);
+	}
+
+	for(i = 0; i < sim->conf.nodes * sim->conf.nodes; i++)
+		free(sim->received[i]);
+
+	free(sim->nodes);
+	free(sim->hops);
+	free(sim->last);
+	free(sim->received);
+}
+
+#endif /* PA_SIM_H_ */
@@ -38,6 +38,10 @@ static int f_btrie_add(struct btrie *root, struct btrie_element *new, const btri
 
 #define TEST_DEBUG(format, ...) printf("TEST Debug   : "format"\n", ##__VA_ARGS__)
 
+/* Controlled clock for routine budget */
+static uint64_t test_clock_us = 0;
+#define pa_clock_us() test_clock_us
+
 #include "pa_rules.h"
 #include "pa_filters.h"
 
@@ -90,7 +94,7 @@ struct test_user {
 
 #define check_ldp_routine(ldp, b, best) \
 		sput_fail_unless((ldp)->backoff == b, "Correct ldp backoff flag"); \
-		sput_fail_unless((ldp)->best_assignment == best, "Correct ldp best_assignment");
+		sput_fail_unless(((ldp)->sched?(ldp)->sched->best_assignment:NULL) == best, "Correct ldp best_assignment");
 
 /* Custom user */
 
@@ -123,6 +127,7 @@ static struct test_user tuser = {
 struct test_rule {
 	struct pa_rule rule;
 	struct pa_ldp ldp;
+	struct pa_ldp_sched sched;
 	int filter_ctr;
 	int prio_ctr;
 	int match_ctr;
@@ -148,6 +153,8 @@ static pa_rule_priority test_rule_prio(struct pa_rule *rule, struct pa_ldp *ldp)
 {
 	struct test_rule *t = container_of(rule, struct test_rule, rule);
 	t->ldp = *ldp;
+	t->sched = *ldp->sched;
+	t->ldp.sched = &t->sched;
 	t->prio_ctr++;
 	TEST_DEBUG("Called get_max_prio %d", t->priority);
 	return t->priority;
@@ -159,6 +166,8 @@ static enum pa_rule_target test_rule_match(struct pa_rule *rule, struct pa_ldp *
 {
 	struct test_rule *t = container_of(rule, struct test_rule, rule);
 	t->ldp = *ldp;
+	t->sched = *ldp->sched;
+	t->ldp.sched = &t->sched;
 	t->best_match_priority = best_match_priority;
 	*pa_arg = t->arg;
 	t->match_ctr++;
@@ -394,9 +403,9 @@ void pa_core_hierarchical() {
 	pa_dp_add(&core, &d1);
 	fu_loop(1); //Publish prefix but no apply
 	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
-	check_ldp_flags(low_ldp, 1, 1, 0, 0);
+	check_ldp_flags(ldp, 1, 1, 0, 0);
 	sput_fail_if(ldp->ha_apply_pending, "Not pending for HA");
-	check_ldp_prefix(low_ldp, &advp1_01.prefix, 64);
+	check_ldp_prefix(ldp, &advp1_01.prefix, 64);
 	sput_fail_unless(list_empty(&low_core.dps), "No DP on low core");
 
 	fu_loop(1); //Apply prefix
@@ -486,13 +495,13 @@ void pa_core_rule() {
 	sput_fail_if(fu_next(), "No scheduled timer.");
 
 	pa_rule_add(&core, &rule1.rule);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->routine_to) == PA_RUN_DELAY, "Correct delay");
 
 	set_time(get_time() + 1);
 	pa_rule_add(&core, &rule2.rule);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
 
 	rule1.filter_accept = 0;
 	rule2.filter_accept = 0;
@@ -547,8 +556,8 @@ void pa_core_rule() {
 	cr_check_ctr(&rule2, 1, 1, 1);
 	check_ldp_flags(ldp, false, false, false, false);
 	check_ldp_publish(ldp, NULL, 0, 0);
-	sput_fail_unless(ldp->backoff_to.pending, "Backoff timer pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == (PA_ADOPT_DELAY_DEFAULT + 1000 % (PA_BACKOFF_DELAY_DEFAULT - PA_ADOPT_DELAY_DEFAULT)), "Correct delay");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Backoff timer pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == (PA_ADOPT_DELAY_DEFAULT + 1000 % (PA_BACKOFF_DELAY_DEFAULT - PA_ADOPT_DELAY_DEFAULT)), "Correct delay");
 	check_ldp_routine(&rule1.ldp, 0, NULL);
 	check_ldp_routine(&rule2.ldp, 0, NULL);
 
@@ -661,8 +670,8 @@ void pa_core_rule() {
 	check_ldp_flags(ldp, true, false, false, true);
 	check_ldp_publish(ldp, &rule1.rule, 3, 10);
 	check_ldp_prefix(ldp, &advp1_02.prefix, advp1_02.plen);
-	sput_fail_unless(ldp->backoff_to.pending, "Backoff timer pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == 10 % PA_ADOPT_DELAY_DEFAULT, "Correct delay");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Backoff timer pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == 10 % PA_ADOPT_DELAY_DEFAULT, "Correct delay");
 
 	//Adopt
 	fu_loop(1);
@@ -670,9 +679,9 @@ void pa_core_rule() {
 	check_ldp_flags(ldp, true, true, false, false);
 	check_ldp_prefix(ldp, &advp1_02.prefix, advp1_02.plen);
 	check_ldp_publish(ldp, &rule1.rule, 3, 10);
-	sput_fail_unless(ldp->backoff_to.pending, "Apply timeout pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
-	sput_fail_unless(fu_next() == &ldp->backoff_to, "Correct timeout");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timeout pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
+	sput_fail_unless(fu_next() == &ldp->sched->backoff_to, "Correct timeout");
 
 	//Apply
 	fu_loop(1);
@@ -707,13 +716,13 @@ void pa_core_rule() {
 	//Now playing with flooding delays
 	set_time(get_time()+10); //Waiting 10ms
 	pa_core_set_flooding_delay(&core, 100);
-	sput_fail_unless(ldp->backoff_to.pending, "Apply timeout pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timeout pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
 
 	set_time(get_time()+10); //Waiting 10 more ms
 	pa_core_set_flooding_delay(&core, PA_DEFAULT_FLOODING_DELAY);
-	sput_fail_unless(ldp->backoff_to.pending, "Apply timeout pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == (int)(2 * core.flooding_delay) - 10, "Correct apply delay");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timeout pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == (int)(2 * core.flooding_delay) - 10, "Correct apply delay");
 
 	//Apply
 	fu_loop(1);
@@ -736,9 +745,9 @@ void pa_core_rule() {
 	check_ldp_flags(ldp, true, false, true, true);
 	check_ldp_prefix(ldp, &advp1_01.prefix, advp1_01.plen);
 	check_ldp_publish(ldp, &rule1.rule, 3, 4);
-	sput_fail_unless(ldp->backoff_to.pending, "Backoff timer pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == 10 % PA_ADOPT_DELAY_DEFAULT, "Correct delay");
-	sput_fail_unless(fu_next() == &ldp->backoff_to, "Correct timeout");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Backoff timer pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == 10 % PA_ADOPT_DELAY_DEFAULT, "Correct delay");
+	sput_fail_unless(fu_next() == &ldp->sched->backoff_to, "Correct timeout");
 
 	//Adopt
 	fu_loop(1);
@@ -801,14 +810,14 @@ void pa_core_norule() {
 
 	//Test scheduling
 	sput_fail_unless(ldp, "ldp present");
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
-	sput_fail_unless(fu_next() == &ldp->routine_to, "Correct timeout");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(fu_next() == &ldp->sched->routine_to, "Correct timeout");
 
 	set_time(get_time() + 1);
 	pa_core_set_node_id(&core, &id1); //Reschedule
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
 
 	//Adding user
 	pa_user_register(&core, &tuser.user);
@@ -830,7 +839,7 @@ void pa_core_norule() {
 	advp2_01.priority = 2;
 	pa_advp_add(&core, &advp2_01);
 	pa_advp_update(&core, &advp2_01);
-	sput_fail_if(ldp->routine_to.pending, "Not routine pending");
+	sput_fail_if(pa_ldp_routine_pending(ldp), "Not routine pending");
 	sput_fail_if(fu_next(), "No pending timeout");
 
 	//advp added
@@ -848,8 +857,8 @@ void pa_core_norule() {
 	advp1_01.link = NULL;
 	advp1_01.priority = 2;
 	pa_advp_add(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->routine_to) == PA_RUN_DELAY, "Correct delay");
 	fu_loop(1);
 	check_user(&tuser, NULL, NULL, NULL);
 	check_ldp_flags(ldp, false, false, false, false);
@@ -863,40 +872,40 @@ void pa_core_norule() {
 	//Accept a prefix
 	advp1_01.link = &l1;
 	pa_advp_update(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->routine_to) == PA_RUN_DELAY, "Correct delay");
 	fu_loop(1);
 	check_user(&tuser, ldp, NULL, NULL);
 	check_ldp_flags(ldp, 1, 0, 0, 0);
 	check_ldp_prefix(ldp, &advp1_01.prefix, advp1_01.plen);
 
 	//Apply running
-	sput_fail_unless(ldp->backoff_to.pending, "Apply timeout pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
-	sput_fail_unless(fu_next() == &ldp->backoff_to, "Correct timeout");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timeout pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
+	sput_fail_unless(fu_next() == &ldp->sched->backoff_to, "Correct timeout");
 
 	//Remove adv2_01
 	pa_advp_del(&core, &advp2_01);
-	sput_fail_if(ldp->routine_to.pending, "Not routine pending");
+	sput_fail_if(pa_ldp_routine_pending(ldp), "Not routine pending");
 
 	//Remove and add adv1_01 again
 	pa_advp_del(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
 	check_user(&tuser, NULL, NULL, NULL);
 	check_ldp_flags(ldp, 1, 0, 0, 0);
 
 	set_time(get_time() + 1);
 	pa_advp_add(&core, &advp1_01);
-	sput_fail_unless(ldp->routine_to.pending, "Routine pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->routine_to) == PA_RUN_DELAY - 1, "Correct delay");
 	fu_loop(1);
 	check_user(&tuser, NULL, NULL, NULL);
 	check_ldp_flags(ldp, 1, 0, 0, 0);
 
 	//Apply running
-	sput_fail_unless(ldp->backoff_to.pending, "Apply timeout pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == (int)(2 * core.flooding_delay) - PA_RUN_DELAY, "Correct apply delay");
-	sput_fail_unless(fu_next() == &ldp->backoff_to, "Correct timeout");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timeout pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == (int)(2 * core.flooding_delay) - PA_RUN_DELAY, "Correct apply delay");
+	sput_fail_unless(fu_next() == &ldp->sched->backoff_to, "Correct timeout");
 
 	//Remove and execute routine
 	pa_advp_del(&core, &advp1_01);
@@ -905,7 +914,7 @@ void pa_core_norule() {
 	check_ldp_flags(ldp, 0, 0, 0, 0);
 
 	//Apply canceled
-	sput_fail_if(ldp->backoff_to.pending, "Apply to not pending");
+	sput_fail_if(pa_ldp_backoff_pending(ldp), "Apply to not pending");
 	sput_fail_if(fu_next(), "Not timeout");
 
 	//Add and execute routine
@@ -950,8 +959,8 @@ void pa_core_norule() {
 	check_ldp_prefix(ldp, &advp1_02.prefix, advp1_02.plen);
 
 	//Check apply timer
-	sput_fail_unless(ldp->backoff_to.pending, "Apply timeout pending");
-	sput_fail_unless(uloop_timeout_remaining(&ldp->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timeout pending");
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == (int)(2 * core.flooding_delay), "Correct apply delay");
 
 	//First one use a lower rid
 	advp1_02.node_id[0] = id3;
@@ -974,7 +983,7 @@ void pa_core_norule() {
 
 	//Remove the link from core
 	pa_link_del(&l1);
-	sput_fail_if(ldp->routine_to.pending, "Not routine pending");
+	sput_fail_if(pa_core_pending_routines(&core), "Not routine pending");
 	sput_fail_if(fu_next(), "No pending timeout");
 	check_user(&tuser, ldp, NULL, NULL);
 
@@ -1080,6 +1089,1294 @@ void pa_core_data() {
 	sput_fail_if(fu_next(), "No scheduled timer.");
 }
 
+void pa_core_conflicts() {
+	fu_init();
+	fr_mask_random = 1;
+	struct pa_core core;
+	struct pa_rule_static s1;
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	sput_fail_if(core.conflicts_valid, "Cache disabled");
+
+	pa_rule_static_init(&s1);
+	s1.rule.name = "static rule";
+	s1.override_priority = 3;
+	s1.override_rule_priority = 0;
+	s1.priority = 3;
+	s1.rule_priority = 3;
+	s1.safety = 1;
+	pa_prefix_cpy(&advp1_02.prefix, advp1_02.plen, &s1.prefix, s1.plen);
+
+	advp1_02.link = NULL;
+	advp1_02.priority = 2;
+	advp1_02.node_id[0] = id2;
+	pa_advp_add(&core, &advp1_02);
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &s1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+
+	fr_random_push(0);
+	fu_loop(1); //get_max_priority, then match returns backoff
+	check_ldp_flags(ldp, 0, 0, 0, 0);
+	sput_fail_if(core.conflicts_valid, "Cache disabled after rules execution");
+	sput_fail_unless(core.conflicts_n == 1, "Single summary for the candidate");
+	sput_fail_unless(core.conflicts[0].advertised, "Advertised Prefix conflicts");
+	sput_fail_if(core.conflicts[0].held, "No conflicting ldp");
+	sput_fail_unless(core.conflicts[0].advp_priority == 2, "Correct advertised priority");
+
+	fu_loop(1); //Backoff timeout
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	check_ldp_prefix(ldp, &advp1_02.prefix, advp1_02.plen);
+	sput_fail_unless(core.conflicts_n == 1, "Single summary for the candidate");
+
+	//Out of the routine, no caching
+	sput_fail_unless(pa_rule_valid_assignment(ldp, &s1.prefix, s1.plen, 4, 4, 1), "Valid assignment");
+	sput_fail_if(pa_rule_valid_assignment(ldp, &s1.prefix, s1.plen, 4, 2, 0), "Advertised Prefix priority too high");
+	sput_fail_if(pa_rule_valid_assignment(ldp, &s1.prefix, s1.plen, 3, 4, 0), "Rule priority too high");
+	sput_fail_unless(core.conflicts_n == 1, "Cache unchanged");
+
+	fu_loop(1); //Apply timeout
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	sput_fail_if(ldp->sched, "Idle pair");
+	sput_fail_if(list_empty(&core.sched_slabs), "Scheduling state slab kept");
+	sput_fail_unless(pa_rule_valid_assignment(ldp, &s1.prefix, s1.plen, 4, 4, 1), "Valid assignment when idle");
+	sput_fail_if(pa_rule_valid_assignment(ldp, &s1.prefix, s1.plen, 3, 4, 0), "Rule priority too high when idle");
+
+	pa_rule_del(&core, &s1.rule);
+	pa_advp_del(&core, &advp1_02);
+	pa_link_del(&l1);
+	sput_fail_unless(list_empty(&core.sched_slabs), "Scheduling state slab freed");
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	fr_mask_random = 0;
+}
+
+void pa_core_budget() {
+	fu_init();
+	struct pa_core core;
+	struct pa_ldp *ldp1, *ldp2;
+	uint32_t id = id1;
+
+	pa_core_init(&core);
+	sput_fail_unless(pa_core_pending_routines(&core) == 0, "No pending routine");
+
+	pa_core_set_routine_budget(&core, 1, 0);
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_dp_add(&core, &d1);
+	ldp1 = list_entry(l1.ldps.next, struct pa_ldp, in_link);
+	ldp2 = list_entry(l2.ldps.next, struct pa_ldp, in_link);
+	sput_fail_unless(pa_core_pending_routines(&core) == 2, "Two pending routines");
+
+	fu_loop(1); //First routine is executed
+	sput_fail_if(pa_ldp_routine_pending(ldp1), "First routine executed");
+	sput_fail_unless(core.tick_to.pending, "Tick pending");
+	sput_fail_unless(pa_core_pending_routines(&core) == 1, "One pending routine");
+
+	fu_loop(1); //Second routine exceeds the budget
+	sput_fail_unless(pa_ldp_routine_pending(ldp2), "Second routine deferred");
+	sput_fail_unless(uloop_timeout_remaining(&ldp2->sched->routine_to) == PA_RUN_YIELD_DELAY, "Correct defer delay");
+	sput_fail_unless(pa_core_pending_routines(&core) == 1, "One pending routine");
+	sput_fail_unless(fu_next() == &core.tick_to, "Tick is first");
+
+	fu_loop(1); //Tick
+	sput_fail_unless(core.tick_routines == 0, "Budget restored");
+	fu_loop(1); //Second routine
+	sput_fail_if(pa_ldp_routine_pending(ldp2), "Second routine executed");
+	sput_fail_unless(pa_core_pending_routines(&core) == 0, "No pending routine");
+	fu_loop(1); //Tick
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	//Time budget
+	pa_core_set_routine_budget(&core, 0, 100);
+	pa_core_set_node_id(&core, &id);
+	sput_fail_unless(pa_core_pending_routines(&core) == 2, "Two pending routines");
+	fu_loop(1); //First routine
+	test_clock_us += 100;
+	fu_loop(1); //Second routine is deferred
+	sput_fail_unless(pa_ldp_routine_pending(ldp2), "Second routine deferred");
+	sput_fail_unless(pa_core_pending_routines(&core) == 1, "One pending routine");
+
+	//Destroying a pair with a deferred routine
+	pa_link_del(&l2);
+	sput_fail_unless(pa_core_pending_routines(&core) == 0, "No pending routine");
+
+	//Disabling the budget
+	pa_core_set_routine_budget(&core, 0, 0);
+	sput_fail_if(core.tick_to.pending, "No tick pending");
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+static int quiescent_ctr = 0;
+static void user_quiescent(__unused struct pa_user *user) {
+	TEST_DEBUG("Called user_quiescent");
+	quiescent_ctr++;
+}
+
+void pa_core_quiescent() {
+	fu_init();
+	fr_mask_random = 1;
+	struct pa_core core;
+	struct pa_rule_static s1;
+	struct pa_user quser = {.quiescent = user_quiescent};
+	struct pa_ldp *ldp;
+	uint32_t id = id1;
+
+	pa_core_init(&core);
+	pa_user_register(&core, &quser);
+
+	pa_rule_static_init(&s1);
+	s1.rule.name = "static rule";
+	s1.override_priority = 3;
+	s1.override_rule_priority = 0;
+	s1.priority = 3;
+	s1.rule_priority = 3;
+	s1.safety = 0;
+	pa_prefix_cpy(&advp1_01.prefix, advp1_01.plen, &s1.prefix, s1.plen);
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &s1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+
+	fr_random_push(0);
+	fu_loop(1); //Routine starts backoff
+	sput_fail_if(core.changed, "Nothing changed");
+	sput_fail_if(core.quiesce_to.pending, "No quiescence pending");
+
+	fu_loop(1); //Backoff timeout
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	sput_fail_unless(core.quiesce_to.pending, "Quiescence pending");
+	sput_fail_unless(uloop_timeout_remaining(&core.quiesce_to) == PA_RUN_DELAY, "Correct delay");
+	sput_fail_unless(fu_next() == &core.quiesce_to, "Quiescence is next");
+	fu_loop(1);
+	sput_fail_unless(quiescent_ctr == 1, "Quiescent called");
+	sput_fail_if(core.changed, "Change flag reset");
+
+	//Routines without any change
+	pa_core_set_node_id(&core, &id);
+	sput_fail_if(core.quiesce_to.pending, "No quiescence pending");
+	fu_loop(1);
+	sput_fail_if(core.quiesce_to.pending, "No quiescence pending");
+
+	//Changes while routines are pending
+	pa_rule_del(&core, &s1.rule);
+	check_ldp_flags(ldp, 1, 0, 0, 0);
+	sput_fail_unless(core.changed, "Changed");
+	sput_fail_if(core.quiesce_to.pending, "Routine pending");
+	fu_loop(1); //Routine
+	sput_fail_unless(core.quiesce_to.pending, "Quiescence pending");
+	pa_core_set_node_id(&core, &id0);
+	sput_fail_if(core.quiesce_to.pending, "Quiescence cancelled by routine");
+	fu_loop(1); //Routine
+	sput_fail_unless(fu_next() == &core.quiesce_to, "Quiescence is next");
+	fu_loop(1);
+	sput_fail_unless(quiescent_ctr == 2, "Quiescent called once");
+
+	pa_user_unregister(&quser);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	fr_mask_random = 0;
+}
+
+static struct pa_event batch_events[2*PA_USER_BATCH_SIZE];
+static size_t batch_n = 0;
+static int batch_ctr = 0;
+static void user_batch(__unused struct pa_user *user, const struct pa_event *events, size_t n) {
+	TEST_DEBUG("Called user_batch with %zu events", n);
+	memcpy(&batch_events[batch_n], events, n * sizeof(*events));
+	batch_n += n;
+	batch_ctr++;
+}
+
+#define check_event(e, l, t, v) \
+		sput_fail_unless((e)->ldp == l, "Correct event ldp"); \
+		sput_fail_unless((e)->type == t, "Correct event type"); \
+		sput_fail_unless((e)->value == v, "Correct event value");
+
+void pa_core_batch() {
+	fu_init();
+	fr_mask_random = 1;
+	struct pa_core core;
+	struct pa_rule_static s1;
+	struct pa_user buser = {.batch = user_batch};
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	pa_user_register(&core, &buser);
+
+	pa_rule_static_init(&s1);
+	s1.rule.name = "static rule";
+	s1.override_priority = 3;
+	s1.override_rule_priority = 0;
+	s1.priority = 3;
+	s1.rule_priority = 3;
+	s1.safety = 0;
+	pa_prefix_cpy(&advp1_01.prefix, advp1_01.plen, &s1.prefix, s1.plen);
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &s1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+
+	fr_random_push(0);
+	fu_loop(1); //Routine starts backoff
+	fu_loop(1); //Backoff timeout
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	sput_fail_unless(core.events_n == 2, "Two buffered events");
+	sput_fail_unless(batch_ctr == 0, "Not delivered yet");
+	sput_fail_unless(fu_next() == &core.batch_to, "Batch is next");
+	fu_loop(1);
+	sput_fail_unless(batch_ctr == 1, "Single batch");
+	sput_fail_unless(batch_n == 2, "Two events");
+	check_event(&batch_events[0], ldp, PA_EVENT_ASSIGNED, 1);
+	check_event(&batch_events[1], ldp, PA_EVENT_PUBLISHED, 1);
+	sput_fail_unless(pa_prefix_equals(&batch_events[0].prefix, batch_events[0].plen, &s1.prefix, s1.plen), "Correct event prefix");
+	sput_fail_unless(batch_events[1].priority == 3, "Correct event priority");
+
+	fu_loop(1); //Apply
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	fu_loop(1);
+	sput_fail_unless(batch_ctr == 2, "Second batch");
+	check_event(&batch_events[2], ldp, PA_EVENT_APPLIED, 1);
+
+	//Events are delivered before the ldp is destroyed
+	pa_link_del(&l1);
+	sput_fail_unless(batch_ctr == 3, "Delivered on destroy");
+	sput_fail_unless(batch_n == 6, "Three events");
+	check_event(&batch_events[3], ldp, PA_EVENT_APPLIED, 0);
+	check_event(&batch_events[4], ldp, PA_EVENT_PUBLISHED, 0);
+	check_event(&batch_events[5], ldp, PA_EVENT_ASSIGNED, 0);
+	sput_fail_if(core.batch_to.pending, "No batch pending");
+
+	pa_rule_del(&core, &s1.rule);
+	pa_user_unregister(&buser);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	fr_mask_random = 0;
+}
+
+static int republished_ctr = 0;
+static void user_republished(__unused struct pa_user *user, __unused struct pa_ldp *ldp) {
+	TEST_DEBUG("Called user_republished");
+	republished_ctr++;
+}
+
+/* A user unregistering and freeing itself when notified. */
+static void user_republished_free(struct pa_user *user, __unused struct pa_ldp *ldp) {
+	republished_ctr++;
+	pa_user_unregister(user);
+	free(user);
+}
+
+void pa_core_republish() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT}, r2 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_user ruser = {.republished = user_republished};
+	struct pa_user *fuser;
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	pa_user_register(&core, &ruser);
+	pa_user_register(&core, &tuser.user);
+
+	r1.filter_accept = 1;
+	r1.priority = 3;
+	r1.target = PA_RULE_PUBLISH;
+	r1.arg.priority = 3;
+	r1.arg.rule_priority = 3;
+	pa_prefix_cpy(&advp1_01.prefix, advp1_01.plen, &r1.arg.prefix, r1.arg.plen);
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &r1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+
+	fu_loop(1); //Routine publishes
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	check_ldp_publish(ldp, &r1.rule, 3, 3);
+	check_user(&tuser, ldp, ldp, NULL);
+	fu_loop(1); //Apply
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, NULL, NULL, ldp);
+	sput_fail_unless(republished_ctr == 0, "Not republished");
+	fuser = calloc(1, sizeof(*fuser));
+	fuser->republished = user_republished_free;
+	pa_user_register(&core, fuser);
+
+	//Same prefix published by a higher priority rule is a single update
+	r2.filter_accept = 1;
+	r2.priority = 4;
+	r2.target = PA_RULE_PUBLISH;
+	r2.arg = r1.arg;
+	r2.arg.priority = 4;
+	r2.arg.rule_priority = 4;
+	pa_rule_add(&core, &r2.rule);
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_ldp_publish(ldp, &r2.rule, 4, 4);
+	check_user(&tuser, NULL, ldp, NULL);
+	sput_fail_unless(republished_ctr == 2, "Republished once to each user");
+
+	pa_user_unregister(&ruser);
+	pa_user_unregister(&tuser.user);
+	pa_rule_del(&core, &r1.rule);
+	pa_rule_del(&core, &r2.rule);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_core_slab() {
+	fu_init();
+	struct pa_core core;
+	struct pa_ldp_slab *slab;
+	struct pa_ldp *ldp1, *ldp2;
+
+	pa_core_init(&core);
+	sput_fail_unless(list_empty(&core.ldp_slabs), "No slab");
+
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_dp_add(&core, &d1);
+	pa_dp_add(&core, &d2);
+	sput_fail_unless(core.ldp_slabs.next->next == &core.ldp_slabs, "Single slab");
+	slab = list_first_entry(&core.ldp_slabs, struct pa_ldp_slab, le);
+	sput_fail_unless(slab->used == 4, "Four ldps");
+	ldp1 = list_entry(l1.ldps.next, struct pa_ldp, in_link);
+	ldp2 = list_entry(l1.ldps.prev, struct pa_ldp, in_link);
+	sput_fail_unless(pa_ldp_slab(ldp1) == slab && pa_ldp_slab(ldp2) == slab, "Correct slab");
+
+	//Released ldps are reused
+	pa_link_del(&l1);
+	sput_fail_unless(slab->used == 2, "Two ldps");
+	pa_link_add(&core, &l1);
+	sput_fail_unless(slab->used == 4, "Four ldps");
+	sput_fail_unless(slab->fresh == 4, "Released ldps reused");
+	sput_fail_unless(list_empty(&slab->free), "No free ldp");
+	ldp1 = list_entry(l1.ldps.next, struct pa_ldp, in_link);
+	sput_fail_unless(ldp1->assigned == 0 && ldp1->userdata[0] == NULL, "Reused ldp is cleared");
+
+	//Empty slabs are released
+	pa_link_del(&l1);
+	pa_link_del(&l2);
+	sput_fail_unless(list_empty(&core.ldp_slabs), "No slab");
+	pa_dp_del(&d1);
+	pa_dp_del(&d2);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_core_lazy() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_filter_ldp fb;
+
+	pa_core_init(&core);
+	pa_core_set_lazy_ldps(&core, 1);
+	pa_filter_ldp_init(&fb, &l1, NULL);
+	pa_rule_set_filter(&r1.rule, &fb.filter);
+	r1.priority = 1;
+	r1.target = PA_RULE_NO_MATCH;
+	pa_rule_add(&core, &r1.rule);
+
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_dp_add(&core, &d1);
+	sput_fail_if(list_empty(&l1.ldps), "Pair accepted by the filter");
+	sput_fail_unless(list_empty(&l2.ldps), "No pair for filtered link");
+	sput_fail_unless(pa_core_pending_routines(&core) == 1, "Single routine");
+	fu_loop(1);
+	sput_fail_if(list_empty(&l1.ldps), "Pair kept");
+
+	//On-link Advertised Prefix
+	advp1_01.link = &l2;
+	advp1_01.priority = 2;
+	advp1_01.node_id[0] = id2;
+	pa_advp_add(&core, &advp1_01);
+	sput_fail_if(list_empty(&l2.ldps), "Pair for on-link Advertised Prefix");
+	fu_loop(2);
+	sput_fail_if(list_empty(&l2.ldps), "Pair kept");
+
+	pa_advp_del(&core, &advp1_01);
+	fu_loop(2);
+	sput_fail_unless(list_empty(&l2.ldps), "Idle pair reclaimed");
+	sput_fail_if(list_empty(&l1.ldps), "Pair kept");
+
+	//Disabling lazy mode creates all pairs
+	pa_core_set_lazy_ldps(&core, 0);
+	sput_fail_if(list_empty(&l2.ldps), "All pairs exist");
+	fu_loop(2);
+	sput_fail_if(list_empty(&l2.ldps), "All pairs are kept");
+	pa_core_set_lazy_ldps(&core, 1);
+	fu_loop(2);
+	sput_fail_unless(list_empty(&l2.ldps), "Idle pair reclaimed");
+
+	//New rule creates pairs
+	pa_rule_unset_filter(&r1.rule);
+	pa_rule_del(&core, &r1.rule);
+	pa_rule_add(&core, &r1.rule);
+	sput_fail_if(list_empty(&l2.ldps), "Pair accepted by new rule");
+
+	pa_rule_del(&core, &r1.rule);
+	fu_loop(2);
+	sput_fail_unless(list_empty(&l1.ldps), "Idle pair reclaimed");
+	sput_fail_unless(list_empty(&l2.ldps), "Idle pair reclaimed");
+
+	pa_link_del(&l1);
+	pa_link_del(&l2);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	advp1_01.link = NULL;
+}
+
+void pa_core_config() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT},
+			r2 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_filter_ldp fb;
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	r1.filter_accept = 1;
+	r2.filter_accept = 1;
+
+	pa_core_config_begin(&core);
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_core_config_begin(&core); //Nested
+	pa_link_add(&core, &l2);
+	pa_rule_add(&core, &r1.rule);
+	pa_core_config_commit(&core);
+	pa_dp_add(&core, &d2);
+	pa_rule_add(&core, &r2.rule);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	sput_fail_unless(pa_core_pending_routines(&core) == 0, "No pending routine");
+	pa_core_config_commit(&core);
+	sput_fail_unless(pa_core_pending_routines(&core) == 4, "One routine per pair");
+	pa_for_each_ldp_in_link(&l1, ldp)
+		sput_fail_unless(pa_ldp_routine_pending(ldp) && !ldp->config_sched, "Pair scheduled");
+	pa_for_each_ldp_in_link(&l2, ldp)
+		sput_fail_unless(pa_ldp_routine_pending(ldp) && !ldp->config_sched, "Pair scheduled");
+	fu_loop(4);
+	cr_check_ctr(&r1, 4, 4, 0);
+	cr_check_ctr(&r2, 4, 4, 0);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	//Unbalanced commit is ignored
+	pa_core_config_commit(&core);
+	sput_fail_unless(core.config_depth == 0, "No transaction");
+
+	pa_rule_del(&core, &r1.rule);
+	pa_rule_del(&core, &r2.rule);
+	pa_link_del(&l1);
+	pa_link_del(&l2);
+	pa_dp_del(&d1);
+	pa_dp_del(&d2);
+
+	//Lazy pairs are created when committing
+	pa_core_set_lazy_ldps(&core, 1);
+	pa_filter_ldp_init(&fb, &l1, NULL);
+	pa_rule_set_filter(&r1.rule, &fb.filter);
+	pa_core_config_begin(&core);
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_dp_add(&core, &d1);
+	pa_dp_add(&core, &d2);
+	pa_rule_add(&core, &r1.rule);
+	sput_fail_unless(list_empty(&l1.ldps), "No pair in transaction");
+	pa_core_config_commit(&core);
+	sput_fail_if(list_empty(&l1.ldps), "Pairs for L1");
+	sput_fail_unless(list_empty(&l2.ldps), "No pair for L2");
+	sput_fail_unless(pa_core_pending_routines(&core) == 2, "One routine per pair");
+
+	pa_rule_del(&core, &r1.rule);
+	pa_link_del(&l1);
+	pa_link_del(&l2);
+	pa_dp_del(&d1);
+	pa_dp_del(&d2);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_core_terminate() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT}, r2 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_filter_ldp f1, f2;
+	struct pa_user buser = {.batch = user_batch};
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	pa_user_register(&core, &buser);
+
+	r1.filter_accept = 1;
+	r1.priority = 3;
+	r1.target = PA_RULE_PUBLISH;
+	r1.arg.priority = 3;
+	r1.arg.rule_priority = 3;
+	r2 = r1;
+	pa_prefix_cpy(&advp1_01.prefix, advp1_01.plen, &r1.arg.prefix, r1.arg.plen);
+	pa_prefix_cpy(&advp2_01.prefix, advp2_01.plen, &r2.arg.prefix, r2.arg.plen);
+	pa_filter_ldp_init(&f1, &l1, &d1);
+	pa_filter_ldp_init(&f2, &l1, &d2);
+	pa_rule_set_filter(&r1.rule, &f1.filter);
+	pa_rule_set_filter(&r2.rule, &f2.filter);
+
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_dp_add(&core, &d1);
+	pa_dp_add(&core, &d2);
+	pa_rule_add(&core, &r1.rule);
+	pa_rule_add(&core, &r2.rule);
+	fu_loop(4);
+	pa_for_each_ldp_in_link(&l1, ldp)
+		sput_fail_unless(ldp->assigned, "L1 pair assigned");
+
+	//Removing a link in a transaction schedules siblings when committing
+	pa_core_config_begin(&core);
+	pa_link_del(&l1);
+	sput_fail_unless(pa_core_pending_routines(&core) == 0, "No pending routine");
+	sput_fail_unless(d1.config_sched && d2.config_sched, "Siblings scheduled at commit");
+	pa_core_config_commit(&core);
+	sput_fail_if(d1.config_sched || d2.config_sched, "Commit done");
+	sput_fail_unless(pa_core_pending_routines(&core) == 2, "Siblings scheduled");
+	pa_link_add(&core, &l1);
+	fu_loop(4);
+	pa_for_each_ldp_in_link(&l1, ldp)
+		sput_fail_unless(ldp->assigned, "L1 pair assigned");
+
+	//Termination
+	batch_n = 0;
+	batch_ctr = 0;
+	pa_core_term(&core);
+	sput_fail_unless(batch_ctr == 1, "Single batch");
+	sput_fail_unless(list_empty(&core.links), "No link");
+	sput_fail_unless(list_empty(&core.dps), "No dp");
+	sput_fail_unless(list_empty(&core.rules), "No rule");
+	sput_fail_unless(list_empty(&l1.ldps) && list_empty(&l2.ldps), "No pair");
+	sput_fail_unless(list_empty(&d1.ldps) && list_empty(&d2.ldps), "No pair");
+#if PA_LDP_SLAB_SIZE != 0
+	sput_fail_unless(list_empty(&core.ldp_slabs), "No slab");
+#endif
+	sput_fail_unless(pa_core_pending_routines(&core) == 0, "No pending routine");
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	pa_user_unregister(&buser);
+}
+
+#define TEST_BULK_LINKS 40
+
+void pa_core_bulk() {
+	fu_init();
+	struct pa_core core;
+	struct pa_user buser = {.batch = user_batch};
+	struct pa_link links[TEST_BULK_LINKS], *lp[TEST_BULK_LINKS];
+	struct pa_advp advps[TEST_BULK_LINKS];
+	struct pa_dp *dps[] = {&d2};
+	struct pa_ldp *ldp;
+	int i;
+
+	pa_core_init(&core);
+	pa_user_register(&core, &buser);
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_dp_add(&core, &d2);
+	for(i = 0; i < TEST_BULK_LINKS; i++) {
+		memset(&links[i], 0, sizeof(links[i]));
+		links[i].name = "bulk";
+		lp[i] = &links[i];
+		pa_link_add(&core, &links[i]);
+
+		memset(&advps[i], 0, sizeof(advps[i]));
+		pa_prefix_cpy(&d1.prefix, d1.plen, &advps[i].prefix, advps[i].plen);
+		advps[i].prefix.s6_addr[7] = i + 1;
+		advps[i].plen = 64;
+		advps[i].link = &links[i];
+		advps[i].priority = 2;
+		memcpy(advps[i].node_id, &id2, PA_NODE_ID_LEN);
+		pa_advp_add(&core, &advps[i]);
+	}
+	fu_loop(-1);
+	pa_for_each_ldp_in_dp(&d1, ldp)
+		sput_fail_unless(ldp->link == &l1 || ldp->applied, "Pair applied");
+
+	//More unassign events than PA_USER_BATCH_SIZE are delivered at once
+	batch_n = 0;
+	batch_ctr = 0;
+	pa_core_bulk_del(&core, dps, 1, lp, TEST_BULK_LINKS);
+	sput_fail_unless(batch_ctr == 1, "Single batch");
+	sput_fail_unless(batch_n == 2 * TEST_BULK_LINKS, "Unassign events");
+	check_event(&batch_events[0], batch_events[0].ldp, PA_EVENT_APPLIED, 0);
+	check_event(&batch_events[1], batch_events[0].ldp, PA_EVENT_ASSIGNED, 0);
+	sput_fail_unless(core.events_buf == core.events, "Reserved buffer released");
+	sput_fail_unless(core.links.next == &l1.le && core.links.prev == &l1.le, "Single link left");
+	sput_fail_unless(core.dps.next == &d1.le && core.dps.prev == &d1.le, "Single dp left");
+	sput_fail_unless(d1.ldps.next == d1.ldps.prev, "Single pair left");
+	sput_fail_unless(list_empty(&d2.ldps), "No pair");
+	sput_fail_if(d1.config_sched || core.config_depth, "Transaction committed");
+
+	for(i = 0; i < TEST_BULK_LINKS; i++)
+		pa_advp_del(&core, &advps[i]);
+	fu_loop(-1);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	pa_user_unregister(&buser);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+#define test_advp(name, b7, pl, l) \
+		struct pa_advp name = {.plen = pl, .link = l, \
+				.prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x03, b7}}}}; \
+		memcpy(name.node_id, &id2, PA_NODE_ID_LEN)
+
+void pa_core_waiters() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_filter_ldp f1;
+	struct pa_dp d3 = {.plen = 60, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x03}}}};
+	struct pa_link la = {.name = "LA"}, lb = {.name = "LB"};
+	struct pa_ldp *ldp, *ldp2, *ldpa, *ldpb;
+	test_advp(r1_64, 0x01, 64, NULL);
+	test_advp(r2_63, 0x02, 63, NULL);
+	test_advp(r4_62, 0x04, 62, NULL);
+	test_advp(r5_64, 0x05, 64, NULL);
+	test_advp(r8_61, 0x08, 61, NULL);
+	test_advp(a4_62, 0x04, 62, &la);
+	test_advp(b1_64, 0x01, 64, &lb);
+	test_advp(c2_63, 0x02, 63, &l2);
+
+	pa_core_init(&core);
+	r1.filter_accept = 1;
+	r1.priority = 3;
+	r1.target = PA_RULE_PUBLISH;
+	r1.arg.priority = 3;
+	r1.arg.rule_priority = 3;
+	r1.arg.prefix = d3.prefix;
+	r1.arg.plen = 64;
+	pa_filter_ldp_init(&f1, &l1, NULL);
+	pa_rule_set_filter(&r1.rule, &f1.filter);
+
+	//L1 gets the only available /64
+	pa_dp_add(&core, &d3);
+	pa_advp_add(&core, &r1_64);
+	pa_advp_add(&core, &r2_63);
+	pa_advp_add(&core, &r4_62);
+	pa_advp_add(&core, &r8_61);
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_link_add(&core, &la);
+	pa_link_add(&core, &lb);
+	pa_rule_add(&core, &r1.rule);
+	fu_loop(4);
+	fu_loop(1); //Apply
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	ldp = list_entry(l1.ldps.next, struct pa_ldp, in_link);
+	ldp2 = list_entry(l2.ldps.next, struct pa_ldp, in_link);
+	ldpa = list_entry(la.ldps.next, struct pa_ldp, in_link);
+	ldpb = list_entry(lb.ldps.next, struct pa_ldp, in_link);
+	sput_fail_unless(ldp->assigned && !ldp->waiting, "L1 assigned");
+	sput_fail_unless(ldp2->waiting && ldpa->waiting && ldpb->waiting, "Others are waiting");
+	sput_fail_unless(d3.waiters.next == &ldp2->sched->in_waiters, "L2 is first");
+
+	//A released /64 only wakes the first waiter up
+	pa_link_del(&l1);
+	sput_fail_unless(pa_core_pending_routines(&core) == 1, "Single routine");
+	sput_fail_unless(pa_ldp_routine_pending(ldp2) && !ldp2->waiting, "L2 woken up");
+	sput_fail_unless(ldpa->waiting && ldpb->waiting, "Others keep waiting");
+	fu_loop(1);
+	sput_fail_unless(ldp2->waiting, "L2 waits again");
+	sput_fail_unless(d3.waiters.prev == &ldp2->sched->in_waiters, "L2 is last");
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	//Neighbors give a /63 to L2, a /62 to LA and a /64 to LB
+	pa_core_config_begin(&core);
+	pa_advp_del(&core, &r1_64);
+	pa_advp_del(&core, &r2_63);
+	pa_advp_del(&core, &r4_62);
+	pa_advp_add(&core, &c2_63);
+	pa_advp_add(&core, &a4_62);
+	pa_advp_add(&core, &b1_64);
+	pa_core_config_commit(&core);
+	pa_link_add(&core, &l1);
+	while(fu_next())
+		fu_loop(1);
+	ldp = list_entry(l1.ldps.next, struct pa_ldp, in_link);
+	sput_fail_unless(ldp->assigned && ldp2->assigned && ldpa->assigned && ldpb->assigned, "All assigned");
+
+	//Neighbors go away, and part of the /62 is taken by another node
+	pa_advp_del(&core, &c2_63);
+	pa_advp_del(&core, &a4_62);
+	pa_advp_del(&core, &b1_64);
+	pa_advp_add(&core, &r5_64);
+	while(fu_next())
+		fu_loop(1);
+	sput_fail_unless(ldp2->waiting && ldp2->plen == 63, "L2 waits for a /63");
+	sput_fail_unless(ldpa->waiting && ldpa->plen == 62, "LA waits for a /62");
+	sput_fail_unless(ldpb->waiting && ldpb->plen == 64, "LB waits for a /64");
+	sput_fail_unless(pa_core_pending_routines(&core) == 0, "No pending routine");
+
+	//The released /64 merges with free space into a /62
+	pa_link_del(&l1);
+	sput_fail_unless(pa_core_pending_routines(&core) == 3, "Three routines");
+	sput_fail_unless(pa_ldp_routine_pending(ldpa), "/62 waiter woken up");
+	sput_fail_unless(pa_ldp_routine_pending(ldp2) && pa_ldp_routine_pending(ldpb),
+			"Remaining space is enough for other waiters");
+	while(fu_next())
+		fu_loop(1);
+
+	pa_rule_del(&core, &r1.rule);
+	pa_link_del(&l2);
+	pa_link_del(&la);
+	pa_link_del(&lb);
+	pa_advp_del(&core, &r5_64);
+	pa_advp_del(&core, &r8_61);
+	pa_dp_del(&d3);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_core_dp_update() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_ldp *ldp, ha_ldp = {.link = &l2, .dp = &d2},
+			ha_ldp2 = {.link = &l1, .dp = &d2};
+
+	pa_core_init(&core);
+	pa_user_register(&core, &tuser.user);
+	r1.filter_accept = 1;
+	r1.priority = 3;
+	r1.target = PA_RULE_PUBLISH;
+	r1.arg.priority = 3;
+	r1.arg.rule_priority = 3;
+	pa_prefix_cpy(&advp1_01.prefix, advp1_01.plen, &r1.arg.prefix, r1.arg.plen);
+
+	d1.ha_ldp = &ha_ldp;
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &r1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+	fu_loop(1); //Publish
+	check_user(&tuser, ldp, ldp, NULL);
+	fu_loop(1); //Apply must wait for the higher-level prefix
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	sput_fail_unless(ldp->ha_apply_pending, "Apply pending");
+
+	//Higher-level prefix change
+	ha_ldp.applied = 1;
+	pa_dp_update(&core, &d1);
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, NULL, NULL, ldp);
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine scheduled");
+	fu_loop(1);
+
+	//Attribute change keeps the pair and its applied prefix
+	d1.ha_ldp = NULL;
+	d1.type = 1;
+	pa_dp_update(&core, &d1);
+	sput_fail_unless(ldp == list_entry(d1.ldps.next, struct pa_ldp, in_dp), "Same pair");
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine scheduled");
+	sput_fail_if(pa_ldp_backoff_pending(ldp), "No apply timer");
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, NULL, NULL, NULL);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	//New higher-level prefix is not applied yet
+	d1.ha_ldp = &ha_ldp;
+	ha_ldp.applied = 0;
+	pa_dp_update(&core, &d1);
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	check_user(&tuser, NULL, NULL, ldp);
+	sput_fail_unless(ldp->ha_apply_pending, "Apply pending");
+	ha_ldp.applied = 1;
+	pa_dp_update(&core, &d1);
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, NULL, NULL, ldp);
+	fu_loop(1);
+
+	//Higher-level pair on another link than the link parent
+	l1.ha_parent = &l2;
+	ha_ldp2.applied = 1;
+	d1.ha_ldp = &ha_ldp2;
+	pa_dp_update(&core, &d1);
+	sput_fail_unless(list_empty(&d1.ldps) && list_empty(&l1.ldps), "Pair destroyed");
+	check_user(&tuser, ldp, ldp, ldp);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	//Back to the parent link
+	d1.ha_ldp = &ha_ldp;
+	pa_dp_update(&core, &d1);
+	sput_fail_if(list_empty(&d1.ldps), "Pair created");
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+	sput_fail_unless(ldp->link == &l1 && pa_ldp_routine_pending(ldp), "Routine scheduled");
+	fu_loop(2); //Publish, then apply
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, ldp, ldp, ldp);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	l1.ha_parent = NULL;
+	d1.ha_ldp = NULL;
+
+	d1.type = PA_DP_TYPE_NONE;
+	pa_user_unregister(&tuser.user);
+	pa_rule_del(&core, &r1.rule);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_core_suspend() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	pa_user_register(&core, &tuser.user);
+	r1.filter_accept = 1;
+	r1.priority = 3;
+	r1.target = PA_RULE_PUBLISH;
+	r1.arg.priority = 3;
+	r1.arg.rule_priority = 3;
+	pa_prefix_cpy(&advp1_01.prefix, advp1_01.plen, &r1.arg.prefix, r1.arg.plen);
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &r1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+
+	//Suspended before the prefix is applied
+	fu_loop(1); //Publish
+	check_user(&tuser, ldp, ldp, NULL);
+	pa_link_suspend(&l1, 0);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	pa_dp_update(&core, &d1);
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Conflict check while suspended");
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	pa_link_resume(&l1);
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Routine scheduled");
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timer started again");
+	fu_loop(1); //Routine
+	fu_loop(1); //Apply
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, NULL, NULL, ldp);
+
+	//Short flap
+	pa_link_suspend(&l1, 5000);
+	sput_fail_unless(fu_next() == &l1.suspend_to, "Grace timer");
+	pa_link_resume(&l1);
+	sput_fail_if(l1.suspend_to.pending, "Grace timer cancelled");
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, NULL, NULL, NULL);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	//Grace period expiration
+	pa_link_suspend(&l1, 5000);
+	fu_loop(1);
+	check_ldp_flags(ldp, 0, 0, 0, 0);
+	check_user(&tuser, ldp, ldp, ldp);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	pa_link_resume(&l1);
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+
+	//Conflict while suspended without grace period
+	pa_link_suspend(&l1, 0);
+	advp1_01.link = NULL;
+	advp1_01.priority = 5;
+	advp1_01.node_id[0] = id2;
+	pa_advp_add(&core, &advp1_01);
+	sput_fail_unless(pa_ldp_routine_pending(ldp), "Conflict check scheduled");
+	fu_loop(1);
+	check_ldp_flags(ldp, 0, 0, 0, 0);
+	check_user(&tuser, ldp, ldp, NULL);
+	sput_fail_if(ldp->sched, "No scheduling state");
+	pa_advp_del(&core, &advp1_01);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	pa_link_resume(&l1);
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+
+	//Adopting rule removed while suspended
+	advp1_01.link = &l1;
+	pa_advp_add(&core, &advp1_01);
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 0, 0, 0);
+	r1.target = PA_RULE_ADOPT;
+	pa_advp_del(&core, &advp1_01);
+	fr_random_push(10);
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 0, 0, 1);
+	pa_link_suspend(&l1, 0);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	pa_rule_del(&core, &r1.rule);
+	check_ldp_flags(ldp, 1, 0, 0, 0);
+	sput_fail_if(pa_ldp_backoff_pending(ldp), "No apply timer while suspended");
+	fu_loop(1);
+	check_ldp_flags(ldp, 1, 0, 0, 0);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	pa_link_resume(&l1);
+	sput_fail_unless(pa_ldp_backoff_pending(ldp), "Apply timer started again");
+
+	pa_link_suspend(&l1, 5000);
+	pa_user_unregister(&tuser.user);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_core_synced() {
+	fu_init();
+	struct pa_core core;
+	struct test_rule r1 = {.rule = CUSTOM_RULE_INIT};
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	pa_user_register(&core, &tuser.user);
+	r1.filter_accept = 1;
+	r1.priority = 3;
+	r1.target = PA_RULE_PUBLISH;
+	r1.arg.priority = 3;
+	r1.arg.rule_priority = 3;
+	pa_prefix_cpy(&advp1_01.prefix, advp1_01.plen, &r1.arg.prefix, r1.arg.plen);
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &r1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+	fu_loop(1); //Publish
+	check_user(&tuser, ldp, ldp, NULL);
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == 2*(int)core.flooding_delay, "Apply timer");
+
+	//Other prefix
+	pa_core_flooding_synced(&core, &d2.prefix, d2.plen, 0);
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+
+	//Shortened apply delay
+	pa_core_flooding_synced(&core, &d1.prefix, d1.plen, 100);
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == 100, "Shorter apply timer");
+	pa_core_flooding_synced(&core, &d1.prefix, d1.plen, 200);
+	sput_fail_unless(uloop_timeout_remaining(&ldp->sched->backoff_to) == 100, "Timer not extended");
+
+	//Immediate apply
+	pa_core_flooding_synced(&core, &d1.prefix, 0, 0);
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	check_user(&tuser, NULL, NULL, ldp);
+	sput_fail_if(pa_ldp_backoff_pending(ldp), "No apply timer");
+
+	pa_user_unregister(&tuser.user);
+	pa_rule_del(&core, &r1.rule);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_core_stats() {
+	fu_init();
+	fr_mask_random = 1;
+	struct pa_core core;
+	struct pa_core_stats stats;
+	struct pa_rule_static s1;
+	struct pa_ldp *ldp;
+
+	pa_core_init(&core);
+	pa_core_get_stats(&core, &stats);
+	sput_fail_if(stats.routines || stats.timers || stats.assign, "Counters initialized");
+
+	pa_rule_static_init(&s1);
+	s1.rule.name = "static rule";
+	s1.override_priority = 3;
+	s1.override_rule_priority = 0;
+	s1.priority = 3;
+	s1.rule_priority = 3;
+	s1.safety = 1;
+	pa_prefix_cpy(&advp1_02.prefix, advp1_02.plen, &s1.prefix, s1.plen);
+
+	advp1_02.link = NULL;
+	advp1_02.priority = 2;
+	advp1_02.node_id[0] = id2;
+	pa_advp_add(&core, &advp1_02);
+
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &s1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+
+	fr_random_push(0);
+	fu_loop(1); //get_max_priority, then match returns backoff
+	pa_core_get_stats(&core, &stats);
+	sput_fail_unless(stats.routines == 1, "One routine");
+	sput_fail_unless(stats.routines_backoff == 0, "No backoff routine");
+	sput_fail_unless(stats.rule_filter == 0, "No filter");
+	sput_fail_unless(stats.rule_max_priority == 1, "One get_max_priority call");
+	sput_fail_unless(stats.rule_match == 1, "One match call");
+	sput_fail_unless(stats.updown_walks >= 2, "Prefix tree walks");
+	sput_fail_unless(stats.updown_elements >= 1, "Advertised Prefix visited");
+	sput_fail_unless(stats.timers >= 2, "Routine and backoff timers");
+	sput_fail_unless(stats.advp_add == 1, "One Advertised Prefix added");
+
+	fu_loop(-1); //Backoff timeout, then apply
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	pa_core_get_stats(&core, &stats);
+	sput_fail_unless(stats.routines_backoff == 1, "One backoff routine");
+	sput_fail_unless(stats.assign == 1, "One assignment");
+	sput_fail_unless(stats.publish == 1, "One publication");
+	sput_fail_unless(stats.apply == 1, "One application");
+	sput_fail_unless(stats.unassign == 0, "No removal");
+
+	pa_advp_update(&core, &advp1_02);
+	pa_advp_del(&core, &advp1_02);
+	pa_rule_del(&core, &s1.rule);
+	pa_dp_del(&d1);
+	pa_core_get_stats(&core, &stats);
+	sput_fail_unless(stats.advp_update == 1, "One Advertised Prefix updated");
+	sput_fail_unless(stats.advp_del == 1, "One Advertised Prefix removed");
+	sput_fail_unless(stats.unassign == 1, "One removal");
+
+	pa_core_reset_stats(&core);
+	pa_core_get_stats(&core, &stats);
+	sput_fail_if(stats.routines || stats.timers || stats.unassign || stats.advp_del, "Counters reset");
+
+	pa_link_del(&l1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	fr_mask_random = 0;
+}
+
+/* Runs the next timer with the clock set to the fake uloop time. */
+static void test_clock_step() {
+	test_clock_us = (uint64_t)_to_time(&fu_next()->time) * 1000;
+	fu_loop(1);
+}
+
+void pa_core_timelines() {
+	fu_init();
+	fr_mask_random = 1;
+	struct pa_core core;
+	struct pa_rule_static s1;
+	const struct pa_histogram *h;
+	struct pa_ldp *ldp;
+	uint64_t created;
+
+	pa_core_init(&core);
+	sput_fail_if(pa_core_timeline(&core, PA_TL_H_CREATED_APPLIED)->count, "Empty histogram");
+	sput_fail_if(pa_histogram_percentile(pa_core_timeline(&core, PA_TL_H_CREATED_APPLIED), 50), "Empty percentile");
+
+	pa_rule_static_init(&s1);
+	s1.rule.name = "static rule";
+	s1.override_priority = 3;
+	s1.override_rule_priority = 0;
+	s1.priority = 3;
+	s1.rule_priority = 3;
+	s1.safety = 1;
+	pa_prefix_cpy(&advp1_02.prefix, advp1_02.plen, &s1.prefix, s1.plen);
+
+	advp1_02.link = NULL;
+	advp1_02.priority = 2;
+	advp1_02.node_id[0] = id2;
+	pa_advp_add(&core, &advp1_02);
+
+	test_clock_us = (uint64_t)_fu_time * 1000;
+	created = test_clock_us;
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &s1.rule);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+	sput_fail_unless(ldp->timeline_set == (1 << PA_TL_CREATED), "Created");
+	sput_fail_unless(ldp->timeline[PA_TL_CREATED] == created, "Creation time");
+
+	fr_random_push(0);
+	test_clock_step(); //Routine starts backoff
+	sput_fail_unless(ldp->timeline[PA_TL_ROUTINE] == created + PA_RUN_DELAY * 1000, "First routine time");
+	sput_fail_unless(ldp->timeline_set & (1 << PA_TL_BACKOFF), "Backoff started");
+
+	test_clock_step(); //Backoff timeout
+	check_ldp_flags(ldp, 1, 1, 0, 0);
+	sput_fail_unless(ldp->timeline[PA_TL_ROUTINE] == created + PA_RUN_DELAY * 1000, "First routine time kept");
+	sput_fail_unless(ldp->timeline[PA_TL_ASSIGNED] == ldp->timeline[PA_TL_PUBLISHED], "Published when assigned");
+	h = pa_core_timeline(&core, PA_TL_H_BACKOFF_ASSIGNED);
+	sput_fail_unless(h->count == 1 && h->max == core.adopt_delay, "Backoff latency");
+	h = pa_core_timeline(&core, PA_TL_H_CREATED_ASSIGNED);
+	sput_fail_unless(h->count == 1 && h->max == core.adopt_delay + PA_RUN_DELAY, "Assignment latency");
+
+	test_clock_step(); //Apply timeout
+	check_ldp_flags(ldp, 1, 1, 1, 0);
+	h = pa_core_timeline(&core, PA_TL_H_ASSIGNED_APPLIED);
+	sput_fail_unless(h->count == 1 && h->sum == 2 * core.flooding_delay, "Apply latency");
+	h = pa_core_timeline(&core, PA_TL_H_CREATED_APPLIED);
+	sput_fail_unless(h->count == 1 && h->max == 2 * core.flooding_delay + core.adopt_delay + PA_RUN_DELAY, "Convergence latency");
+	sput_fail_unless(pa_histogram_percentile(h, 50) == h->max, "Percentile bounded by max");
+	sput_fail_if(ldp->timeline_set & (1 << PA_TL_UNASSIGNED), "Not un-assigned");
+
+	pa_rule_del(&core, &s1.rule);
+	pa_advp_del(&core, &advp1_02);
+	pa_dp_del(&d1);
+	pa_link_del(&l1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	pa_core_reset_timeline(&core);
+	sput_fail_if(pa_core_timeline(&core, PA_TL_H_CREATED_APPLIED)->count, "Histogram reset");
+	fr_mask_random = 0;
+}
+
+void pa_core_histogram() {
+	struct pa_histogram h;
+	int i;
+
+	memset(&h, 0, sizeof(h));
+	pa_histogram_add(&h, 0);
+	pa_histogram_add(&h, 1);
+	pa_histogram_add(&h, 3);
+	for(i = 0; i < 7; i++)
+		pa_histogram_add(&h, 100);
+	sput_fail_unless(h.count == 10 && h.sum == 704 && h.max == 100, "Histogram totals");
+	sput_fail_unless(h.buckets[0] == 1 && h.buckets[1] == 1 && h.buckets[2] == 1 && h.buckets[7] == 7, "Histogram buckets");
+	sput_fail_unless(pa_histogram_percentile(&h, 10) == 0, "10th percentile");
+	sput_fail_unless(pa_histogram_percentile(&h, 20) == 1, "20th percentile");
+	sput_fail_unless(pa_histogram_percentile(&h, 30) == 3, "30th percentile");
+	sput_fail_unless(pa_histogram_percentile(&h, 90) == 100, "90th percentile");
+
+	pa_histogram_add(&h, UINT64_MAX);
+	sput_fail_unless(h.buckets[PA_HISTOGRAM_BUCKETS - 1] == 1, "Last bucket");
+	sput_fail_unless(pa_histogram_percentile(&h, 100) == UINT64_MAX, "Largest value");
+}
+
+/* A user blocking the event loop for 50us. */
+static void user_slow(__unused struct pa_user *user, __unused struct pa_ldp *ldp) {
+	test_clock_us += 50;
+}
+
+/* A user unregistering and freeing itself after 20us. */
+static void user_free(struct pa_user *user, __unused struct pa_ldp *ldp) {
+	test_clock_us += 20;
+	pa_user_unregister(user);
+	free(user);
+}
+
+void pa_core_latencies() {
+	fu_init();
+	struct pa_core core;
+	struct pa_user user = {.assigned = user_slow, .applied = user_slow};
+	struct pa_user *fuser;
+	const struct pa_histogram *h;
+	struct pa_ldp *ldp;
+
+	test_clock_us = (uint64_t)_fu_time * 1000;
+	pa_core_init(&core);
+	user.latency.count = 1;
+	pa_user_register(&core, &user);
+	sput_fail_if(user.latency.count, "User histogram reset when registered");
+	sput_fail_if(pa_core_latency(&core, PA_LAT_ROUTINE_LAG)->count, "Empty histogram");
+	fuser = calloc(1, sizeof(*fuser));
+	fuser->assigned = user_free;
+	pa_user_register(&core, fuser);
+
+	advp1_01.link = &l1;
+	advp1_01.priority = 2;
+	advp1_01.node_id[0] = id2;
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_advp_add(&core, &advp1_01);
+	ldp = list_entry(d1.ldps.next, struct pa_ldp, in_dp);
+	sput_fail_unless(ldp->sched->routine_to_due == test_clock_us + PA_RUN_DELAY * 1000, "Routine due time");
+
+	test_clock_us = ldp->sched->routine_to_due + 300;
+	fu_loop(1); //Late routine accepts the Advertised Prefix
+	check_ldp_flags(ldp, 1, 0, 0, 0);
+	h = pa_core_latency(&core, PA_LAT_ROUTINE_LAG);
+	sput_fail_unless(h->count == 1 && h->max == 300, "Routine lag");
+	h = pa_core_latency(&core, PA_LAT_ROUTINE);
+	sput_fail_unless(h->count == 1 && h->max == 70, "Routine duration includes callbacks");
+	h = pa_core_latency(&core, PA_LAT_USER);
+	sput_fail_unless(h->count == 2 && h->sum == 70, "User callback durations");
+	sput_fail_unless(user.latency.count == 1 && user.latency.sum == 50, "Per-user duration");
+
+	test_clock_us = ldp->sched->backoff_to_due + 1000;
+	fu_loop(1); //Late apply timer
+	check_ldp_flags(ldp, 1, 0, 1, 0);
+	h = pa_core_latency(&core, PA_LAT_BACKOFF_LAG);
+	sput_fail_unless(h->count == 1 && h->max == 1000, "Apply timer lag");
+	sput_fail_unless(pa_core_latency(&core, PA_LAT_USER)->count == 3, "Freed user not called");
+	sput_fail_unless(user.latency.count == 2 && user.latency.sum == 100, "Per-user durations");
+
+	pa_core_reset_latency(&core);
+	sput_fail_if(pa_core_latency(&core, PA_LAT_USER)->count, "Core histograms reset");
+	sput_fail_if(user.latency.count, "User histogram reset");
+
+	pa_user_unregister(&user);
+	pa_advp_del(&core, &advp1_01);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+/* A rule match taking 10us. */
+static enum pa_rule_target test_rule_match_slow(struct pa_rule *rule, struct pa_ldp *ldp,
+		pa_rule_priority best_match_priority,
+		struct pa_rule_arg *pa_arg)
+{
+	test_clock_us += 10;
+	return test_rule_match(rule, ldp, best_match_priority, pa_arg);
+}
+
+void pa_core_rule_stats() {
+	fu_init();
+	fr_mask_random = 1;
+	struct pa_core core;
+	struct pa_rule_stats stats;
+	struct test_rule rule1 = {.rule = CUSTOM_RULE_INIT, .filter_accept = 1},
+			rule2 = {.rule = CUSTOM_RULE_INIT, .filter_accept = 0};
+
+	rule1.rule.match = test_rule_match_slow;
+	rule1.priority = 2;
+	rule1.target = PA_RULE_BACKOFF;
+	rule1.arg.rule_priority = 2;
+
+	pa_core_init(&core);
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	rule1.rule._stats.wins = 42;
+	pa_rule_add(&core, &rule1.rule);
+	pa_rule_add(&core, &rule2.rule);
+	pa_rule_get_stats(&rule1.rule, &stats);
+	sput_fail_if(stats.wins, "Counters reset when added");
+
+	fr_random_push(0);
+	fu_loop(1); //Routine
+	cr_check_ctr(&rule1, 1, 1, 1);
+	cr_check_ctr(&rule2, 1, 0, 0);
+	pa_rule_get_stats(&rule1.rule, &stats);
+	sput_fail_unless(stats.filter_calls == 1 && stats.max_priority_calls == 1 &&
+			stats.match_calls == 1, "Rule calls");
+	sput_fail_unless(stats.filter_us == 0 && stats.max_priority_us == 0 &&
+			stats.match_us == 10, "Rule execution time");
+	sput_fail_unless(stats.wins == 1, "Rule won");
+	pa_rule_get_stats(&rule2.rule, &stats);
+	sput_fail_unless(stats.filter_calls == 1 && stats.max_priority_calls == 0 &&
+			stats.match_calls == 0 && stats.wins == 0, "Filtered rule");
+
+	pa_rule_reset_stats(&rule1.rule);
+	pa_rule_get_stats(&rule1.rule, &stats);
+	sput_fail_if(stats.filter_calls || stats.match_us || stats.wins, "Counters reset");
+
+	pa_rule_del(&core, &rule1.rule);
+	pa_rule_del(&core, &rule2.rule);
+	pa_link_del(&l1);
+	pa_dp_del(&d1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	fr_mask_random = 0;
+}
+
 int main() {
 	fu_init();
 	sput_start_testing();
@@ -1089,6 +2386,25 @@ int main() {
 	sput_run_test(pa_core_rule);
 	sput_run_test(pa_core_hierarchical);
 	sput_run_test(pa_core_override);
+	sput_run_test(pa_core_conflicts);
+	sput_run_test(pa_core_budget);
+	sput_run_test(pa_core_quiescent);
+	sput_run_test(pa_core_batch);
+	sput_run_test(pa_core_republish);
+	sput_run_test(pa_core_slab);
+	sput_run_test(pa_core_lazy);
+	sput_run_test(pa_core_config);
+	sput_run_test(pa_core_terminate);
+	sput_run_test(pa_core_bulk);
+	sput_run_test(pa_core_waiters);
+	sput_run_test(pa_core_dp_update);
+	sput_run_test(pa_core_suspend);
+	sput_run_test(pa_core_synced);
+	sput_run_test(pa_core_stats);
+	sput_run_test(pa_core_timelines);
+	sput_run_test(pa_core_histogram);
+	sput_run_test(pa_core_latencies);
+	sput_run_test(pa_core_rule_stats);
 	sput_leave_suite(); /* optional */
 	sput_finish_testing();
 	return sput_get_return_value();
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#define PA_WARNING(format, ...) printf("PA Warning : "format"\n", ##__VA_ARGS__)
+#define PA_INFO(format, ...)    printf("PA Info    : "format"\n", ##__VA_ARGS__)
+#define PA_DEBUG(format, ...)   printf("PA Debug   : "format"\n", ##__VA_ARGS__)
+
+#include "fake_uloop.h"
+
+/* Publication and confirmation times */
+static uint64_t test_clock_us = 0;
+#define pa_clock_us() test_clock_us
+
+#include "pa_core.c"
+#include "pa_fdelay.c"
+
+#include "sput.h"
+
+static struct in6_addr p = {{{0x20, 0x01, 0, 0, 0, 0, 0x01, 0x00}}};
+#define PP(i) (p.s6_addr[7] = i, &p)
+
+void pa_fdelay_estimate_test()
+{
+	struct pa_core core;
+	struct pa_fdelay fdelay;
+	uint32_t i;
+
+	fu_init();
+	pa_core_init(&core);
+	pa_fdelay_init(&fdelay, &core);
+	sput_fail_unless(pa_fdelay_estimate(&fdelay) == 0, "No estimation");
+
+	for(i = 1; i < fdelay.min_samples; i++)
+		pa_fdelay_sample(&fdelay, i * 100);
+	sput_fail_unless(pa_fdelay_estimate(&fdelay) == 0, "Not enough samples");
+	sput_fail_unless(core.flooding_delay == PA_DEFAULT_FLOODING_DELAY, "Default flooding delay");
+
+	pa_fdelay_sample(&fdelay, 500);
+	sput_fail_unless(pa_fdelay_estimate(&fdelay) == 1000, "Twice the highest sample");
+	sput_fail_unless(core.flooding_delay == 1000, "Flooding delay updated");
+
+	//Upper bound
+	pa_fdelay_sample(&fdelay, 100000);
+	sput_fail_unless(core.flooding_delay == PA_DEFAULT_FLOODING_DELAY, "Maximum flooding delay");
+
+	//Percentile ignores outliers once there are enough samples
+	for(i = 0; i < PA_FDELAY_SAMPLES; i++)
+		pa_fdelay_sample(&fdelay, 10);
+	sput_fail_unless(fdelay.samples_n == PA_FDELAY_SAMPLES, "Full sample set");
+	sput_fail_unless(core.flooding_delay == fdelay.min_delay, "Minimum flooding delay");
+	pa_fdelay_sample(&fdelay, 100000);
+	sput_fail_unless(core.flooding_delay == fdelay.min_delay, "Outlier ignored");
+
+	pa_fdelay_term(&fdelay);
+	sput_fail_unless(list_empty(&core.users), "Unregistered");
+}
+
+void pa_fdelay_confirm_test()
+{
+	struct pa_core core;
+	struct pa_fdelay fdelay;
+	struct pa_ldp ldp = {};
+
+	fu_init();
+	pa_core_init(&core);
+	pa_fdelay_init(&fdelay, &core);
+	fdelay.min_samples = 1;
+
+	test_clock_us = 1000000;
+	pa_prefix_cpy(PP(1), 64, &ldp.prefix, ldp.plen);
+	ldp.published = 1;
+	fdelay.user.published(&fdelay.user, &ldp);
+
+	//Unknown prefix
+	pa_fdelay_confirmed(&fdelay, PP(2), 64);
+	sput_fail_unless(fdelay.samples_n == 0, "No sample");
+
+	//Republish keeps the publication time
+	test_clock_us += 100000;
+	fdelay.user.published(&fdelay.user, &ldp);
+	test_clock_us += 200000;
+	pa_fdelay_confirmed(&fdelay, PP(1), 64);
+	sput_fail_unless(fdelay.samples_n == 1, "One sample");
+	sput_fail_unless(fdelay.samples[0] == 300, "Correct latency");
+	sput_fail_unless(core.flooding_delay == 600, "Flooding delay updated");
+
+	//Confirmed once
+	pa_fdelay_confirmed(&fdelay, PP(1), 64);
+	sput_fail_unless(fdelay.samples_n == 1, "No new sample");
+
+	//Unpublished prefixes are forgotten
+	ldp.published = 0;
+	fdelay.user.published(&fdelay.user, &ldp);
+	ldp.published = 1;
+	fdelay.user.published(&fdelay.user, &ldp);
+	ldp.published = 0;
+	fdelay.user.published(&fdelay.user, &ldp);
+	pa_fdelay_confirmed(&fdelay, PP(1), 64);
+	sput_fail_unless(fdelay.samples_n == 1, "No new sample");
+
+	pa_fdelay_term(&fdelay);
+}
+
+int main() {
+	sput_start_testing();
+	sput_enter_suite("Flooding delay estimation tests"); /* optional */
+	sput_run_test(pa_fdelay_estimate_test);
+	sput_run_test(pa_fdelay_confirm_test);
+	sput_leave_suite(); /* optional */
+	sput_finish_testing();
+	return sput_get_return_value();
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define PA_WARNING(format, ...) printf("PA Warning : "format"\n", ##__VA_ARGS__)
+#define PA_INFO(format, ...)    printf("PA Info    : "format"\n", ##__VA_ARGS__)
+#define PA_DEBUG(format, ...)   printf("PA Debug   : "format"\n", ##__VA_ARGS__)
+
+#include "fake_uloop.h"
+
+#include "pa_rules.h"
+
+#include "pa_core.c"
+#include "pa_store.c"
+#include "pa_metrics.c"
+
+#include "sput.h"
+
+static struct pa_dp
+	d1 = {.plen = 56, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x01}}}};
+
+static struct pa_link l1 = {.name = "L1"};
+
+static struct pa_advp
+	advp1 = {.plen = 64, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x01, 0x01}}},
+			.priority = 2, .node_id = {0x222222}},
+	advp2 = {.plen = 57, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x01, 0x80}}},
+			.priority = 2, .node_id = {0x222222}};
+
+static char test_dir[] = "/tmp/test_pa_metrics.XXXXXX";
+static char test_path[sizeof(test_dir) + 16];
+
+/* Renders all metrics into a string, which must be freed. */
+static char *test_metrics(struct pa_metrics *metrics)
+{
+	char *buf = NULL;
+	size_t len;
+	FILE *f;
+	if(!(f = open_memstream(&buf, &len)))
+		return NULL;
+	sput_fail_if(pa_metrics_write(metrics, f), "Metrics written");
+	fclose(f);
+	return buf;
+}
+
+static int test_contains(const char *buf, const char *line)
+{
+	char l[256];
+	snprintf(l, sizeof(l), "\n%s\n", line);
+	return buf && strstr(buf, l) != NULL;
+}
+
+void pa_metrics_output()
+{
+	struct pa_core core;
+	struct pa_store store;
+	struct pa_metrics metrics;
+	struct pa_rule_static s1;
+	struct pa_user user = {};
+	char line[256], dp[PA_PREFIX_STRLEN];
+	char *buf;
+
+	fu_init();
+	pa_core_init(&core);
+	pa_store_init(&store, &core, 10);
+	pa_metrics_init(&metrics, &core, &store);
+	pa_user_register(&core, &user);
+
+	buf = test_metrics(&metrics);
+	sput_fail_unless(buf && !strncmp(buf, "# HELP pa_links ", 16), "First family");
+	sput_fail_unless(test_contains(buf, "pa_links 0"), "No link");
+	sput_fail_unless(test_contains(buf, "pa_store_max_prefixes 10"), "Store capacity");
+	sput_fail_unless(test_contains(buf, "pa_store_cached_prefixes 0"), "Empty store");
+	sput_fail_unless(test_contains(buf, "# TYPE pa_dp_available_ratio gauge"), "Empty family");
+	free(buf);
+
+	pa_rule_static_init(&s1);
+	s1.rule.name = "static \"a\\b\"";
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_advp_add(&core, &advp1);
+	pa_rule_add(&core, &s1.rule);
+	pa_prefix_tostring(dp, &d1.prefix, d1.plen);
+
+	buf = test_metrics(&metrics);
+	sput_fail_unless(test_contains(buf, "pa_links 1"), "One link");
+	sput_fail_unless(test_contains(buf, "pa_dps 1"), "One Delegated Prefix");
+	sput_fail_unless(test_contains(buf, "pa_pairs 1"), "One pair");
+	sput_fail_unless(test_contains(buf, "pa_assigned_prefixes 0"), "Not assigned");
+	sput_fail_unless(test_contains(buf, "pa_pending_routines 1"), "Pending routine");
+	snprintf(line, sizeof(line), "pa_dp_available_prefixes{dp=\"%s\",plen=\"64\"} 255", dp);
+	sput_fail_unless(test_contains(buf, line), "Available prefixes");
+	snprintf(line, sizeof(line), "pa_dp_available_ratio{dp=\"%s\"} 0.996094", dp);
+	sput_fail_unless(test_contains(buf, line), "Available ratio");
+	snprintf(line, sizeof(line), "pa_dp_waiting_pairs{dp=\"%s\"} 0", dp);
+	sput_fail_unless(test_contains(buf, line), "No waiting pair");
+	sput_fail_unless(test_contains(buf, "pa_advp_add_total 1"), "Stats counter");
+	sput_fail_unless(test_contains(buf, "# TYPE pa_advp_add_total counter"), "Counter type");
+	sput_fail_unless(test_contains(buf, "pa_rule_wins_total{rule=\"static \\\"a\\\\b\\\"\"} 0"), "Escaped rule name");
+	sput_fail_unless(test_contains(buf, "pa_rule_calls_total{rule=\"static \\\"a\\\\b\\\"\",function=\"match\"} 0"), "Rule calls");
+	sput_fail_unless(test_contains(buf, "# TYPE pa_convergence_milliseconds histogram"), "Histogram type");
+	sput_fail_unless(test_contains(buf, "pa_convergence_milliseconds_bucket{interval=\"created_applied\",le=\"0\"} 0"), "First bucket");
+	sput_fail_unless(test_contains(buf, "pa_event_loop_microseconds_bucket{kind=\"routine\",le=\"+Inf\"} 0"), "Last bucket");
+	sput_fail_unless(test_contains(buf, "pa_event_loop_microseconds_count{kind=\"user\"} 0"), "Histogram count");
+	sput_fail_unless(test_contains(buf, "pa_user_callback_microseconds_count{user=\"0\"} 0"), "Unnamed user");
+	sput_fail_unless(test_contains(buf, "pa_user_callback_microseconds_sum{user=\"store\"} 0"), "Named user");
+	free(buf);
+
+	//Half of the Delegated Prefix is used
+	pa_advp_add(&core, &advp2);
+	buf = test_metrics(&metrics);
+	snprintf(line, sizeof(line), "pa_dp_available_prefixes{dp=\"%s\",plen=\"64\"} 127", dp);
+	sput_fail_unless(test_contains(buf, line), "Half available");
+	snprintf(line, sizeof(line), "pa_dp_available_ratio{dp=\"%s\"} 0.496094", dp);
+	sput_fail_unless(test_contains(buf, line), "Half ratio");
+	free(buf);
+
+	//Counted prefix length is shorter than the Delegated Prefix
+	metrics.available_plen = 48;
+	buf = test_metrics(&metrics);
+	sput_fail_if(strstr(buf, "pa_dp_available_prefixes{"), "No prefix count");
+	snprintf(line, sizeof(line), "pa_dp_available_ratio{dp=\"%s\"} 0", dp);
+	sput_fail_unless(test_contains(buf, line), "Not available as a whole");
+	free(buf);
+
+	pa_user_unregister(&user);
+	pa_rule_del(&core, &s1.rule);
+	pa_advp_del(&core, &advp2);
+	pa_advp_del(&core, &advp1);
+	pa_dp_del(&d1);
+	pa_link_del(&l1);
+	pa_metrics_term(&metrics);
+	pa_store_term(&store);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+void pa_metrics_file()
+{
+	struct pa_core core;
+	struct pa_metrics metrics;
+	char buf[64];
+	FILE *f;
+
+	pa_core_init(&core);
+	pa_metrics_init(&metrics, &core, NULL);
+
+	snprintf(test_path, sizeof(test_path), "%s/metrics", test_dir);
+	sput_fail_if(pa_metrics_save(&metrics, test_path), "Saved");
+	sput_fail_unless((f = fopen(test_path, "r")), "File exists");
+	if(f) {
+		sput_fail_unless(fgets(buf, sizeof(buf), f) && !strncmp(buf, "# HELP pa_links ", 16), "File content");
+		sput_fail_if(strstr(buf, "store"), "No store");
+		fclose(f);
+	}
+	strcat(test_path, ".tmp");
+	sput_fail_unless(access(test_path, F_OK), "Temporary file renamed");
+
+	//Replaces the previous file
+	snprintf(test_path, sizeof(test_path), "%s/metrics", test_dir);
+	sput_fail_if(pa_metrics_save(&metrics, test_path), "Saved again");
+	unlink(test_path);
+
+	snprintf(test_path, sizeof(test_path), "%s/none/metrics", test_dir);
+	sput_fail_unless(pa_metrics_save(&metrics, test_path) == -1, "Invalid directory");
+}
+
+void pa_metrics_socket()
+{
+	struct pa_core core;
+	struct pa_metrics metrics;
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	char buf[4096];
+	size_t len = 0;
+	ssize_t n;
+	int fd;
+
+	pa_core_init(&core);
+	pa_metrics_init(&metrics, &core, NULL);
+	sput_fail_unless(pa_metrics_serve(&metrics) == -1, "Not listening");
+
+	snprintf(test_path, sizeof(test_path), "%s/sock", test_dir);
+	sput_fail_unless(pa_metrics_listen(&metrics, test_path) >= 0, "Listening");
+	sput_fail_unless(pa_metrics_listen(&metrics, test_path) == -1, "Already listening");
+	sput_fail_unless(pa_metrics_serve(&metrics) == 0, "No request");
+
+	strcpy(addr.sun_path, test_path);
+	sput_fail_unless((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0, "Client socket");
+	sput_fail_if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), "Connected");
+	sput_fail_unless(pa_metrics_serve(&metrics) == 1, "Request served");
+	while(len < sizeof(buf) - 1 && (n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += n;
+	buf[len] = '\0';
+	close(fd);
+	sput_fail_unless(!strncmp(buf, "# HELP pa_links ", 16), "Metrics received");
+	sput_fail_unless(test_contains(buf, "pa_links 0"), "Metrics content");
+
+	//Clients are not waited for
+	sput_fail_unless((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0, "Second client socket");
+	sput_fail_if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), "Second client connected");
+	close(fd);
+	sput_fail_unless(pa_metrics_serve(&metrics) == 0, "Closed client dropped");
+
+	pa_metrics_term(&metrics);
+	sput_fail_unless(access(test_path, F_OK), "Socket removed");
+	sput_fail_unless(pa_metrics_serve(&metrics) == -1, "Not listening anymore");
+}
+
+int main() {
+	if(!mkdtemp(test_dir))
+		return 1;
+
+	sput_start_testing();
+	sput_enter_suite("Prefix Assignment metrics tests"); /* optional */
+	sput_run_test(pa_metrics_output);
+	sput_run_test(pa_metrics_file);
+	sput_run_test(pa_metrics_socket);
+	sput_leave_suite(); /* optional */
+	sput_finish_testing();
+	rmdir(test_dir);
+	return sput_get_return_value();
+}
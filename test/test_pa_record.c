@@ -0,0 +1,324 @@
+/*
+ * Record and replay tests.
+ *
+ * When run with an argument, the given record is replayed at full speed:
+ *   test_pa_record <record-file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fake_uloop.h"
+
+/* Records use virtual time */
+#define pa_clock_us() ((uint64_t)_fu_time * 1000)
+
+#include "pa_rules.h"
+
+#include "pa_core.c"
+#include "pa_record.c"
+
+#include "sput.h"
+
+static struct pa_dp
+	d1 = {.plen = 56, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x01}}}},
+	d2 = {.plen = 56, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x02}}}};
+
+static struct pa_link l1, l2, l3;
+
+static struct pa_advp
+		advp1 = {.plen = 64, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x01, 0x01}}}, .priority = 2},
+		advp2 = {.plen = 64, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x02, 0x01}}}, .priority = 2},
+		advp3 = {.plen = 64, .priority = 3};
+
+/* Assignments at the end of the recording. */
+struct test_assignment {
+	const char *link;
+	pa_prefix dp;
+	pa_prefix prefix;
+	pa_plen plen;
+	uint8_t applied;
+};
+
+#define TEST_ASSIGNMENTS 8
+static struct test_assignment assignments[TEST_ASSIGNMENTS];
+static int assignments_n;
+
+static int64_t replay_base;
+
+static void test_set_time(__attribute__((unused)) struct pa_record *rec, uint64_t time)
+{
+	if(replay_base + (int64_t)time > _fu_time)
+		_fu_time = replay_base + (int64_t)time;
+}
+
+static void test_snapshot(struct pa_core *core)
+{
+	struct pa_link *link;
+	struct pa_ldp *ldp;
+	struct test_assignment *a;
+	assignments_n = 0;
+	pa_for_each_link(core, link) {
+		pa_for_each_ldp_in_link(link, ldp) {
+			if(!ldp->assigned || assignments_n == TEST_ASSIGNMENTS)
+				continue;
+			a = &assignments[assignments_n++];
+			a->link = link->name;
+			a->dp = ldp->dp->prefix;
+			pa_prefix_cpy(&ldp->prefix, ldp->plen, &a->prefix, a->plen);
+			a->applied = ldp->applied;
+		}
+	}
+}
+
+static int test_snapshot_cmp(struct pa_core *core)
+{
+	struct pa_link *link;
+	struct pa_ldp *ldp;
+	struct test_assignment *a;
+	int n = 0, i;
+	pa_for_each_link(core, link) {
+		pa_for_each_ldp_in_link(link, ldp) {
+			if(!ldp->assigned)
+				continue;
+			n++;
+			for(i = 0; i < assignments_n; i++) {
+				a = &assignments[i];
+				if(!strcmp(a->link, link->name) &&
+						!memcmp(&a->dp, &ldp->dp->prefix, sizeof(pa_prefix)))
+					break;
+			}
+			if(i == assignments_n ||
+					!pa_prefix_equals(&a->prefix, a->plen, &ldp->prefix, ldp->plen) ||
+					a->applied != ldp->applied)
+				return -1;
+		}
+	}
+	return (n == assignments_n)?0:-1;
+}
+
+void pa_record_replay()
+{
+	struct pa_core core;
+	struct pa_record rec;
+	struct pa_rule_adopt adopt;
+	struct pa_rule_random random;
+	struct pa_rule_static stat;
+	PA_NODE_ID_TYPE id = 0x111111;
+	uint64_t events;
+	FILE *f;
+	int ret;
+
+	fu_init();
+	srandom(1);
+	pa_core_init(&core);
+	sput_fail_unless((f = tmpfile()), "Temporary file");
+	if(!f)
+		return;
+
+	sput_fail_if(pa_record_start(&rec, &core, f), "Record started");
+	pa_core_set_node_id(&core, &id);
+
+	pa_rule_adopt_init(&adopt);
+	adopt.rule.name = "adopt";
+	adopt.rule_priority = 1;
+	adopt.priority = 2;
+	pa_rule_random_init(&random);
+	random.rule.name = "random";
+	random.rule_priority = 2;
+	random.priority = 2;
+	random.desired_plen = 64;
+	random.random_set_size = 16;
+	random.pseudo_random_tentatives = 0;
+	pa_rule_static_init(&stat);
+	stat.rule.name = "static";
+	stat.rule_priority = 3;
+	stat.priority = 2;
+	stat.override_priority = 0;
+	stat.override_rule_priority = 0;
+	stat.safety = 1;
+	stat.plen = 64;
+	stat.prefix = d2.prefix;
+	stat.prefix.s6_addr[7] = 0x42;
+
+	pa_link_init(&l1, "L1");
+	pa_link_init(&l2, "L2");
+	pa_link_init(&l3, "L3");
+
+	pa_core_config_begin(&core);
+	pa_rule_add(&core, &adopt.rule);
+	pa_rule_add(&core, &random.rule);
+	pa_link_add(&core, &l1);
+	pa_link_add(&core, &l2);
+	pa_link_add(&core, &l3);
+	pa_dp_add(&core, &d1);
+	pa_dp_add(&core, &d2);
+	pa_advp_add(&core, &advp1);
+	pa_core_config_commit(&core);
+	fu_loop(-1);
+
+	//Various inputs
+	pa_rule_add(&core, &stat.rule);
+	advp1.priority = 1;
+	pa_advp_update(&core, &advp1);
+	pa_advp_add(&core, &advp2);
+	pa_core_set_flooding_delay(&core, 5000);
+	fu_loop(-1);
+
+	//Override an assigned prefix
+	sput_fail_unless(l1.ldps.next != &l1.ldps, "L1 pairs");
+	if(l1.ldps.next == &l1.ldps)
+		return;
+	pa_prefix_cpy(&list_first_entry(&l1.ldps, struct pa_ldp, in_link)->prefix, 64,
+			&advp3.prefix, advp3.plen);
+	pa_advp_add(&core, &advp3);
+	pa_advp_del(&core, &advp1);
+	pa_link_suspend(&l2, 100);
+	fu_loop(4);
+	pa_core_flooding_synced(&core, &d1.prefix, d1.plen, 0);
+	pa_link_resume(&l2);
+	pa_link_del(&l3);
+	pa_rule_del(&core, &stat.rule);
+	pa_dp_update(&core, &d2);
+	fu_loop(-1);
+
+	test_snapshot(&core);
+	sput_fail_unless(assignments_n == 4, "Four assignments");
+	events = rec.events;
+	pa_record_stop(&rec);
+	sput_fail_unless(events > 20, "Recorded events");
+
+	pa_advp_del(&core, &advp2);
+	pa_advp_del(&core, &advp3);
+	pa_core_term(&core);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	//Replay with different random values
+	srandom(2);
+	rewind(f);
+	replay_base = _fu_time;
+	pa_core_init(&core);
+	rec.set_time = test_set_time;
+	rec.rule_get = NULL;
+	sput_fail_if(pa_replay_start(&rec, &core, f), "Replay started");
+	while((ret = pa_replay_step(&rec)) > 0);
+	sput_fail_if(ret, "Record end");
+	sput_fail_unless(rec.events == events, "All events replayed");
+	sput_fail_if(rec.diverged, "No divergence");
+	sput_fail_if(test_snapshot_cmp(&core), "Same assignments");
+	pa_replay_stop(&rec);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+	fclose(f);
+}
+
+void pa_record_errors()
+{
+	struct pa_core core;
+	struct pa_record rec;
+	FILE *f;
+
+	fu_init();
+	pa_core_init(&core);
+	sput_fail_unless((f = tmpfile()), "Temporary file");
+	if(!f)
+		return;
+
+	//Recording must start with an empty core
+	pa_link_init(&l1, "L1");
+	pa_link_add(&core, &l1);
+	sput_fail_unless(pa_record_start(&rec, &core, f) == -1, "Core is not empty");
+	pa_link_del(&l1);
+	pa_advp_add(&core, &advp1);
+	sput_fail_unless(pa_record_start(&rec, &core, f) == -1, "Core is not empty");
+	pa_advp_del(&core, &advp1);
+
+	//Invalid record
+	fputs("not a record", f);
+	rewind(f);
+	rec.set_time = test_set_time;
+	rec.rule_get = NULL;
+	sput_fail_unless(pa_replay_start(&rec, &core, f) == -1, "Invalid header");
+	sput_fail_if(core.record, "Not replaying");
+	fclose(f);
+
+	//Truncated record
+	sput_fail_unless((f = tmpfile()), "Temporary file");
+	if(!f)
+		return;
+	sput_fail_if(pa_record_start(&rec, &core, f), "Record started");
+	pa_link_add(&core, &l1);
+	pa_record_stop(&rec);
+	pa_link_del(&l1);
+	fputc(PA_RECORD_LINK_DEL, f);
+	rewind(f);
+	replay_base = _fu_time;
+	sput_fail_if(pa_replay_start(&rec, &core, f), "Replay started");
+	while(pa_replay_step(&rec) > 0);
+	sput_fail_unless(pa_replay_step(&rec) == 0, "Record end");
+	sput_fail_unless(core.links.next != &core.links, "Link was replayed");
+	pa_replay_stop(&rec);
+	sput_fail_unless(list_empty(&core.links), "Link was removed");
+	fclose(f);
+}
+
+static uint64_t test_wall_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int pa_record_main(const char *file)
+{
+	struct pa_core core;
+	struct pa_record rec;
+	uint64_t start, end;
+	FILE *f;
+	int ret;
+
+	if(!(f = fopen(file, "r"))) {
+		fprintf(stderr, "Could not open %s\n", file);
+		return 2;
+	}
+
+	fu_init();
+	replay_base = _fu_time;
+	pa_core_init(&core);
+	rec.set_time = test_set_time;
+	rec.rule_get = NULL;
+	if(pa_replay_start(&rec, &core, f)) {
+		fprintf(stderr, "Invalid record %s\n", file);
+		fclose(f);
+		return 2;
+	}
+
+	start = test_wall_us();
+	while((ret = pa_replay_step(&rec)) > 0);
+	end = test_wall_us();
+
+	printf("events             %"PRIu64"\n", rec.events);
+	printf("diverged           %"PRIu64"\n", rec.diverged);
+	printf("recorded time      %"PRId64" ms\n", _fu_time - replay_base);
+	printf("replay time        %"PRIu64" us\n", end - start);
+	if(ret < 0)
+		printf("record is truncated or corrupted\n");
+
+	pa_replay_stop(&rec);
+	fclose(f);
+	return (ret < 0 || rec.diverged)?1:0;
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1)
+		return pa_record_main(argv[1]);
+
+	sput_start_testing();
+	sput_enter_suite("Prefix Assignment record tests"); /* optional */
+	sput_run_test(pa_record_replay);
+	sput_run_test(pa_record_errors);
+	sput_leave_suite(); /* optional */
+	sput_finish_testing();
+	return sput_get_return_value();
+}
@@ -66,9 +66,10 @@ void pa_rules_random()
 {
 	struct pa_core core;
 	struct pa_dp dp = {.prefix = p1, .plen = 4};
-	struct pa_link link = {.name = "L1"};
+	struct pa_link link = {.name = "L1", .core = &core};
 	struct pa_advp advp = {.link = &link, .prefix = p1, .plen = 56};
-	struct pa_ldp ldp = {.core = &core, .dp = &dp, .link = &link, .prefix = p1, .plen = 2};
+	struct pa_ldp_sched sched = {};
+	struct pa_ldp ldp = {.dp = &dp, .link = &link, .prefix = p1, .plen = 2, .sched = &sched};
 	struct pa_rule_arg arg;
 
 	test_core_init(&core, 5);
@@ -83,12 +84,12 @@ void pa_rules_random()
 	random.pseudo_random_tentatives = 2;
 	random.random_set_size = 4;
 
-	ldp.best_assignment = &advp;
+	sched.best_assignment = &advp;
 	ldp.assigned = 1;
 	ldp.applied = 1;
 	test_rule_get_max_prio(&random.rule, &ldp, 0);
 
-	ldp.best_assignment = NULL;
+	sched.best_assignment = NULL;
 	ldp.published = 1;
 	test_rule_get_max_prio(&random.rule, &ldp, 0);
 
@@ -193,12 +194,85 @@ void pa_rules_random()
 	test_advp_del(&core, &advp);
 }
 
+void pa_rules_random_speculative()
+{
+	struct pa_core core;
+	struct pa_dp dp = {.prefix = p1, .plen = 56};
+	struct pa_link link = {.name = "L1", .core = &core};
+	struct pa_advp advp = {.link = &link, .prefix = p1, .plen = 60};
+	struct pa_ldp_sched sched = {};
+	struct pa_ldp ldp = {.dp = &dp, .link = &link, .sched = &sched};
+	struct pa_rule_arg arg;
+
+	test_core_init(&core, 5);
+
+	struct pa_rule_random random;
+	pa_rule_random_init(&random);
+	sput_fail_if(random.speculative, "Speculative disabled by default");
+	random.desired_plen = 60;
+	random.rule_priority = 3;
+	random.priority = 4;
+	random.pseudo_random_tentatives = 0;
+	random.random_set_size = 16;
+	random.speculative = 1;
+
+	fr_mask_md5 = false;
+	fr_mask_random = true;
+
+	//Candidate is computed when backoff starts
+	ldp.backoff = 0;
+	arg.speculative = 0;
+	fr_random_push(1);
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_BACKOFF);
+	sput_fail_unless(arg.speculative, "Speculative candidate");
+	test_rule_prefix(&arg, &p11, 60, 4);
+
+	//Done by pa_core
+	pa_prefix_cpy(&arg.prefix, arg.plen, &sched.candidate_prefix, sched.candidate_plen);
+	ldp.candidate = 1;
+
+	//Still in backoff, no new search
+	arg.speculative = 0;
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_BACKOFF);
+	sput_fail_unless(arg.speculative, "Speculative candidate");
+	test_rule_prefix(&arg, &p11, 60, 4);
+
+	//Backoff timeout uses the candidate
+	ldp.backoff = 1;
+	arg.speculative = 0;
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
+	sput_fail_if(arg.speculative, "Not speculative");
+	test_rule_prefix(&arg, &p11, 60, 4);
+
+	//Candidate is not available anymore
+	advp.prefix = p11;
+	test_advp_add(&core, &advp);
+	fr_random_push(1);
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
+	test_rule_prefix(&arg, &p12, 60, 4);
+	test_advp_del(&core, &advp);
+
+	//Candidate is ignored when not speculative
+	random.speculative = 0;
+	fr_random_push(0);
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_PUBLISH);
+	test_rule_prefix(&arg, &p1, 60, 4);
+
+	ldp.backoff = 0;
+	arg.speculative = 0;
+	test_rule_match(&random.rule, &ldp, 1, &arg, PA_RULE_BACKOFF);
+	sput_fail_if(arg.speculative, "Not speculative");
+
+	fr_mask_random = false;
+}
+
 void pa_rules_adopt()
 {
 	struct pa_core core;
 	struct pa_dp dp = {.prefix = p1, .plen = 4};
 	struct pa_link link = {.name = "L1"};
-	struct pa_ldp ldp = {.dp = &dp, .link = &link, .prefix = p101, .plen = 64};
+	struct pa_ldp_sched sched = {};
+	struct pa_ldp ldp = {.dp = &dp, .link = &link, .prefix = p101, .plen = 64, .sched = &sched};
 	struct pa_rule_arg arg;
 	test_core_init(&core, 5);
 
@@ -221,6 +295,7 @@ int main() {
 	sput_enter_suite("Prefix Assignment Rules tests"); /* optional */
 	sput_run_test(pa_rules_adopt);
 	sput_run_test(pa_rules_random);
+	sput_run_test(pa_rules_random_speculative);
 	sput_leave_suite(); /* optional */
 	sput_finish_testing();
 	return sput_get_return_value();
@@ -215,10 +215,11 @@ void pa_store_delays_test()
 	store.token_count = 0;
 
 	struct pa_link l;
-	struct pa_dp d;
+	struct pa_dp d = {.prefix = PV(0), .plen = 56};
 	struct pa_ldp ldp;
 	ldp.link = &l;
 	ldp.dp = &d;
+	ldp.rule = NULL;
 	ldp.prefix = PV(0);
 	ldp.plen = 64;
 	ldp.assigned = 0;
@@ -417,6 +418,9 @@ void pa_store_load_test()
 	pa_store_load_line("prefix ", -1);
 	pa_store_load_line("prefix nya notaprefix", -1);
 	pa_store_load_line("prefix nya ::/0 tomanyargs", -1);
+	pa_store_load_line("prefix nya 2001::/64 2001::/56 tomanyargs", -1);
+	pa_store_load_line("prefix nya 2001::/64 2001:1::/56", -1);
+	pa_store_load_line("prefix nya 2001::/56 2001::/64", -1);
 
 	struct pa_store_prefix *prefix;
 	struct pa_store_link *link;
@@ -430,11 +434,14 @@ void pa_store_load_test()
 	sput_fail_unless(link->n_prefixes == 1, "One single prefix");
 	sput_fail_unless(store.links.next->next == &store.links, "One single link");
 
-	//Load same prefix again
-	pa_store_load_line("prefix link0 2001:0:0:100::/64", 0);
+	sput_fail_if(prefix->dp_plen, "Unknown delegated prefix");
+
+	//Load same prefix again, with its delegated prefix
+	pa_store_load_line("prefix link0 2001:0:0:100::/64 2001:0:0:100::/56", 0);
 	sput_fail_unless(store.n_prefixes == 1, "Correct number of prefixes");
 	prefix = list_entry(store.prefixes.next, struct pa_store_prefix, in_store);
 	sput_fail_if(pa_prefix_cmp(&prefix->prefix, prefix->plen, PP(0), 64), "Correct prefix");
+	sput_fail_if(pa_prefix_cmp(&prefix->dp_prefix, prefix->dp_plen, PP(0), 56), "Correct delegated prefix");
 	link = list_entry(store.links.next, struct pa_store_link, le);
 	sput_fail_if(strcmp("link0", link->name), "Link name");
 	sput_fail_if(link->link, "Private link");
@@ -545,10 +552,11 @@ void pa_store_cache_test()
 	sput_fail_unless(list_empty(&store.links), "No links");
 
 	struct pa_link l;
-	struct pa_dp d;
+	struct pa_dp d = {.prefix = PV(0), .plen = 56};
 	struct pa_ldp ldp;
 	ldp.link = &l;
 	ldp.dp = &d;
+	ldp.rule = NULL;
 	ldp.prefix = PV(0);
 	ldp.plen = 64;
 	ldp.assigned = 0;
@@ -713,6 +721,117 @@ void pa_store_cache_test()
 	pa_store_term(&store);
 }
 
+static struct pa_ldp *test_ldp_get(struct pa_link *link, struct pa_dp *dp)
+{
+	struct pa_ldp *ldp;
+	pa_for_each_ldp_in_link(link, ldp)
+		if(ldp->dp == dp)
+			return ldp;
+	return NULL;
+}
+
+void pa_store_renumber_test()
+{
+	fu_init();
+	fake_files = 0;
+
+	struct pa_core core;
+	struct pa_link l1 = {.name = "link1"};
+	struct pa_dp dp = {.prefix = PV(0), .plen = 56},
+			new_dp = {.prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x02, 0x00}}}, .plen = 56},
+			other_dp = {.prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x04, 0x00}}}, .plen = 56},
+			ula = {.prefix = {{{0xfd, 0, 0, 0, 0, 0, 0, 0}}}, .plen = 56},
+			short_dp = {.prefix = {{{0x20, 0x01, 0, 0, 0, 0x03}}}, .plen = 48};
+	struct pa_store store;
+	struct pa_store_link ls1;
+	struct pa_store_rule rrule;
+	struct pa_store_prefix *prefix;
+	struct pa_advp a1, a2;
+	struct pa_ldp *ldp;
+	pa_prefix translated = {{{0x20, 0x01, 0, 0, 0, 0, 0x02, 0x05}}},
+			ula_prefix = {{{0xfd, 0, 0, 0, 0, 0, 0, 0x07}}};
+
+	core.node_id[0] = 5;
+	pa_core_init(&core);
+	pa_store_init(&store, &core, 10);
+	pa_store_link_init(&ls1, &l1, "stored_link1", 3);
+	pa_store_link_add(&store, &ls1);
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &dp);
+	pa_dp_add(&core, &ula);
+
+	rrule.priority = 4;
+	rrule.rule_priority = 3;
+	rrule.rule.name = "Renumbering";
+	pa_store_renumber_rule_init(&rrule, &store);
+	pa_rule_add(&core, &rrule.rule);
+
+	pa_prefix_cpy(PP(5), 64, &a1.prefix, a1.plen);
+	a1.priority = 2;
+	a1.link = &l1;
+	a1.node_id[0] = 2;
+	pa_advp_add(&core, &a1);
+	pa_prefix_cpy(&ula_prefix, 64, &a2.prefix, a2.plen);
+	a2.priority = 2;
+	a2.link = &l1;
+	a2.node_id[0] = 2;
+	pa_advp_add(&core, &a2);
+	fu_loop(-1); //Routines and apply
+	sput_fail_unless(test_ldp_get(&l1, &dp)->applied, "Prefix applied");
+	sput_fail_unless(test_ldp_get(&l1, &ula)->applied, "ULA prefix applied");
+	sput_fail_unless(store.n_prefixes == 2, "Prefixes cached");
+	prefix = list_entry(ls1.prefixes.prev, struct pa_store_prefix, in_link);
+	sput_fail_if(pa_prefix_cmp(&prefix->dp_prefix, prefix->dp_plen, &dp.prefix, dp.plen), "Delegated prefix cached");
+
+	//The old dp still exists, so nothing is translated
+	pa_advp_del(&core, &a1);
+	pa_advp_del(&core, &a2);
+	pa_dp_add(&core, &new_dp);
+	fu_loop(-1);
+	pa_for_each_ldp_in_link(&l1, ldp)
+		sput_fail_if(ldp->assigned, "No prefix on link");
+
+	//Renumbering, the ULA was already used on the link and is not renumbered
+	pa_dp_del(&dp);
+	pa_dp_del(&ula);
+	pa_dp_del(&new_dp);
+	pa_dp_add(&core, &ula);
+	pa_dp_add(&core, &new_dp);
+	ldp = test_ldp_get(&l1, &new_dp);
+	fu_loop(2); //Published without backoff
+	sput_fail_unless(ldp->assigned && ldp->published, "Prefix published");
+	sput_fail_if(pa_prefix_cmp(&translated, 64, &ldp->prefix, ldp->plen), "Translated prefix");
+	sput_fail_unless(ldp->priority == 4, "Correct priority");
+	sput_fail_unless(ldp->rule_priority == 3, "Correct rule priority");
+	sput_fail_if(test_ldp_get(&l1, &ula)->assigned, "No ULA prefix");
+
+	//The renumbered prefix replaces the old one
+	fu_loop(-1);
+	sput_fail_unless(ldp->applied, "Prefix applied");
+	sput_fail_unless(store.n_prefixes == 2, "Old prefix uncached");
+	list_for_each_entry(prefix, &ls1.prefixes, in_link)
+		sput_fail_if(!pa_prefix_cmp(&prefix->prefix, prefix->plen, PP(5), 64), "Old prefix uncached");
+
+	//Stale prefixes are not renumbered into other dps
+	pa_dp_add(&core, &other_dp);
+	fu_loop(-1);
+	sput_fail_if(test_ldp_get(&l1, &other_dp)->assigned, "No prefix on link");
+	pa_dp_del(&other_dp);
+
+	//Delegated prefix length changes
+	pa_dp_del(&new_dp);
+	pa_dp_add(&core, &short_dp);
+	fu_loop(-1);
+	sput_fail_if(test_ldp_get(&l1, &short_dp)->assigned, "No prefix on link");
+
+	pa_rule_del(&core, &rrule.rule);
+	pa_link_del(&l1);
+	pa_dp_del(&short_dp);
+	pa_dp_del(&ula);
+	pa_store_link_remove(&store, &ls1);
+	pa_store_term(&store);
+}
+
 int main() {
 	sput_start_testing();
 	sput_enter_suite("Prefix Assignment Storage tests"); /* optional */
@@ -722,6 +841,7 @@ int main() {
 	sput_run_test(pa_store_saveload_test);
 	sput_run_test(pa_store_delays_test);
 	sput_run_test(pa_store_rule_test);
+	sput_run_test(pa_store_renumber_test);
 	sput_leave_suite(); /* optional */
 	sput_finish_testing();
 	return sput_get_return_value();
@@ -0,0 +1,272 @@
+/*
+ * Trace ring buffer tests.
+ *
+ * When run with an argument, the given trace file is decoded:
+ *   test_pa_trace <trace-file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_uloop.h"
+
+/* Traces use virtual time */
+#define pa_clock_us() ((uint64_t)_fu_time * 1000)
+
+#include "pa_rules.h"
+
+#include "pa_core.c"
+#include "pa_trace.c"
+
+#include "sput.h"
+
+static struct pa_dp
+	d1 = {.plen = 56, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x01}}}};
+
+static struct pa_link l1;
+
+static struct pa_advp
+		advp1 = {.plen = 64, .prefix = {{{0x20, 0x01, 0, 0, 0, 0, 0x01, 0x01}}}, .priority = 2};
+
+static const struct {
+	uint8_t type;
+	uint8_t value;
+} expected[] = {
+		{PA_TRACE_LDP_CREATE, 0},
+		{PA_TRACE_ADVP_ADD, 0},
+		{PA_TRACE_ROUTINE, 0},
+		{PA_TRACE_ASSIGN, 1},
+		{PA_TRACE_APPLY, 1},
+		{PA_TRACE_ADVP_DEL, 0},
+		{PA_TRACE_ROUTINE, 0},
+		{PA_TRACE_APPLY, 0},
+		{PA_TRACE_ASSIGN, 0},
+		{PA_TRACE_WAIT, 0},
+		{PA_TRACE_LDP_DESTROY, 0},
+};
+
+#define EXPECTED_N (sizeof(expected) / sizeof(expected[0]))
+
+void pa_trace_events()
+{
+	struct pa_core core;
+	struct pa_trace_event events[PA_TRACE];
+	struct pa_ldp *ldp;
+	size_t n, i;
+	uint64_t start;
+
+	fu_init();
+	pa_core_init(&core);
+	sput_fail_if(pa_trace_get(&core, events, PA_TRACE), "Empty trace");
+
+	start = pa_clock_us();
+	pa_link_init(&l1, "L1");
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	ldp = list_first_entry(&d1.ldps, struct pa_ldp, in_dp);
+	advp1.link = &l1;
+	advp1.node_id[0] = 0x111111;
+	pa_advp_add(&core, &advp1);
+	fu_loop(2); //Routine, then apply
+	pa_advp_del(&core, &advp1);
+	fu_loop(1); //Routine
+	pa_dp_del(&d1);
+	pa_link_del(&l1);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+
+	n = pa_trace_get(&core, events, PA_TRACE);
+	sput_fail_unless(n == EXPECTED_N, "Traced events");
+	for(i = 0; i < n && i < EXPECTED_N; i++) {
+		sput_fail_unless(events[i].type == expected[i].type &&
+				events[i].value == expected[i].value, "Event type");
+		sput_fail_unless(i == 1 || i == 5 || events[i].object == ldp, "Pair event");
+	}
+	sput_fail_unless(events[1].object == &advp1 &&
+			pa_prefix_equals(&events[1].prefix, events[1].plen, &advp1.prefix, advp1.plen) &&
+			events[1].priority == 2, "Advertised Prefix event");
+	sput_fail_unless(pa_prefix_equals(&events[3].prefix, events[3].plen, &advp1.prefix, advp1.plen),
+			"Assigned prefix");
+	sput_fail_unless(events[0].time == start, "Creation time");
+	sput_fail_unless(events[3].time == start + PA_RUN_DELAY * 1000, "Assignment time");
+	sput_fail_unless(events[4].time == events[3].time + 2000 * (uint64_t)core.flooding_delay, "Application time");
+	sput_fail_unless(pa_trace_get(&core, events, 3) == 3 && events[0].type == PA_TRACE_ASSIGN &&
+			events[2].type == PA_TRACE_LDP_DESTROY, "Last events, oldest first");
+
+	//Ring buffer wraps around
+	for(i = 0; i < 2 * PA_TRACE; i++) {
+		advp1.priority = i;
+		pa_advp_update(&core, &advp1);
+	}
+	sput_fail_unless(core.trace_n == EXPECTED_N + 2 * PA_TRACE, "Total events");
+	n = pa_trace_get(&core, events, PA_TRACE);
+	sput_fail_unless(n == PA_TRACE, "Full trace");
+	for(i = 0; i < n; i++)
+		sput_fail_unless(events[i].type == PA_TRACE_ADVP_UPDATE &&
+				events[i].priority == PA_TRACE + i, "Last events in order");
+
+	pa_core_term(&core);
+	sput_fail_if(pa_trace_get(&core, events, PA_TRACE) != PA_TRACE, "Trace kept when terminated");
+	advp1.priority = 2;
+}
+
+void pa_trace_file()
+{
+	struct pa_core core;
+	struct pa_trace_event events[PA_TRACE], e;
+	size_t n, i;
+	FILE *f;
+
+	fu_init();
+	pa_core_init(&core);
+	sput_fail_unless((f = tmpfile()), "Temporary file");
+	if(!f)
+		return;
+
+	for(i = 0; i < PA_TRACE + 4; i++) {
+		advp1.priority = i;
+		if(i % 2)
+			pa_advp_del(&core, &advp1);
+		else
+			pa_advp_add(&core, &advp1);
+	}
+
+	sput_fail_if(pa_trace_write(&core, f, 8), "Written");
+	rewind(f);
+	n = pa_trace_get(&core, events, PA_TRACE);
+	sput_fail_if(pa_trace_read_header(f), "Valid header");
+	for(i = 0; i < 8; i++) {
+		sput_fail_unless(pa_trace_read(f, &e) == 1, "Event read");
+		sput_fail_if(memcmp(&e, &events[n - 8 + i], sizeof(e)), "Same event");
+	}
+	sput_fail_unless(pa_trace_read(f, &e) == 0, "End of trace");
+
+	//Truncated event
+	fputc(0, f);
+	fseek(f, -1, SEEK_END);
+	sput_fail_unless(pa_trace_read(f, &e) == -1, "Truncated trace");
+	fclose(f);
+
+	//Invalid header
+	sput_fail_unless((f = tmpfile()), "Temporary file");
+	if(!f)
+		return;
+	fputs("not a trace", f);
+	rewind(f);
+	sput_fail_unless(pa_trace_read_header(f) == -1, "Invalid header");
+	fclose(f);
+
+	//Printing
+	sput_fail_unless((f = tmpfile()), "Temporary file");
+	if(!f)
+		return;
+	pa_trace_print(f, &events[n - 1]);
+	sput_fail_unless(ftell(f) > 0, "Event printed");
+	fclose(f);
+
+	sput_fail_unless(!strcmp(pa_trace_type_str(PA_TRACE_ASSIGN), "assign"), "Type name");
+	sput_fail_unless(!strcmp(pa_trace_type_str(PA_TRACE_TYPE_MAX), "unknown"), "Unknown type name");
+	pa_core_term(&core);
+	advp1.priority = 2;
+}
+
+void pa_trace_rule_events()
+{
+	struct pa_core core;
+	struct pa_trace_event events[PA_TRACE];
+	struct pa_rule_static stat;
+	char line[256];
+	size_t n, i;
+	FILE *f;
+
+	fu_init();
+	pa_core_init(&core);
+	pa_rule_static_init(&stat);
+	stat.rule.name = "static";
+	stat.rule_priority = 2;
+	stat.priority = 2;
+	stat.override_priority = 0;
+	stat.override_rule_priority = 0;
+	stat.safety = 1;
+	stat.plen = 64;
+	stat.prefix = d1.prefix;
+	stat.prefix.s6_addr[7] = 0x42;
+
+	pa_link_init(&l1, "L1");
+	pa_link_add(&core, &l1);
+	pa_dp_add(&core, &d1);
+	pa_rule_add(&core, &stat.rule);
+	fu_loop(1); //Routine starts backoff
+
+	n = pa_trace_get(&core, events, PA_TRACE);
+	for(i = 0; i < n && events[i].type != PA_TRACE_RULE; i++);
+	sput_fail_unless(i < n, "Rule event");
+	if(i < n) {
+		sput_fail_unless(!strcmp(events[i].rule, "static"), "Winning rule");
+		sput_fail_unless(events[i].value == PA_RULE_BACKOFF, "Backoff target");
+		sput_fail_unless(events[i].rule_priority == 0, "No priority");
+	}
+
+	stat.rule.name = "static rule with a long name";
+	fu_loop(1); //Backoff routine publishes the static prefix
+	n = pa_trace_get(&core, events, PA_TRACE);
+	for(i = n; i && events[i - 1].type != PA_TRACE_RULE; i--);
+	sput_fail_unless(i--, "Rule event");
+	if(i < n) {
+		sput_fail_unless(!strcmp(events[i].rule, "static rule wit"), "Truncated rule name");
+		sput_fail_unless(events[i].value == PA_RULE_PUBLISH, "Publish target");
+		sput_fail_unless(pa_prefix_equals(&events[i].prefix, events[i].plen, &stat.prefix, stat.plen),
+				"Published prefix");
+		sput_fail_unless(events[i].rule_priority == 2, "Rule priority");
+		if((f = tmpfile())) {
+			pa_trace_print(f, &events[i]);
+			rewind(f);
+			sput_fail_unless(fgets(line, sizeof(line), f) && strstr(line, " publish rule='static rule wit' "),
+					"Rule name printed");
+			fclose(f);
+		}
+	}
+	pa_core_term(&core);
+	sput_fail_if(fu_next(), "No scheduled timer.");
+}
+
+static int pa_trace_main(const char *file)
+{
+	struct pa_trace_event e;
+	FILE *f;
+	int ret;
+
+	if(!(f = fopen(file, "r"))) {
+		fprintf(stderr, "Could not open %s\n", file);
+		return 2;
+	}
+
+	if(pa_trace_read_header(f)) {
+		fprintf(stderr, "Invalid trace %s\n", file);
+		fclose(f);
+		return 2;
+	}
+
+	while((ret = pa_trace_read(f, &e)) > 0)
+		pa_trace_print(stdout, &e);
+
+	if(ret < 0)
+		printf("trace is truncated\n");
+
+	fclose(f);
+	return (ret < 0)?1:0;
+}
+
+int main(int argc, char **argv) {
+	if(argc > 1)
+		return pa_trace_main(argv[1]);
+
+	sput_start_testing();
+	sput_enter_suite("Prefix Assignment trace tests"); /* optional */
+	sput_run_test(pa_trace_events);
+	sput_run_test(pa_trace_file);
+	sput_run_test(pa_trace_rule_events);
+	sput_leave_suite(); /* optional */
+	sput_finish_testing();
+	return sput_get_return_value();
+}